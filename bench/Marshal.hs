@@ -0,0 +1,82 @@
+{-# Language OverloadedStrings #-}
+{-|
+Module      : Main
+Description : Allocation benchmark for extension message marshaling
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+Compares the heap allocation needed to marshal incoming IRC messages
+for extensions using per-field allocation and the reusable arena.
+
+Usage: @marshal [FILE]@ where @FILE@ contains raw IRC lines, one per
+line. Without a file a synthetic corpus of 100,000 lines is used.
+
+-}
+module Main (main) where
+
+import           Client.CApi (withRawIrcMsg, withRawIrcMsgs)
+import           Client.CApi.Arena (newArena)
+import           Control.Exception (evaluate)
+import           Control.Monad (forM_)
+import qualified Data.ByteString.Char8 as B
+import           Data.Foldable (foldl')
+import           Data.Int (Int64)
+import           Data.List.Split (chunksOf)
+import           Data.Time (diffUTCTime, getCurrentTime)
+import           Irc.RawIrcMsg
+import           System.Environment (getArgs)
+import           System.Mem (getAllocationCounter, performGC)
+import           Text.Printf (printf)
+
+main :: IO ()
+main =
+  do args  <- getArgs
+     raw   <- case args of
+                [path] -> B.lines <$> B.readFile path
+                _      -> return syntheticCorpus
+     let msgs = [ (line, msg) | line <- raw, Just msg <- [parseRawIrcMsg (asUtf8 line)] ]
+     _ <- evaluate (foldl' (\acc (_,m) -> acc + length (_msgParams m)) 0 msgs)
+     let n = length msgs
+     printf "messages: %d\n" n
+
+     report "per-field" n $
+       forM_ msgs $ \(_,m) -> withRawIrcMsg "network" m (\_ -> return ())
+
+     arena <- newArena
+     report "arena" n $
+       forM_ msgs $ \(l,m) -> withRawIrcMsgs arena "network" [(l,m,"")] (\_ -> return ())
+
+     report "arena, bursts of 64" n $
+       forM_ (chunksOf 64 msgs) $ \ms ->
+         withRawIrcMsgs arena "network" [ (l,m,"") | (l,m) <- ms ] (\_ -> return ())
+
+-- | Run an action and print the bytes allocated and time taken per message.
+report :: String -> Int -> IO () -> IO ()
+report name n action =
+  do performGC
+     before <- getAllocationCounter
+     start  <- getCurrentTime
+     action
+     end    <- getCurrentTime
+     after  <- getAllocationCounter
+     let bytes = fromIntegral (before - after :: Int64) :: Double
+         secs  = realToFrac (diffUTCTime end start) :: Double
+     printf "%-20s %10.1f bytes/msg %10.1f ns/msg\n"
+       name (bytes / fromIntegral n) (secs * 1e9 / fromIntegral n)
+
+-- | 100,000 lines resembling a busy network: tagged channel messages,
+-- membership changes, and numerics.
+syntheticCorpus :: [B.ByteString]
+syntheticCorpus = take 100000 (cycle samples)
+  where
+    samples =
+      [ "@time=2018-01-01T00:00:00.000Z;account=alice :alice!alice@example.com PRIVMSG #haskell :has anyone tried the new release yet?"
+      , ":bob!~bob@192.0.2.1 PRIVMSG #haskell :\206\187> map (+1) [1,2,3]"
+      , ":carol!carol@gateway/web/irccloud.com/x-abcdef JOIN #haskell"
+      , ":dave!dave@unaffiliated/dave QUIT :Ping timeout: 246 seconds"
+      , ":irc.example.net 353 me = #haskell :alice bob carol dave eve mallory trent peggy victor"
+      , ":eve!eve@example.org NOTICE me :this is a private notice"
+      , "PING :irc.example.net"
+      , ":mallory!m@203.0.113.7 NICK :mallory_"
+      ]
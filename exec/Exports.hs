@@ -14,8 +14,10 @@ import Client.CApi.Types
 import Foreign.C
 
 foreign export ccall glirc_send_message       :: Glirc_send_message
+foreign export ccall glirc_send_messages      :: Glirc_send_messages
 foreign export ccall glirc_print              :: Glirc_print
 foreign export ccall glirc_inject_chat        :: Glirc_inject_chat
+foreign export ccall glirc_inject_chats       :: Glirc_inject_chats
 foreign export ccall glirc_list_networks      :: Glirc_list_networks
 foreign export ccall glirc_identifier_cmp     :: Glirc_identifier_cmp
 foreign export ccall glirc_is_channel         :: Glirc_is_channel
@@ -23,8 +25,14 @@ foreign export ccall glirc_is_logged_on       :: Glirc_is_channel
 foreign export ccall glirc_list_channels      :: Glirc_list_channels
 foreign export ccall glirc_list_channel_users :: Glirc_list_channel_users
 foreign export ccall glirc_my_nick            :: Glirc_my_nick
+foreign export ccall glirc_my_userinfo        :: Glirc_my_userinfo
 foreign export ccall glirc_mark_seen          :: Glirc_mark_seen
 foreign export ccall glirc_clear_window       :: Glirc_clear_window
 foreign export ccall glirc_free_string        :: Glirc_free_string
 foreign export ccall glirc_free_strings       :: Glirc_free_strings
 foreign export ccall glirc_current_focus      :: Glirc_current_focus
+foreign export ccall glirc_timer_start        :: Glirc_timer_start
+foreign export ccall glirc_timer_cancel       :: Glirc_timer_cancel
+foreign export ccall glirc_watch_fd           :: Glirc_watch_fd
+foreign export ccall glirc_unwatch_fd         :: Glirc_unwatch_fd
+foreign export ccall glirc_callback_stats     :: Glirc_callback_stats
@@ -1,8 +1,16 @@
 #ifndef GLIRC_API
 #define GLIRC_API
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "glirc-codes.h"
+
+/* Version of the glirc_extension layout understood by this header.
+ * Extensions announce it by exporting glirc_extension_api_version,
+ * see GLIRC_EXTENSION_API_VERSION below. */
+#define GLIRC_API_VERSION 4
+
 struct glirc;
 
 enum message_code {
@@ -15,11 +23,56 @@ enum process_result {
         DROP_MESSAGE = 1
 };
 
+/* Readiness conditions for glirc_watch_fd */
+enum fd_events {
+        GLIRC_FD_READ  = 1,
+        GLIRC_FD_WRITE = 2,
+        GLIRC_FD_ERROR = 4  /* fd could not be watched, the watch is removed */
+};
+
+/* Callbacks measured by glirc_callback_stats */
+enum glirc_callback {
+        GLIRC_CALLBACK_START   = 0,
+        GLIRC_CALLBACK_MESSAGE = 1, /* process_message and process_messages */
+        GLIRC_CALLBACK_CHAT    = 2,
+        GLIRC_CALLBACK_COMMAND = 3
+};
+
+#define GLIRC_STATS_BUCKETS 24
+
+/* Counters for one callback of one extension */
+struct glirc_callback_stats {
+        unsigned long calls;
+        unsigned long messages; /* messages passed across all calls */
+        unsigned long drops;    /* messages dropped */
+        uint64_t total_ns;
+        uint64_t max_ns;
+        /* histogram[0] counts calls under 1us and histogram[i] calls from
+         * 2^(i-1) up to 2^i us. The last bucket also counts slower calls. */
+        unsigned long histogram[GLIRC_STATS_BUCKETS];
+};
+
 struct glirc_string {
         const char *str;
         size_t len;
 };
 
+/* Kinds of glirc_member_change */
+enum member_change_kind {
+        GLIRC_MEMBER_JOIN  = 0,
+        GLIRC_MEMBER_PART  = 1,
+        GLIRC_MEMBER_KICK  = 2,
+        GLIRC_MEMBER_QUIT  = 3,
+        GLIRC_MEMBER_NICK  = 4,
+        GLIRC_MEMBER_RESET = 5  /* forget every member of the channel */
+};
+
+/* Byte range within glirc_message.raw */
+struct glirc_span {
+        size_t offset;
+        size_t len;
+};
+
 struct glirc_message {
         struct glirc_string network;
         struct glirc_string prefix_nick;
@@ -31,6 +84,27 @@ struct glirc_message {
         const struct glirc_string *tagkeys;
         const struct glirc_string *tagvals;
         size_t tags_n;
+
+        /* Fields below this point are only set on messages received from
+         * the server and are ignored by glirc_send_message. raw.str is NULL
+         * when the line is not available, in which case the spans are 0. */
+        struct glirc_string raw;              /* line as received, without CR LF */
+        struct glirc_span prefix_span;        /* prefix without ':', len 0 if absent */
+        struct glirc_span command_span;
+        const struct glirc_span *param_spans; /* params_n entries */
+
+        /* Also only set on received messages: well-known tags decoded by
+         * the client, and the batch the message belongs to. The strings
+         * are empty when the tag is absent. */
+        int64_t server_time;                  /* time tag in ns since the epoch, 0 if absent */
+        struct glirc_string msgid;
+        struct glirc_string account;
+        struct glirc_string batch_ref;        /* value of the batch tag */
+        struct glirc_string batch_type;       /* type given when that batch started */
+
+        /* Set on every message given to an extension, ignored by
+         * glirc_send_message. Equal to glirc_command_code(command). */
+        enum glirc_command_code command_code;
 };
 
 struct glirc_chat {
@@ -39,16 +113,134 @@ struct glirc_chat {
         struct glirc_string message;
 };
 
+/* Chat message shown by glirc_inject_chats */
+struct glirc_injected_chat {
+        struct glirc_string network;
+        struct glirc_string source; /* nick!user@host */
+        struct glirc_string target;
+        struct glirc_string message;
+};
+
 struct glirc_command {
         struct glirc_string command;
 };
 
+/* Change to the members of one channel. nick is empty for
+ * GLIRC_MEMBER_RESET and new_nick is only set for GLIRC_MEMBER_NICK. */
+struct glirc_member_change {
+        int kind; /* enum member_change_kind */
+        struct glirc_string network;
+        struct glirc_string channel;
+        struct glirc_string nick;
+        struct glirc_string new_nick;
+};
+
 typedef void *start_type         (struct glirc *G, const char *path);
 typedef void stop_type           (struct glirc *G, void *S);
 typedef enum process_result process_message_type(struct glirc *G, void *S, const struct glirc_message *);
 typedef enum process_result process_chat_type(struct glirc *G, void *S, const struct glirc_chat *);
 typedef void process_command_type(struct glirc *G, void *S, const struct glirc_command *);
 
+/* Process a burst of messages received together. drops is a zeroed bitmap
+ * with one bit per message; set bit i to drop msgs[i].
+ *
+ * Every message of a burst, up to 256 lines, is offered to the
+ * extensions before the client applies any of them. process_message is
+ * called for each message of the burst in the same way. While these
+ * callbacks run, queries such as glirc_my_nick, glirc_is_logged_on and
+ * glirc_list_channel_users return the state from before the burst.
+ * For example, a NICK early in the burst is not yet reflected when a
+ * later message of the same burst is processed. Extensions that need
+ * the state a message leads to should track it from the messages
+ * themselves. */
+typedef void process_messages_type(struct glirc *G, void *S,
+                const struct glirc_message * const *msgs, size_t n,
+                unsigned char *drops);
+
+/* Process membership changes in the order they happened */
+typedef void process_member_changes_type(struct glirc *G, void *S,
+                const struct glirc_member_change *changes, size_t n);
+
+/* Called once when a timer started with glirc_timer_start is due */
+typedef void timer_callback_type(struct glirc *G, void *dat);
+typedef long timer_id;
+
+/* Called with the conditions that hold each time a watched fd is ready */
+typedef void fd_callback_type(struct glirc *G, void *dat, int fd, int events);
+typedef long watch_id;
+
+static inline void glirc_drop_message(unsigned char *drops, size_t i)
+{
+        drops[i / 8] |= (unsigned char)(1u << (i % 8));
+}
+
+/* Code of a command name for switch-based dispatch, GLIRC_CMD_UNKNOWN
+ * when it is neither a three digit numeric nor a known verb. Verbs are
+ * matched exactly as the server sends them, in upper case. */
+static inline enum glirc_command_code glirc_command_code(struct glirc_string cmd)
+{
+        if (cmd.len == 3 &&
+            cmd.str[0] >= '0' && cmd.str[0] <= '9' &&
+            cmd.str[1] >= '0' && cmd.str[1] <= '9' &&
+            cmd.str[2] >= '0' && cmd.str[2] <= '9') {
+                return (enum glirc_command_code)
+                        ((cmd.str[0] - '0') * 100 + (cmd.str[1] - '0') * 10 + (cmd.str[2] - '0'));
+        }
+
+#define GLIRC_VERB_CASE(verb) \
+        if (cmd.len == sizeof #verb - 1) { \
+                size_t i = 0; \
+                while (i < cmd.len && cmd.str[i] == #verb[i]) i++; \
+                if (i == cmd.len) return GLIRC_CMD_##verb; \
+        }
+        GLIRC_COMMAND_VERBS(GLIRC_VERB_CASE)
+#undef GLIRC_VERB_CASE
+
+        return GLIRC_CMD_UNKNOWN;
+}
+
+/* Nicknames and channel names are compared without regard to case using
+ * the RFC 2812 rules: a-z and {|}~ fold to A-Z and [\]^. The functions
+ * below work on the UTF-8 bytes of an identifier and agree with the
+ * client's Irc.Identifier, so they can be used in place of
+ * glirc_identifier_cmp and to key hash tables by identifier. */
+static inline unsigned char glirc_id_fold_char(unsigned char c)
+{
+        return c >= 'a' && c <= '~' ? (unsigned char)(c - ('a' - 'A')) : c;
+}
+
+/* Fold len bytes of src into dst. dst may be the same as src. */
+static inline void glirc_id_casefold(char *dst, const char *src, size_t len)
+{
+        for (size_t i = 0; i < len; i++) {
+                dst[i] = (char)glirc_id_fold_char((unsigned char)src[i]);
+        }
+}
+
+/* Returns -1, 0, or 1 like glirc_identifier_cmp */
+static inline int glirc_id_cmp(struct glirc_string s, struct glirc_string t)
+{
+        size_t n = s.len < t.len ? s.len : t.len;
+        for (size_t i = 0; i < n; i++) {
+                unsigned char x = glirc_id_fold_char((unsigned char)s.str[i]);
+                unsigned char y = glirc_id_fold_char((unsigned char)t.str[i]);
+                if (x != y) return x < y ? -1 : 1;
+        }
+        return s.len < t.len ? -1 : s.len > t.len ? 1 : 0;
+}
+
+/* 64-bit FNV-1a hash of the folded identifier. Identifiers that compare
+ * equal have the same hash. Matches idHash64 in Irc.Identifier. */
+static inline uint64_t glirc_id_hash(struct glirc_string s)
+{
+        uint64_t h = UINT64_C(0xcbf29ce484222325);
+        for (size_t i = 0; i < s.len; i++) {
+                h ^= glirc_id_fold_char((unsigned char)s.str[i]);
+                h *= UINT64_C(0x100000001b3);
+        }
+        return h;
+}
+
 struct glirc_extension {
         const char *name;
         int major_version, minor_version;
@@ -57,8 +249,52 @@ struct glirc_extension {
         process_message_type *process_message;
         process_command_type *process_command;
         process_chat_type    *process_chat;
+
+        /* Fields below this point are only read when the extension
+         * exports a glirc_extension_api_version of at least the version
+         * listed next to the field. Extensions that don't export it are
+         * version 0, and their struct ends here. */
+
+        /* 1: NULL-terminated list of commands that process_message and
+         * process_messages want to see, or NULL for every message */
+        const char * const *message_commands;
+
+        /* 2: used instead of process_message when set */
+        process_messages_type *process_messages;
+
+        /* 3: when nonzero, the message callbacks are called on a dedicated
+         * thread with the messages the client accepted, and their drop
+         * results are ignored. Calls made through G on that thread wait
+         * until the client is next running extension callbacks. */
+        int observe_only;
+
+        /* 4: called on the client thread, even for observe_only
+         * extensions, with changes to the members of joined channels.
+         * The members of each channel are sent as a GLIRC_MEMBER_RESET
+         * followed by joins when the extension starts and when the
+         * server sends a names list. Leaving a channel is reported as a
+         * part or kick of your own nick, and disconnecting as a reset
+         * of each channel. */
+        process_member_changes_type *process_member_changes;
 };
 
+/* Defines the glirc_extension_api_version symbol, which tells the
+ * client how much of struct glirc_extension it can read. Use it once,
+ * at file scope, next to the extension definition:
+ *
+ *   GLIRC_EXTENSION_API_VERSION;
+ *   struct glirc_extension extension = { ... };
+ */
+#ifdef __cplusplus
+#define GLIRC_EXTENSION_API_VERSION \
+        extern "C" __attribute__ ((visibility ("default"))) \
+        const int glirc_extension_api_version = GLIRC_API_VERSION
+#else
+#define GLIRC_EXTENSION_API_VERSION \
+        __attribute__ ((visibility ("default"))) \
+        const int glirc_extension_api_version = GLIRC_API_VERSION
+#endif
+
 int glirc_send_message(struct glirc *G, const struct glirc_message *);
 int glirc_print(struct glirc *G, enum message_code, const char *msg, size_t msglen);
 int glirc_inject_chat(struct glirc *G,
@@ -66,11 +302,27 @@ int glirc_inject_chat(struct glirc *G,
                 const char* src, size_t srcLen,
                 const char* tgt, size_t tgtLen,
                 const char* msg, size_t msgLen);
+
+/* Send n messages, locking the client state once and finding the
+ * connection once for each run of messages to the same network. Returns
+ * 0 when every message was sent. */
+int glirc_send_messages(struct glirc *G, const struct glirc_message *msgs, size_t n);
+
+/* Record n chat messages like glirc_inject_chat under a single lock of
+ * the client state. Returns 0 on success. */
+int glirc_inject_chats(struct glirc *G, const struct glirc_injected_chat *chats, size_t n);
+
 char ** glirc_list_networks(struct glirc *G);
 char ** glirc_list_channels(struct glirc *G, struct glirc_string network);
 char ** glirc_list_channel_users(struct glirc *G, struct glirc_string network, struct glirc_string channel);
 void glirc_current_focus(struct glirc *G, char **net, size_t *netlen, char **tgt , size_t *tgtlen);
 char * glirc_my_nick(struct glirc *G, const char *net, size_t netlen);
+
+/* Our nick!user@host on a network as others see it, or NULL when not
+ * connected. The user and host are left out until the client learns
+ * them on joining a channel. Free with glirc_free_string. */
+char * glirc_my_userinfo(struct glirc *G, const char *net, size_t netlen);
+
 void glirc_mark_seen(struct glirc *G, struct glirc_string network, struct glirc_string channel);
 void glirc_clear_window(struct glirc *G, struct glirc_string network, struct glirc_string channel);
 int glirc_identifier_cmp(struct glirc_string s, struct glirc_string t);
@@ -79,6 +331,29 @@ int glirc_is_channel(struct glirc *G, const char *net, size_t netlen,
 int glirc_is_logged_on(struct glirc *G, const char *net, size_t netlen,
                                         const char *tgt, size_t tgtlen);
 
+/* Call cb with dat after at least millis milliseconds. Timers are
+ * canceled when extensions are stopped. Returns 0 on failure. */
+timer_id glirc_timer_start(struct glirc *G, unsigned long millis,
+                timer_callback_type *cb, void *dat);
+
+/* Cancel a timer that has not fired. Returns its dat, or NULL when
+ * the timer already fired or was canceled. */
+void *glirc_timer_cancel(struct glirc *G, timer_id timer);
+
+/* Call cb from the client's event loop whenever fd is ready for any of
+ * the given fd_events. The watch remains until it is removed or the
+ * extensions are stopped. Returns 0 on failure. */
+watch_id glirc_watch_fd(struct glirc *G, int fd, int events,
+                fd_callback_type *cb, void *dat);
+
+/* Remove a watch. Returns its dat, or NULL when there is no such watch. */
+void *glirc_unwatch_fd(struct glirc *G, watch_id watch);
+
+/* Copy the counters of a callback of the loaded extension with the given
+ * name into stats. Returns 0 on success. */
+int glirc_callback_stats(struct glirc *G, const char *ext, size_t extlen,
+                enum glirc_callback callback, struct glirc_callback_stats *stats);
+
 void glirc_free_string(char *);
 void glirc_free_strings(char **);
 
@@ -0,0 +1,455 @@
+/* Generated by glirc-codes.sh from lib/src/Irc/Codes.hs, do not edit */
+#ifndef GLIRC_CODES
+#define GLIRC_CODES
+
+/* Values of glirc_message.command_code. A numeric reply's code is its
+ * number, so several names can share a value. Known verbs are numbered
+ * from 1000. Anything else, including the numeric 000, is
+ * GLIRC_CMD_UNKNOWN. */
+enum glirc_command_code {
+        GLIRC_CMD_UNKNOWN = 0,
+        GLIRC_RPL_WELCOME                    = 1,
+        GLIRC_RPL_YOURHOST                   = 2,
+        GLIRC_RPL_CREATED                    = 3,
+        GLIRC_RPL_MYINFO                     = 4,
+        GLIRC_RPL_ISUPPORT                   = 5,
+        GLIRC_RPL_SNOMASK                    = 8,
+        GLIRC_RPL_STATMEMTOT                 = 9,
+        GLIRC_RPL_REDIR                      = 10,
+        GLIRC_RPL_YOURCOOKIE                 = 14,
+        GLIRC_RPL_MAP                        = 15,
+        GLIRC_RPL_MAPEND                     = 17,
+        GLIRC_RPL_YOURID                     = 42,
+        GLIRC_RPL_SAVENICK                   = 43,
+        GLIRC_RPL_ATTEMPTINGJUNC             = 50,
+        GLIRC_RPL_ATTEMPTINGREROUTE          = 51,
+        GLIRC_RPL_TRACELINK                  = 200,
+        GLIRC_RPL_TRACECONNECTING            = 201,
+        GLIRC_RPL_TRACEHANDSHAKE             = 202,
+        GLIRC_RPL_TRACEUNKNOWN               = 203,
+        GLIRC_RPL_TRACEOPERATOR              = 204,
+        GLIRC_RPL_TRACEUSER                  = 205,
+        GLIRC_RPL_TRACESERVER                = 206,
+        GLIRC_RPL_TRACESERVICE               = 207,
+        GLIRC_RPL_TRACENEWTYPE               = 208,
+        GLIRC_RPL_TRACECLASS                 = 209,
+        GLIRC_RPL_TRACERECONNECT             = 210,
+        GLIRC_RPL_STATS                      = 210,
+        GLIRC_RPL_STATSLINKINFO              = 211,
+        GLIRC_RPL_STATSCOMMANDS              = 212,
+        GLIRC_RPL_STATSCLINE                 = 213,
+        GLIRC_RPL_STATSNLINE                 = 214,
+        GLIRC_RPL_STATSILINE                 = 215,
+        GLIRC_RPL_STATSKLINE                 = 216,
+        GLIRC_RPL_STATSQLINE                 = 217,
+        GLIRC_RPL_STATSYLINE                 = 218,
+        GLIRC_RPL_ENDOFSTATS                 = 219,
+        GLIRC_RPL_STATSPLINE                 = 220,
+        GLIRC_RPL_UMODEIS                    = 221,
+        GLIRC_RPL_SQLINE_NICK                = 222,
+        GLIRC_RPL_STATSDLINE                 = 225,
+        GLIRC_RPL_STATSZLINE                 = 225,
+        GLIRC_RPL_STATSCOUNT                 = 226,
+        GLIRC_RPL_SERVICEINFO                = 231,
+        GLIRC_RPL_ENDOFSERVICES              = 232,
+        GLIRC_RPL_SERVICE                    = 233,
+        GLIRC_RPL_SERVLIST                   = 234,
+        GLIRC_RPL_SERVLISTEND                = 235,
+        GLIRC_RPL_STATSVERBOSE               = 236,
+        GLIRC_RPL_STATSIAUTH                 = 239,
+        GLIRC_RPL_STATSLLINE                 = 241,
+        GLIRC_RPL_STATSUPTIME                = 242,
+        GLIRC_RPL_STATSOLINE                 = 243,
+        GLIRC_RPL_STATSHLINE                 = 244,
+        GLIRC_RPL_STATSSLINE                 = 245,
+        GLIRC_RPL_STATSPING                  = 246,
+        GLIRC_RPL_STATSXLINE                 = 247,
+        GLIRC_RPL_STATSULINE                 = 248,
+        GLIRC_RPL_STATSDEBUG                 = 249,
+        GLIRC_RPL_STATSCONN                  = 250,
+        GLIRC_RPL_LUSERCLIENT                = 251,
+        GLIRC_RPL_LUSEROP                    = 252,
+        GLIRC_RPL_LUSERUNKNOWN               = 253,
+        GLIRC_RPL_LUSERCHANNELS              = 254,
+        GLIRC_RPL_LUSERME                    = 255,
+        GLIRC_RPL_ADMINME                    = 256,
+        GLIRC_RPL_ADMINLOC1                  = 257,
+        GLIRC_RPL_ADMINLOC2                  = 258,
+        GLIRC_RPL_ADMINEMAIL                 = 259,
+        GLIRC_RPL_TRACELOG                   = 261,
+        GLIRC_RPL_ENDOFTRACE                 = 262,
+        GLIRC_RPL_LOAD2HI                    = 263,
+        GLIRC_RPL_LOCALUSERS                 = 265,
+        GLIRC_RPL_GLOBALUSERS                = 266,
+        GLIRC_RPL_START_NETSTAT              = 267,
+        GLIRC_RPL_NETSTAT                    = 268,
+        GLIRC_RPL_END_NETSTAT                = 269,
+        GLIRC_RPL_PRIVS                      = 270,
+        GLIRC_RPL_SILELIST                   = 271,
+        GLIRC_RPL_ENDOFSILELIST              = 272,
+        GLIRC_RPL_NOTIFY                     = 273,
+        GLIRC_RPL_ENDNOTIFY                  = 274,
+        GLIRC_RPL_STATSDELTA                 = 274,
+        GLIRC_RPL_WHOISCERTFP                = 276,
+        GLIRC_RPL_VCHANLIST                  = 277,
+        GLIRC_RPL_VCHANHELP                  = 278,
+        GLIRC_RPL_GLIST                      = 280,
+        GLIRC_RPL_ACCEPTLIST                 = 281,
+        GLIRC_RPL_ENDOFACCEPT                = 282,
+        GLIRC_RPL_ENDOFJUPELIST              = 283,
+        GLIRC_RPL_FEATURE                    = 284,
+        GLIRC_RPL_DATASTR                    = 290,
+        GLIRC_RPL_END_CHANINFO               = 299,
+        GLIRC_RPL_NONE                       = 300,
+        GLIRC_RPL_AWAY                       = 301,
+        GLIRC_RPL_USERHOST                   = 302,
+        GLIRC_RPL_ISON                       = 303,
+        GLIRC_RPL_TEXT                       = 304,
+        GLIRC_RPL_UNAWAY                     = 305,
+        GLIRC_RPL_NOWAWAY                    = 306,
+        GLIRC_RPL_WHOISREGNICK               = 307,
+        GLIRC_RPL_SUSERHOST                  = 307,
+        GLIRC_RPL_NOTIFYACTION               = 308,
+        GLIRC_RPL_WHOISADMIN                 = 308,
+        GLIRC_RPL_NICKTRACE                  = 309,
+        GLIRC_RPL_WHOISSADMIN                = 309,
+        GLIRC_RPL_WHOISHELPER                = 309,
+        GLIRC_RPL_WHOISUSER                  = 311,
+        GLIRC_RPL_WHOISSERVER                = 312,
+        GLIRC_RPL_WHOISOPERATOR              = 313,
+        GLIRC_RPL_WHOWASUSER                 = 314,
+        GLIRC_RPL_ENDOFWHO                   = 315,
+        GLIRC_RPL_WHOISCHANOP                = 316,
+        GLIRC_RPL_WHOISIDLE                  = 317,
+        GLIRC_RPL_ENDOFWHOIS                 = 318,
+        GLIRC_RPL_WHOISCHANNELS              = 319,
+        GLIRC_RPL_WHOISSPECIAL               = 320,
+        GLIRC_RPL_LISTSTART                  = 321,
+        GLIRC_RPL_LIST                       = 322,
+        GLIRC_RPL_LISTEND                    = 323,
+        GLIRC_RPL_CHANNELMODEIS              = 324,
+        GLIRC_RPL_CHANNELMLOCKIS             = 325,
+        GLIRC_RPL_NOCHANPASS                 = 326,
+        GLIRC_RPL_CHPASSUNKNOWN              = 327,
+        GLIRC_RPL_CHANNEL_URL                = 328,
+        GLIRC_RPL_CREATIONTIME               = 329,
+        GLIRC_RPL_WHOWAS_TIME                = 330,
+        GLIRC_RPL_WHOISACCOUNT               = 330,
+        GLIRC_RPL_NOTOPIC                    = 331,
+        GLIRC_RPL_TOPIC                      = 332,
+        GLIRC_RPL_TOPICWHOTIME               = 333,
+        GLIRC_RPL_LISTUSAGE                  = 334,
+        GLIRC_RPL_COMMANDSYNTAX              = 334,
+        GLIRC_RPL_LISTSYNTAX                 = 334,
+        GLIRC_RPL_WHOISACTUALLY              = 338,
+        GLIRC_RPL_BADCHANPASS                = 339,
+        GLIRC_RPL_INVITING                   = 341,
+        GLIRC_RPL_SUMMONING                  = 342,
+        GLIRC_RPL_INVITED                    = 345,
+        GLIRC_RPL_INVEXLIST                  = 346,
+        GLIRC_RPL_ENDOFINVEXLIST             = 347,
+        GLIRC_RPL_EXCEPTLIST                 = 348,
+        GLIRC_RPL_ENDOFEXCEPTLIST            = 349,
+        GLIRC_RPL_VERSION                    = 351,
+        GLIRC_RPL_WHOREPLY                   = 352,
+        GLIRC_RPL_NAMREPLY                   = 353,
+        GLIRC_RPL_WHOSPCRPL                  = 354,
+        GLIRC_RPL_NAMREPLY_                  = 355,
+        GLIRC_RPL_WHOWASREAL                 = 360,
+        GLIRC_RPL_KILLDONE                   = 361,
+        GLIRC_RPL_CLOSING                    = 362,
+        GLIRC_RPL_CLOSEEND                   = 363,
+        GLIRC_RPL_LINKS                      = 364,
+        GLIRC_RPL_ENDOFLINKS                 = 365,
+        GLIRC_RPL_ENDOFNAMES                 = 366,
+        GLIRC_RPL_BANLIST                    = 367,
+        GLIRC_RPL_ENDOFBANLIST               = 368,
+        GLIRC_RPL_ENDOFWHOWAS                = 369,
+        GLIRC_RPL_INFO                       = 371,
+        GLIRC_RPL_MOTD                       = 372,
+        GLIRC_RPL_INFOSTART                  = 373,
+        GLIRC_RPL_ENDOFINFO                  = 374,
+        GLIRC_RPL_MOTDSTART                  = 375,
+        GLIRC_RPL_ENDOFMOTD                  = 376,
+        GLIRC_RPL_WHOISHOST                  = 378,
+        GLIRC_RPL_KICKLINKED                 = 379,
+        GLIRC_RPL_YOUREOPER                  = 381,
+        GLIRC_RPL_REHASHING                  = 382,
+        GLIRC_RPL_YOURESERVICE               = 383,
+        GLIRC_RPL_MYPORTIS                   = 384,
+        GLIRC_RPL_NOTOPERANYMORE             = 385,
+        GLIRC_RPL_RSACHALLENGE               = 386,
+        GLIRC_RPL_TIME                       = 391,
+        GLIRC_RPL_USERSSTART                 = 392,
+        GLIRC_RPL_USERS                      = 393,
+        GLIRC_RPL_ENDOFUSERS                 = 394,
+        GLIRC_RPL_NOUSERS                    = 395,
+        GLIRC_RPL_HOSTHIDDEN                 = 396,
+        GLIRC_ERR_UNKNOWNERROR               = 400,
+        GLIRC_ERR_NOSUCHNICK                 = 401,
+        GLIRC_ERR_NOSUCHSERVER               = 402,
+        GLIRC_ERR_NOSUCHCHANNEL              = 403,
+        GLIRC_ERR_CANNOTSENDTOCHAN           = 404,
+        GLIRC_ERR_TOOMANYCHANNELS            = 405,
+        GLIRC_ERR_WASNOSUCHNICK              = 406,
+        GLIRC_ERR_TOOMANYTARGETS             = 407,
+        GLIRC_ERR_NOORIGIN                   = 409,
+        GLIRC_ERR_NORECIPIENT                = 411,
+        GLIRC_ERR_NOTEXTTOSEND               = 412,
+        GLIRC_ERR_NOTOPLEVEL                 = 413,
+        GLIRC_ERR_WILDTOPLEVEL               = 414,
+        GLIRC_ERR_BADMASK                    = 415,
+        GLIRC_ERR_TOOMANYMATCHES             = 416,
+        GLIRC_ERR_LENGTHTRUNCATED            = 419,
+        GLIRC_ERR_UNKNOWNCOMMAND             = 421,
+        GLIRC_ERR_NOMOTD                     = 422,
+        GLIRC_ERR_NOADMININFO                = 423,
+        GLIRC_ERR_FILEERROR                  = 424,
+        GLIRC_ERR_NOOPERMOTD                 = 425,
+        GLIRC_ERR_TOOMANYAWAY                = 429,
+        GLIRC_ERR_EVENTNICKCHANGE            = 430,
+        GLIRC_ERR_NONICKNAMEGIVEN            = 431,
+        GLIRC_ERR_ERRONEUSNICKNAME           = 432,
+        GLIRC_ERR_NICKNAMEINUSE              = 433,
+        GLIRC_ERR_SERVICENAMEINUSE           = 434,
+        GLIRC_ERR_NORULES                    = 434,
+        GLIRC_ERR_BANNICKCHANGE              = 435,
+        GLIRC_ERR_NICKCOLLISION              = 436,
+        GLIRC_ERR_UNAVAILRESOURCE            = 437,
+        GLIRC_ERR_NICKTOOFAST                = 438,
+        GLIRC_ERR_TARGETTOOFAST              = 439,
+        GLIRC_ERR_SERVICESDOWN               = 440,
+        GLIRC_ERR_USERNOTINCHANNEL           = 441,
+        GLIRC_ERR_NOTONCHANNEL               = 442,
+        GLIRC_ERR_USERONCHANNEL              = 443,
+        GLIRC_ERR_NOLOGIN                    = 444,
+        GLIRC_ERR_SUMMONDISABLED             = 445,
+        GLIRC_ERR_USERSDISABLED              = 446,
+        GLIRC_ERR_NONICKCHANGE               = 447,
+        GLIRC_ERR_NOTIMPLEMENTED             = 449,
+        GLIRC_ERR_NOTREGISTERED              = 451,
+        GLIRC_ERR_IDCOLLISION                = 452,
+        GLIRC_ERR_NICKLOST                   = 453,
+        GLIRC_ERR_HOSTILENAME                = 455,
+        GLIRC_ERR_ACCEPTFULL                 = 456,
+        GLIRC_ERR_ACCEPTEXIST                = 457,
+        GLIRC_ERR_ACCEPTNOT                  = 458,
+        GLIRC_ERR_NOHIDING                   = 459,
+        GLIRC_ERR_NOTFORHALFOPS              = 460,
+        GLIRC_ERR_NEEDMOREPARAMS             = 461,
+        GLIRC_ERR_ALREADYREGISTERED          = 462,
+        GLIRC_ERR_NOPERMFORHOST              = 463,
+        GLIRC_ERR_PASSWDMISMATCH             = 464,
+        GLIRC_ERR_YOUREBANNEDCREEP           = 465,
+        GLIRC_ERR_YOUWILLBEBANNED            = 466,
+        GLIRC_ERR_KEYSET                     = 467,
+        GLIRC_ERR_INVALIDUSERNAME            = 468,
+        GLIRC_ERR_ONLYSERVERSCANCHANGE       = 468,
+        GLIRC_ERR_LINKSET                    = 469,
+        GLIRC_ERR_LINKCHANNEL                = 470,
+        GLIRC_ERR_CHANNELISFULL              = 471,
+        GLIRC_ERR_UNKNOWNMODE                = 472,
+        GLIRC_ERR_INVITEONLYCHAN             = 473,
+        GLIRC_ERR_BANNEDFROMCHAN             = 474,
+        GLIRC_ERR_BADCHANNELKEY              = 475,
+        GLIRC_ERR_BADCHANMASK                = 476,
+        GLIRC_ERR_NEEDREGGEDNICK             = 477,
+        GLIRC_ERR_BANLISTFULL                = 478,
+        GLIRC_ERR_BADCHANNAME                = 479,
+        GLIRC_ERR_THROTTLE                   = 480,
+        GLIRC_ERR_NOPRIVILEGES               = 481,
+        GLIRC_ERR_CHANOPRIVSNEEDED           = 482,
+        GLIRC_ERR_CANTKILLSERVER             = 483,
+        GLIRC_ERR_ISCHANSERVICE              = 484,
+        GLIRC_ERR_BANNEDNICK                 = 485,
+        GLIRC_ERR_NONONREG                   = 486,
+        GLIRC_ERR_TSLESSCHAN                 = 488,
+        GLIRC_ERR_VOICENEEDED                = 489,
+        GLIRC_ERR_NOOPERHOST                 = 491,
+        GLIRC_ERR_NOSERVICEHOST              = 492,
+        GLIRC_ERR_NOFEATURE                  = 493,
+        GLIRC_ERR_OWNMODE                    = 494,
+        GLIRC_ERR_BADLOGTYPE                 = 495,
+        GLIRC_ERR_BADLOGSYS                  = 496,
+        GLIRC_ERR_BADLOGVALUE                = 497,
+        GLIRC_ERR_ISOPERLCHAN                = 498,
+        GLIRC_ERR_CHANOWNPRIVNEEDED          = 499,
+        GLIRC_ERR_UMODEUNKNOWNFLAG           = 501,
+        GLIRC_ERR_USERSDONTMATCH             = 502,
+        GLIRC_ERR_GHOSTEDCLIENT              = 503,
+        GLIRC_ERR_USERNOTONSERV              = 504,
+        GLIRC_ERR_SILELISTFULL               = 511,
+        GLIRC_ERR_TOOMANYWATCH               = 512,
+        GLIRC_ERR_WRONGPONG                  = 513,
+        GLIRC_ERR_BADEXPIRE                  = 515,
+        GLIRC_ERR_DONTCHEAT                  = 516,
+        GLIRC_ERR_DISABLED                   = 517,
+        GLIRC_ERR_NOINVITE                   = 518,
+        GLIRC_ERR_LONGMASK                   = 518,
+        GLIRC_ERR_ADMONLY                    = 519,
+        GLIRC_ERR_TOOMANYUSERS               = 519,
+        GLIRC_ERR_OPERONLY                   = 520,
+        GLIRC_ERR_MASKTOOWIDE                = 520,
+        GLIRC_ERR_WHOTRUNC                   = 520,
+        GLIRC_ERR_LISTSYNTAX                 = 521,
+        GLIRC_ERR_WHOSYNTAX                  = 522,
+        GLIRC_ERR_WHOLIMEXCEED               = 523,
+        GLIRC_ERR_HELPNOTFOUND               = 524,
+        GLIRC_ERR_REMOTEPFX                  = 525,
+        GLIRC_ERR_PFXUNROUTABLE              = 526,
+        GLIRC_ERR_BADHOSTMASK                = 550,
+        GLIRC_ERR_HOSTUNAVAIL                = 551,
+        GLIRC_ERR_USINGSLINE                 = 552,
+        GLIRC_ERR_STATSSLINE                 = 553,
+        GLIRC_RPL_LOGON                      = 600,
+        GLIRC_RPL_LOGOFF                     = 601,
+        GLIRC_RPL_WATCHOFF                   = 602,
+        GLIRC_RPL_WATCHSTAT                  = 603,
+        GLIRC_RPL_NOWON                      = 604,
+        GLIRC_RPL_NOWOFF                     = 605,
+        GLIRC_RPL_WATCHLIST                  = 606,
+        GLIRC_RPL_ENDOFWATCHLIST             = 607,
+        GLIRC_RPL_WATCHCLEAR                 = 608,
+        GLIRC_RPL_ISOPER                     = 610,
+        GLIRC_RPL_ISLOCOP                    = 611,
+        GLIRC_RPL_ISNOTOPER                  = 612,
+        GLIRC_RPL_ENDOFISOPER                = 613,
+        GLIRC_RPL_DCCSTATUS                  = 617,
+        GLIRC_RPL_DCCLIST                    = 618,
+        GLIRC_RPL_ENDOFDCCLIST               = 619,
+        GLIRC_RPL_WHOWASHOST                 = 619,
+        GLIRC_RPL_DCCINFO                    = 620,
+        GLIRC_RPL_RULES                      = 621,
+        GLIRC_RPL_ENDOFO                     = 626,
+        GLIRC_RPL_SETTINGS                   = 630,
+        GLIRC_RPL_ENDOFSETTINGS              = 631,
+        GLIRC_RPL_DUMPING                    = 640,
+        GLIRC_RPL_DUMPRPL                    = 641,
+        GLIRC_RPL_EODUMP                     = 642,
+        GLIRC_RPL_TRACEROUTE_HOP             = 660,
+        GLIRC_RPL_TRACEROUTE_START           = 661,
+        GLIRC_RPL_MODECHANGEWARN             = 662,
+        GLIRC_RPL_CHANREDIR                  = 663,
+        GLIRC_RPL_SERVMODEIS                 = 664,
+        GLIRC_RPL_OTHERUMODEIS               = 665,
+        GLIRC_RPL_ENDOF_GENERIC              = 666,
+        GLIRC_RPL_WHOWASDETAILS              = 670,
+        GLIRC_RPL_WHOISSECURE                = 671,
+        GLIRC_RPL_UNKNOWNMODES               = 672,
+        GLIRC_RPL_CANNOTSETMODES             = 673,
+        GLIRC_RPL_LUSERSTAFF                 = 678,
+        GLIRC_RPL_TIMEONSERVERIS             = 679,
+        GLIRC_RPL_NETWORKS                   = 682,
+        GLIRC_RPL_YOURLANGUAGEIS             = 687,
+        GLIRC_RPL_LANGUAGE                   = 688,
+        GLIRC_RPL_WHOISSTAFF                 = 689,
+        GLIRC_RPL_WHOISLANGUAGE              = 690,
+        GLIRC_RPL_MODLIST                    = 702,
+        GLIRC_RPL_ENDOFMODLIST               = 703,
+        GLIRC_RPL_HELPSTART                  = 704,
+        GLIRC_RPL_HELPTXT                    = 705,
+        GLIRC_RPL_ENDOFHELP                  = 706,
+        GLIRC_ERR_TARGCHANGE                 = 707,
+        GLIRC_RPL_ETRACEFULL                 = 708,
+        GLIRC_RPL_ETRACE                     = 709,
+        GLIRC_RPL_KNOCK                      = 710,
+        GLIRC_RPL_KNOCKDLVR                  = 711,
+        GLIRC_ERR_TOOMANYKNOCK               = 712,
+        GLIRC_ERR_CHANOPEN                   = 713,
+        GLIRC_ERR_KNOCKONCHAN                = 714,
+        GLIRC_ERR_KNOCKDISABLED              = 715,
+        GLIRC_RPL_TARGUMODEG                 = 716,
+        GLIRC_RPL_TARGNOTIFY                 = 717,
+        GLIRC_RPL_UMODEGMSG                  = 718,
+        GLIRC_RPL_OMOTDSTART                 = 720,
+        GLIRC_RPL_OMOTD                      = 721,
+        GLIRC_RPL_ENDOFOMOTD                 = 722,
+        GLIRC_ERR_NOPRIVS                    = 723,
+        GLIRC_RPL_TESTMASK                   = 724,
+        GLIRC_RPL_TESTLINE                   = 725,
+        GLIRC_RPL_NOTESTLINE                 = 726,
+        GLIRC_RPL_QUIETLIST                  = 728,
+        GLIRC_RPL_ENDOFQUIETLIST             = 729,
+        GLIRC_RPL_MONONLINE                  = 730,
+        GLIRC_RPL_MONOFFLINE                 = 731,
+        GLIRC_RPL_MONLIST                    = 732,
+        GLIRC_RPL_ENDOFMONLIST               = 733,
+        GLIRC_ERR_MONLISTFULL                = 734,
+        GLIRC_RPL_RSACHALLENGE2              = 740,
+        GLIRC_RPL_ENDOFRSACHALLENGE2         = 741,
+        GLIRC_ERR_MLOCKRESTRICTED            = 742,
+        GLIRC_RPL_SCANMATCHED                = 750,
+        GLIRC_RPL_SCANUMODES                 = 751,
+        GLIRC_RPL_XINFO                      = 771,
+        GLIRC_RPL_XINFOSTART                 = 773,
+        GLIRC_RPL_XINFOEND                   = 774,
+        GLIRC_RPL_LOGGEDIN                   = 900,
+        GLIRC_RPL_LOGGEDOUT                  = 901,
+        GLIRC_RPL_NICKLOCKED                 = 902,
+        GLIRC_RPL_SASLSUCCESS                = 903,
+        GLIRC_RPL_SASLFAIL                   = 904,
+        GLIRC_RPL_SASLTOOLONG                = 905,
+        GLIRC_RPL_SASLABORTED                = 906,
+        GLIRC_RPL_SASLALREADY                = 907,
+        GLIRC_RPL_SASLMECHS                  = 908,
+        GLIRC_ERR_CANNOTDOCOMMAND            = 972,
+        GLIRC_ERR_CANNOTCHANGEUMODE          = 973,
+        GLIRC_ERR_CANNOTCHANGECHANMODE       = 974,
+        GLIRC_ERR_CANNOTCHANGESERVERMODE     = 975,
+        GLIRC_ERR_CANNOTSENDTONICK           = 976,
+        GLIRC_ERR_UNKNOWNSERVERMODE          = 977,
+        GLIRC_ERR_SERVERMODELOCK             = 979,
+        GLIRC_ERR_BADCHARENCODING            = 980,
+        GLIRC_ERR_TOOMANYLANGUAGES           = 981,
+        GLIRC_ERR_NOLANGUAGE                 = 982,
+        GLIRC_ERR_TEXTTOOSHORT               = 983,
+        GLIRC_ERR_NUMERIC_ERR                = 999,
+        GLIRC_CMD_ACCOUNT                    = 1000,
+        GLIRC_CMD_AUTHENTICATE               = 1001,
+        GLIRC_CMD_AWAY                       = 1002,
+        GLIRC_CMD_BATCH                      = 1003,
+        GLIRC_CMD_CAP                        = 1004,
+        GLIRC_CMD_CHGHOST                    = 1005,
+        GLIRC_CMD_ERROR                      = 1006,
+        GLIRC_CMD_INVITE                     = 1007,
+        GLIRC_CMD_JOIN                       = 1008,
+        GLIRC_CMD_KICK                       = 1009,
+        GLIRC_CMD_MODE                       = 1010,
+        GLIRC_CMD_NICK                       = 1011,
+        GLIRC_CMD_NOTICE                     = 1012,
+        GLIRC_CMD_PART                       = 1013,
+        GLIRC_CMD_PING                       = 1014,
+        GLIRC_CMD_PONG                       = 1015,
+        GLIRC_CMD_PRIVMSG                    = 1016,
+        GLIRC_CMD_QUIT                       = 1017,
+        GLIRC_CMD_TAGMSG                     = 1018,
+        GLIRC_CMD_TOPIC                      = 1019,
+        GLIRC_CMD_WALLOPS                    = 1020,
+        GLIRC_CMD_COUNT = 1021 /* one more than the largest code */
+};
+
+/* X(verb) for each known verb, used by glirc_command_code */
+#define GLIRC_COMMAND_VERBS(X) \
+        X(ACCOUNT) \
+        X(AUTHENTICATE) \
+        X(AWAY) \
+        X(BATCH) \
+        X(CAP) \
+        X(CHGHOST) \
+        X(ERROR) \
+        X(INVITE) \
+        X(JOIN) \
+        X(KICK) \
+        X(MODE) \
+        X(NICK) \
+        X(NOTICE) \
+        X(PART) \
+        X(PING) \
+        X(PONG) \
+        X(PRIVMSG) \
+        X(QUIT) \
+        X(TAGMSG) \
+        X(TOPIC) \
+        X(WALLOPS) \
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Regenerate glirc-codes.h from the reply codes in lib/src/Irc/Codes.hs.
+# Run from the repository root after adding codes or verbs:
+#
+#   sh include/glirc-codes.sh > include/glirc-codes.h
+#
+# Verbs are listed here. Keep them in step with commandCode in
+# src/Client/CApi/Types.hsc, the test suite checks that they agree.
+
+VERBS="ACCOUNT AUTHENTICATE AWAY BATCH CAP CHGHOST ERROR INVITE JOIN KICK
+MODE NICK NOTICE PART PING PONG PRIVMSG QUIT TAGMSG TOPIC WALLOPS"
+
+cat <<EOF
+/* Generated by glirc-codes.sh from lib/src/Irc/Codes.hs, do not edit */
+#ifndef GLIRC_CODES
+#define GLIRC_CODES
+
+/* Values of glirc_message.command_code. A numeric reply's code is its
+ * number, so several names can share a value. Known verbs are numbered
+ * from 1000. Anything else, including the numeric 000, is
+ * GLIRC_CMD_UNKNOWN. */
+enum glirc_command_code {
+        GLIRC_CMD_UNKNOWN = 0,
+EOF
+
+awk '$1 == "pattern" && $3 == "=" && $4 == "ReplyCode" {
+        printf "        GLIRC_%-30s = %d,\n", $2, $5
+}' lib/src/Irc/Codes.hs
+
+n=1000
+for verb in $VERBS; do
+        printf '        GLIRC_CMD_%-26s = %d,\n' "$verb" "$n"
+        n=$((n + 1))
+done
+
+cat <<EOF
+        GLIRC_CMD_COUNT = $n /* one more than the largest code */
+};
+
+/* X(verb) for each known verb, used by glirc_command_code */
+#define GLIRC_COMMAND_VERBS(X) \\
+EOF
+
+for verb in $VERBS; do
+        printf '        X(%s) \\\n' "$verb"
+done
+
+cat <<EOF
+
+#endif
+EOF
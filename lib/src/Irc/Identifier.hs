@@ -18,11 +18,13 @@ module Irc.Identifier
   , idText
   , idTextNorm
   , idPrefix
+  , idHash64
   ) where
 
 import           Control.Monad.ST
 import           Data.ByteString (ByteString)
 import qualified Data.ByteString as B
+import           Data.Bits
 import           Data.Char
 import           Data.Foldable
 import           Data.Function
@@ -106,6 +108,15 @@ idPrefix (Identifier _ x) (Identifier _ y) =
   all (\i -> indexWord8 x i == indexWord8 y i)
       [0 .. BA.sizeofByteArray x - 1]
 
+-- | 64-bit FNV-1a hash of the case-normalized identifier. This is the
+-- same hash computed by @glirc_id_hash@ so that extensions can agree
+-- with the client on the hash of an identifier.
+idHash64 :: Identifier -> Word64
+idHash64 (Identifier _ x) =
+  foldl' (\h i -> (h `xor` fromIntegral (indexWord8 x i)) * 0x100000001b3)
+         0xcbf29ce484222325
+         [0 .. BA.sizeofByteArray x - 1]
+
 -- | Capitalize a string according to RFC 2812
 -- Latin letters are capitalized and {|}~ are mapped to [\]^
 ircFoldCase :: ByteString -> ByteArray
@@ -59,6 +59,37 @@ function extension:process_message(msg)
         end
 end
 
+------------------------------------------------------------------------
+-- Channel membership mirror
+------------------------------------------------------------------------
+
+-- members[network][channel][nick] = true
+local members = {}
+
+local function channel_members(change)
+    local net = members[change.network]
+    if not net then net = {} members[change.network] = net end
+    local chan = net[change.channel]
+    if not chan then chan = {} net[change.channel] = chan end
+    return chan
+end
+
+function extension:process_member_changes(changes)
+    for _, c in ipairs(changes) do
+        local chan = channel_members(c)
+        if c.kind == 'join' then
+            chan[c.nick] = true
+        elseif c.kind == 'nick' then
+            chan[c.nick] = nil
+            chan[c.new_nick] = true
+        elseif c.kind == 'reset' then
+            members[c.network][c.channel] = nil
+        else -- part, kick, quit
+            chan[c.nick] = nil
+        end
+    end
+end
+
 ------------------------------------------------------------------------
 -- Command handlers
 ------------------------------------------------------------------------
@@ -81,6 +112,13 @@ function commands.list_channel_users(network, channel)
     glirc.print(table.concat(glirc.list_channel_users(network,channel), ' '))
 end
 
+function commands.member_count(network, channel)
+    local chan = members[network] and members[network][channel] or {}
+    local n = 0
+    for _ in pairs(chan) do n = n + 1 end
+    glirc.print(channel .. ' has ' .. n .. ' members')
+end
+
 function commands.my_nick(network)
     glirc.print(glirc.my_nick(network))
 end
@@ -76,6 +76,106 @@ static int glirc_lua_send_message(lua_State *L)
         return 0;
 }
 
+/* Helper
+ * Reads the message table at the top of the stack into msg. The table's
+ * strings, and an array for its parameters, are left on the stack so
+ * that they stay alive until the message is sent.
+ */
+static void get_glirc_message(lua_State *L, struct glirc_message *msg)
+{
+        int t = lua_gettop(L);
+        luaL_checkstack(L, 20, "too many messages");
+        memset(msg, 0, sizeof *msg);
+
+        lua_getfield(L, t, "command");
+        get_glirc_string(L, -1, &msg->command);
+
+        lua_getfield(L, t, "network");
+        get_glirc_string(L, -1, &msg->network);
+
+        lua_getfield(L, t, "params");
+        int p = lua_gettop(L);
+        lua_Integer n = luaL_len(L, p);
+
+        if (n < 0 || n > 15) luaL_error(L, "too many command parameters");
+
+        struct glirc_string *params = lua_newuserdata(L, n * sizeof *params);
+        msg->params   = params;
+        msg->params_n = n;
+
+        for (int i = 0; i < n; i++) {
+                lua_geti(L, p, i+1);
+                get_glirc_string(L, -1, &params[i]);
+        }
+}
+
+/* Lua Function:
+ * Arguments: Messages (array of tables like send_message's)
+ * Returns:
+ *
+ * All of the messages are handed to the client in one call.
+ */
+static int glirc_lua_send_messages(lua_State *L)
+{
+        luaL_checktype(L, 1, LUA_TTABLE);
+        luaL_checktype(L, 2, LUA_TNONE);
+
+        lua_Integer n = luaL_len(L, 1);
+        if (n < 0) n = 0;
+
+        struct glirc_message *msgs = lua_newuserdata(L, n * sizeof *msgs);
+
+        for (lua_Integer i = 0; i < n; i++) {
+                lua_geti(L, 1, i+1);
+                get_glirc_message(L, &msgs[i]);
+        }
+
+        if (glirc_send_messages(get_glirc(L), msgs, n)) {
+                luaL_error(L, "failure in client");
+        }
+
+        return 0;
+}
+
+/* Lua Function:
+ * Arguments: Chats (array of tables with .network .source .target .message (strings))
+ * Returns:
+ *
+ * Shows the messages in the client's windows as though they were
+ * received, updating the client once for all of them.
+ */
+static int glirc_lua_inject_chats(lua_State *L)
+{
+        luaL_checktype(L, 1, LUA_TTABLE);
+        luaL_checktype(L, 2, LUA_TNONE);
+
+        lua_Integer n = luaL_len(L, 1);
+        if (n < 0) n = 0;
+
+        struct glirc_injected_chat *chats = lua_newuserdata(L, n * sizeof *chats);
+
+        for (lua_Integer i = 0; i < n; i++) {
+                luaL_checkstack(L, 5, "too many chats");
+                lua_geti(L, 1, i+1);
+                int t = lua_gettop(L);
+
+                lua_getfield(L, t, "network");
+                get_glirc_string(L, -1, &chats[i].network);
+                lua_getfield(L, t, "source");
+                get_glirc_string(L, -1, &chats[i].source);
+                lua_getfield(L, t, "target");
+                get_glirc_string(L, -1, &chats[i].target);
+                lua_getfield(L, t, "message");
+                get_glirc_string(L, -1, &chats[i].message);
+        }
+
+        if (glirc_inject_chats(get_glirc(L), chats, n)) {
+                luaL_error(L, "failure in client");
+        }
+
+        return 0;
+}
+
 /* Populate scriptpath by computing the filename glirc.lua
  * in the same directory as the file in libpath.
  *
@@ -253,7 +353,7 @@ static int glirc_lua_identifier_cmp(lua_State *L)
         str2.str = luaL_checklstring(L, 2, &str2.len);
         luaL_checktype(L, 3, LUA_TNONE);
 
-        int res = glirc_identifier_cmp(str1, str2);
+        int res = glirc_id_cmp(str1, str2);
         lua_pushinteger(L, res);
 
         return 1;
@@ -261,6 +361,8 @@ static int glirc_lua_identifier_cmp(lua_State *L)
 
 static luaL_Reg glirc_lib[] =
   { { "send_message"      , glirc_lua_send_message       }
+  , { "send_messages"     , glirc_lua_send_messages      }
+  , { "inject_chats"      , glirc_lua_inject_chats       }
   , { "print"             , glirc_lua_print              }
   , { "error"             , glirc_lua_error              }
   , { "identifier_cmp"    , glirc_lua_identifier_cmp     }
@@ -376,7 +478,7 @@ static void push_glirc_command(lua_State *L, const struct glirc_command *cmd)
  * */
 static void push_glirc_message(lua_State *L, const struct glirc_message *msg)
 {
-        lua_createtable(L, 0, 5);
+        lua_createtable(L, 0, 6);
 
         push_glirc_string(L, &msg->network);
         lua_setfield(L,-2,"network");
@@ -417,6 +519,67 @@ static void push_glirc_message(lua_State *L, const struct glirc_message *msg)
                 }
                 lua_setfield(L,-2,"tags");
         }
+
+        if (msg->raw.str != NULL) {
+                push_glirc_string(L, &msg->raw);
+                lua_setfield(L,-2,"raw");
+        }
+
+        /* decoded tags, only present when the message has them */
+        if (msg->server_time != 0) {
+                lua_pushinteger(L, msg->server_time);
+                lua_setfield(L,-2,"server_time");
+        }
+        if (msg->msgid.len > 0) {
+                push_glirc_string(L, &msg->msgid);
+                lua_setfield(L,-2,"msgid");
+        }
+        if (msg->account.len > 0) {
+                push_glirc_string(L, &msg->account);
+                lua_setfield(L,-2,"account");
+        }
+        if (msg->batch_ref.len > 0) {
+                push_glirc_string(L, &msg->batch_ref);
+                lua_setfield(L,-2,"batch");
+                push_glirc_string(L, &msg->batch_type);
+                lua_setfield(L,-2,"batch_type");
+        }
+}
+
+/* Push a table onto the top of the stack containing all of the fields
+ * of the member change struct. The kind is given as a lowercase string.
+ *
+ * [-0, +1, m]
+ * */
+static void push_glirc_member_change(lua_State *L, const struct glirc_member_change *change)
+{
+        static const char * const kinds[] = {
+                [GLIRC_MEMBER_JOIN]  = "join",
+                [GLIRC_MEMBER_PART]  = "part",
+                [GLIRC_MEMBER_KICK]  = "kick",
+                [GLIRC_MEMBER_QUIT]  = "quit",
+                [GLIRC_MEMBER_NICK]  = "nick",
+                [GLIRC_MEMBER_RESET] = "reset",
+        };
+
+        lua_createtable(L, 0, 5);
+
+        lua_pushstring(L, kinds[change->kind]);
+        lua_setfield(L,-2,"kind");
+
+        push_glirc_string(L, &change->network);
+        lua_setfield(L,-2,"network");
+
+        push_glirc_string(L, &change->channel);
+        lua_setfield(L,-2,"channel");
+
+        push_glirc_string(L, &change->nick);
+        lua_setfield(L,-2,"nick");
+
+        if (change->kind == GLIRC_MEMBER_NICK) {
+                push_glirc_string(L, &change->new_nick);
+                lua_setfield(L,-2,"new_nick");
+        }
 }
 
 static int callback_worker(lua_State *L)
@@ -429,6 +592,50 @@ static int callback_worker(lua_State *L)
         return 1;
 }
 
+/* Deliver a burst of messages with a single protected call. Scripts that
+ * define process_messages receive the whole array and return an array of
+ * drop flags. Otherwise process_message is called for each message.
+ */
+static int messages_worker(lua_State *L)
+{                                                                // msgs
+        lua_getfield(L, LUA_REGISTRYINDEX, CALLBACK_MODULE_KEY); // msgs ext
+        if (lua_getfield(L, 2, "process_messages") != LUA_TNIL) {// msgs ext callback
+                lua_pushvalue(L, 2);                             // msgs ext callback ext
+                lua_pushvalue(L, 1);                             // msgs ext callback ext msgs
+                lua_call(L, 2, 1);                               // msgs ext drops
+                return 1;
+        }
+        lua_settop(L, 2);                                        // msgs ext
+
+        lua_len(L, 1);
+        lua_Integer n = lua_tointeger(L, -1);
+        lua_settop(L, 2);
+
+        lua_createtable(L, n, 0);                                // msgs ext drops
+        for (lua_Integer i = 1; i <= n; i++) {
+                lua_getfield(L, 2, "process_message");           // msgs ext drops callback
+                lua_pushvalue(L, 2);                             // msgs ext drops callback ext
+                lua_geti(L, 1, i);                               // msgs ext drops callback ext msg
+                lua_call(L, 2, 1);                               // msgs ext drops drop
+                lua_rawseti(L, 3, i);                            // msgs ext drops
+        }
+        return 1;
+}
+
+/* Deliver membership changes to process_member_changes when the script
+ * defines it.
+ */
+static int member_changes_worker(lua_State *L)
+{                                                                // changes
+        lua_getfield(L, LUA_REGISTRYINDEX, CALLBACK_MODULE_KEY); // changes ext
+        if (lua_getfield(L, 2, "process_member_changes") != LUA_TNIL) {
+                lua_pushvalue(L, 2);                             // changes ext callback ext
+                lua_pushvalue(L, 1);                             // changes ext callback ext changes
+                lua_call(L, 2, 0);                               // changes ext
+        }
+        return 0;
+}
+
 static int callback(struct glirc *G, lua_State *L, const char *callback_name, int args)
 {
         // remember glirc handle
@@ -467,6 +674,63 @@ static enum process_result message_entrypoint(struct glirc *G, void *L, const st
         return res ? DROP_MESSAGE : PASS_MESSAGE;
 }
 
+static void messages_entrypoint(struct glirc *G, void *L,
+                const struct glirc_message * const *msgs, size_t n,
+                unsigned char *drops)
+{
+        if (L == NULL) return;
+
+        // remember glirc handle
+        memcpy(lua_getextraspace(L), &G, sizeof(G));
+
+        lua_pushcfunction(L, messages_worker);  // STACK: worker
+        lua_createtable(L, n, 0);               // STACK: worker msgs
+        for (size_t i = 0; i < n; i++) {
+                push_glirc_message(L, msgs[i]);
+                lua_rawseti(L, -2, i+1);
+        }
+
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK) {  // STACK: drops
+                size_t msglen = 0;
+                const char *msg = lua_tolstring(L, -1, &msglen);
+                glirc_print(G, ERROR_MESSAGE, msg, msglen);
+        } else if (lua_type(L, 1) == LUA_TTABLE) {
+                for (size_t i = 0; i < n; i++) {
+                        lua_rawgeti(L, 1, i+1);
+                        if (lua_toboolean(L, -1)) {
+                                glirc_drop_message(drops, i);
+                        }
+                        lua_settop(L, 1);
+                }
+        }
+
+        lua_settop(L, 0);
+}
+
+static void member_changes_entrypoint(struct glirc *G, void *L,
+                const struct glirc_member_change *changes, size_t n)
+{
+        if (L == NULL) return;
+
+        // remember glirc handle
+        memcpy(lua_getextraspace(L), &G, sizeof(G));
+
+        lua_pushcfunction(L, member_changes_worker); // STACK: worker
+        lua_createtable(L, n, 0);                    // STACK: worker changes
+        for (size_t i = 0; i < n; i++) {
+                push_glirc_member_change(L, &changes[i]);
+                lua_rawseti(L, -2, i+1);
+        }
+
+        if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+                size_t msglen = 0;
+                const char *msg = lua_tolstring(L, -1, &msglen);
+                glirc_print(G, ERROR_MESSAGE, msg, msglen);
+        }
+
+        lua_settop(L, 0);
+}
+
 static enum process_result chat_entrypoint(struct glirc *G, void *L, const struct glirc_chat *chat)
 {
         if (L == NULL) return PASS_MESSAGE;
@@ -482,6 +746,8 @@ static void command_entrypoint(struct glirc *G, void *L, const struct glirc_comm
         callback(G, L, "process_command", 1);
 }
 
+GLIRC_EXTENSION_API_VERSION;
+
 struct glirc_extension extension = {
         .name            = "Lua",
         .major_version   = MAJOR,
@@ -490,5 +756,7 @@ struct glirc_extension extension = {
         .stop            = stop_entrypoint,
         .process_message = message_entrypoint,
         .process_command = command_entrypoint,
-        .process_chat    = chat_entrypoint
+        .process_chat    = chat_entrypoint,
+        .process_messages = messages_entrypoint,
+        .process_member_changes = member_changes_entrypoint,
 };
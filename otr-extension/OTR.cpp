@@ -5,13 +5,67 @@ OTR::OTR(const OtrlMessageAppOps *ops, void *opdata)
 
 OTR::~OTR() { otrl_userstate_free(us); }
 
+/* Passed to libotr as add_app_data wherever it may create contexts */
+void
+OTR::index_context(void *data, ConnContext *context)
+{
+    auto otr = static_cast<OTR*>(data);
+    std::string key;
+    context_key(&key, context->username, context->accountname, context->protocol,
+                context->their_instance);
+    otr->index[key] = context;
+}
+
+void
+OTR::context_key(std::string *key, const char *username, const char *accountname,
+                 const char *protocol, otrl_instag_t instag)
+{
+    key->clear();
+    key->append(username).push_back('\0');
+    key->append(accountname).push_back('\0');
+    key->append(protocol).push_back('\0');
+    key->append(reinterpret_cast<const char *>(&instag), sizeof instag);
+}
+
 ConnContext *
 OTR::context_find
-  (const std::string &username, const std::string &accountname, const std::string &protocol) const
+  (const std::string &username, const std::string &accountname, const std::string &protocol,
+   otrl_instag_t instag) const
+{
+    // The special instance tags pick one of the master's instances
+    bool pick = instag != OTRL_INSTAG_MASTER && instag < OTRL_MIN_VALID_INSTAG;
+
+    context_key(&scratch_key, username.c_str(), accountname.c_str(), protocol.c_str(),
+                pick ? OTRL_INSTAG_MASTER : instag);
+
+    ConnContext *context;
+    auto it = index.find(scratch_key);
+    if (it != index.end()) {
+        context = it->second;
+    } else {
+        // created by a libotr call that was not given index_context
+        context = otrl_context_find
+                (us, username.c_str(), accountname.c_str(), protocol.c_str(),
+                 pick ? OTRL_INSTAG_MASTER : instag, 0, nullptr, nullptr, nullptr);
+        if (!context) return nullptr;
+        index.emplace(scratch_key, context);
+    }
+
+    if (!pick) return context;
+    if (instag == OTRL_INSTAG_BEST) return otrl_context_find_recent_secure_instance(context);
+    return otrl_context_find_recent_instance(context, instag);
+}
+
+ConnContext *
+OTR::context_add
+  (const std::string &username, const std::string &accountname, const std::string &protocol)
 {
+    auto context = context_find(username, accountname, protocol, OTRL_INSTAG_MASTER);
+    if (context) return context;
+
     return otrl_context_find
                 (us, username.c_str(), accountname.c_str(), protocol.c_str(),
-                 OTRL_INSTAG_BEST, 0, nullptr, nullptr, nullptr);
+                 OTRL_INSTAG_MASTER, 1, nullptr, index_context, this);
 }
 
 void
@@ -25,16 +79,34 @@ OTR::message_disconnect_all_instances(
 
 
 gcry_error_t
-OTR::privkey_write_fingerprints(const char *path) const
+OTR::privkey_write_fingerprints(FILE *file) const
+{
+    return otrl_privkey_write_fingerprints_FILEp(us, file);
+}
+
+
+gcry_error_t
+OTR::privkey_generate_start(const char *accountname, const char *protocol, void **newkey) const
 {
-    return otrl_privkey_write_fingerprints(us, path);
+    return otrl_privkey_generate_start(us, accountname, protocol, newkey);
 }
 
+gcry_error_t
+OTR::privkey_generate_calculate(void *newkey)
+{
+    return otrl_privkey_generate_calculate(newkey);
+}
 
 gcry_error_t
-OTR::privkey_generate(const char *path, const char *accountname, const char *protocol) const
+OTR::privkey_generate_finish(void *newkey, const char *path) const
+{
+    return otrl_privkey_generate_finish(us, newkey, path);
+}
+
+void
+OTR::privkey_generate_cancelled(void *newkey) const
 {
-    return otrl_privkey_generate(us, path, accountname, protocol);
+    otrl_privkey_generate_cancelled(us, newkey);
 }
 
 gcry_error_t
@@ -56,9 +128,9 @@ OTR::instag_read(const char *path) const
 }
 
 gcry_error_t
-OTR::privkey_read_fingerprints(const char *path) const
+OTR::privkey_read_fingerprints(const char *path)
 {
-    return otrl_privkey_read_fingerprints(us, path, nullptr, nullptr);
+    return otrl_privkey_read_fingerprints(us, path, index_context, this);
 }
 
 void
@@ -88,13 +160,13 @@ std::tuple<gcry_error_t, bool>
 OTR::message_sending(const std::string &accountname,
                      const std::string &protocol,
                      const std::string &username,
-                     const std::string &message) const
+                     const std::string &message)
 {
     char * newmsg = nullptr;
 
     auto err = otrl_message_sending
       (us, ops, opdata, accountname.c_str(), protocol.c_str(), username.c_str(), OTRL_INSTAG_BEST, message.c_str(),
-       nullptr, &newmsg, OTRL_FRAGMENT_SEND_ALL, nullptr, nullptr, nullptr);
+       nullptr, &newmsg, OTRL_FRAGMENT_SEND_ALL, nullptr, index_context, this);
 
     otrl_message_free(newmsg);
 
@@ -105,13 +177,13 @@ std::tuple<int, bool, std::string>
 OTR::message_receiving(const std::string &accountname,
                        const std::string &protocol,
                        const std::string &username,
-                       const std::string &message) const
+                       const std::string &message)
 {
     char *newmsg = nullptr;
     std::string newmessage;
 
     int internal = otrl_message_receiving(us, ops, opdata, accountname.c_str(), protocol.c_str(), username.c_str(),
-                      message.c_str(), &newmsg, NULL, NULL, NULL, NULL);
+                      message.c_str(), &newmsg, NULL, NULL, index_context, this);
 
     if (newmsg) {
         newmessage = newmsg;
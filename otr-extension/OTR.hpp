@@ -3,6 +3,7 @@
 #define OTR_HPP
 
 #include <string>
+#include <unordered_map>
 
 extern "C" {
     #include <libotr/proto.h>
@@ -14,6 +15,20 @@ class OTR {
         const OtrlMessageAppOps *ops;
         void *opdata;
 
+        /* Every context libotr has created, keyed by username,
+         * accountname, protocol, and instance tag as built by
+         * context_key. libotr keeps its contexts in a list sorted by
+         * name, so this replaces a scan of every context with a hash
+         * lookup. Contexts are only freed with the user state, so
+         * entries never go stale. */
+        mutable std::unordered_map<std::string, ConnContext*> index;
+        mutable std::string scratch_key;
+
+        static void index_context(void *data, ConnContext *context);
+        static void context_key(std::string *key, const char *username,
+                                const char *accountname, const char *protocol,
+                                otrl_instag_t instag);
+
 public:
         OtrlUserState us;
 
@@ -22,19 +37,37 @@ public:
         OTR(const OTR &) = delete;
         OTR &operator=(const OTR &) = delete;
 
+        /* Find a context without creating one. instag may be a
+         * specific instance or one of OTRL_INSTAG_MASTER, _BEST, and
+         * _RECENT as for otrl_context_find. */
         ConnContext * context_find
-          (const std::string &username, const std::string &accountname, const std::string &protocol) const;
+          (const std::string &username, const std::string &accountname, const std::string &protocol,
+           otrl_instag_t instag = OTRL_INSTAG_BEST) const;
+
+        /* Find or create the master context for a peer */
+        ConnContext * context_add
+          (const std::string &username, const std::string &accountname, const std::string &protocol);
+
+        size_t contexts_n() const { return index.size(); }
 
         void message_disconnect_all_instances(
                         const std::string &accountname, const std::string &protocol,
                         const std::string &username) const;
 
-        gcry_error_t privkey_write_fingerprints(const char *path) const;
-        gcry_error_t privkey_generate(const char *path, const char *accountname, const char *protocol) const;
+        /* Write the fingerprints to an open file, such as a memory
+         * stream to be saved elsewhere */
+        gcry_error_t privkey_write_fingerprints(FILE *file) const;
+        /* Key generation in three steps so that the slow middle one
+         * can run on another thread. Only calculate may be called off
+         * the thread that owns the user state. */
+        gcry_error_t privkey_generate_start(const char *accountname, const char *protocol, void **newkey) const;
+        static gcry_error_t privkey_generate_calculate(void *newkey);
+        gcry_error_t privkey_generate_finish(void *newkey, const char *path) const;
+        void privkey_generate_cancelled(void *newkey) const;
         gcry_error_t instag_generate(const char *path, const char *accountname, const char *protocol) const;
         gcry_error_t privkey_read(const char *path) const;
         gcry_error_t instag_read(const char *path) const;
-        gcry_error_t privkey_read_fingerprints(const char *path) const;
+        gcry_error_t privkey_read_fingerprints(const char *path);
 
 
         void message_initiate_smp (ConnContext *context, const std::string &secret) const;
@@ -47,13 +80,13 @@ public:
         message_sending(const std::string &accountname,
                         const std::string &protocol,
                         const std::string &username,
-                        const std::string &message) const;
+                        const std::string &message);
 
         std::tuple<int, bool, std::string>
         message_receiving(const std::string &accountname,
                           const std::string &protocol,
                           const std::string &username,
-                          const std::string &message) const;
+                          const std::string &message);
 };
 
 #endif
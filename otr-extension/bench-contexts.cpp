@@ -0,0 +1,84 @@
+// Compare finding contexts through the OTR class's index with
+// otrl_context_find's scan of libotr's context list.
+//
+// usage: bench-contexts [CONTEXTS [LOOKUPS]]
+//
+// CONTEXTS (default 10000) peers are spread over ten networks, as for a
+// bouncer attached to many networks, and looked up in random order.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "OTR.hpp"
+
+using namespace std;
+
+namespace {
+
+struct peer { string username, accountname, protocol; };
+
+template <typename F>
+double ns_per_lookup(const vector<size_t> &order, F find)
+{
+    auto start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (auto i : order) found += find(i) != nullptr;
+    auto end = chrono::steady_clock::now();
+
+    if (found != order.size()) {
+        fprintf(stderr, "only %zu of %zu lookups found a context\n", found, order.size());
+        exit(EXIT_FAILURE);
+    }
+    return chrono::duration<double, nano>(end - start).count() / order.size();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t contexts = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+    size_t lookups  = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000;
+    if (contexts == 0 || lookups == 0) {
+        fprintf(stderr, "usage: %s [CONTEXTS [LOOKUPS]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    OTRL_INIT;
+    OtrlMessageAppOps ops {};
+    OTR otr(&ops, nullptr);
+
+    vector<peer> peers;
+    peers.reserve(contexts);
+    for (size_t i = 0; i < contexts; i++) {
+        peers.push_back({ "peer" + to_string(i), "me", "network" + to_string(i % 10) });
+        auto &p = peers.back();
+        otr.context_add(p.username, p.accountname, p.protocol);
+    }
+
+    mt19937 gen(1);
+    uniform_int_distribution<size_t> pick(0, contexts - 1);
+    vector<size_t> order(lookups);
+    for (auto &i : order) i = pick(gen);
+
+    double scan = ns_per_lookup(order, [&](size_t i) {
+        auto &p = peers[i];
+        return otrl_context_find(otr.us, p.username.c_str(), p.accountname.c_str(),
+                                 p.protocol.c_str(), OTRL_INSTAG_BEST, 0,
+                                 nullptr, nullptr, nullptr);
+    });
+
+    double indexed = ns_per_lookup(order, [&](size_t i) {
+        auto &p = peers[i];
+        return otr.context_find(p.username, p.accountname, p.protocol);
+    });
+
+    printf("%zu contexts, %zu lookups\n", otr.contexts_n(), lookups);
+    printf("otrl_context_find  %10.1f ns/lookup\n", scan);
+    printf("OTR::context_find  %10.1f ns/lookup\n", indexed);
+    return EXIT_SUCCESS;
+}
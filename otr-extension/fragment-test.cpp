@@ -0,0 +1,135 @@
+// Test of the OTR fragment size. Messages of many lengths are split the
+// way libotr splits them, and every fragment must fit in the line the
+// server relays to the peer. The number of fragments is checked against
+// the fixed 400 byte size used before.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "fragment.hpp"
+
+using namespace std;
+
+namespace {
+
+// Bytes of each fragment taken by libotr's protocol 3 header,
+// "?OTR|sender|receiver,k,n," and a trailing "," and NUL
+const size_t HEADER_LEN = 37;
+
+// Number of fragments libotr sends a message of msglen bytes in, as
+// computed by fragment_and_send in message.c
+size_t fragment_count(size_t msglen, int mms)
+{
+    if (msglen <= size_t(mms)) return 1;
+    return (msglen - 1) / (mms - HEADER_LEN) + 1;
+}
+
+// Build the fragments like otrl_proto_fragment_create and return the
+// length of the longest line the server relays for them
+size_t longest_line(const string &prefix, const string &target, size_t msglen, int mms)
+{
+    size_t count = fragment_count(msglen, mms);
+    size_t piece = count == 1 ? msglen : mms - HEADER_LEN;
+    size_t longest = 0;
+
+    for (size_t k = 1, done = 0; k <= count; k++) {
+        size_t len = min(piece, msglen - done);
+        done += len;
+
+        string text = count == 1 ? string(len, 'x') : "?OTR|01234567|89abcdef,";
+        if (count > 1) {
+            char kn[48];
+            snprintf(kn, sizeof kn, "%05zu,%05zu,", k, count);
+            text += kn + string(len, 'x') + ",";
+        }
+
+        auto line = ":" + prefix + " PRIVMSG " + target + " :" + text + "\r\n";
+        longest = max(longest, line.length());
+    }
+    return longest;
+}
+
+struct prefix_case {
+    const char *name;
+    string known;   // nick!user@host as the client knows it
+    string relayed; // longest prefix the server might relay instead
+};
+
+int failed;
+
+void check(bool ok, const char *what, const char *name, size_t msglen)
+{
+    if (!ok) {
+        fprintf(stderr, "%s: %s for a message of %zu bytes\n", name, what, msglen);
+        failed = 1;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    string host63(63, 'h'), nick30(30, 'n');
+
+    prefix_case cases[] = {
+        { "known",   "glircuser!~glirc@example.com", "glircuser!~glirc@example.com.cloaked" },
+        { "unknown", "glircuser",                    "glircuser!~glircuser@" + host63 },
+        { "no user", "glircuser@example.com",        "glircuser!~abcdefghij@example.com" },
+        { "long",    nick30 + "!~abcdefghi@" + host63, nick30 + "!~abcdefghi@" + host63 },
+    };
+    string targets[] = { "a", "friend", nick30 };
+
+    for (auto &c : cases) {
+        for (auto &target : targets) {
+            int mms = fragment_size(c.known, target.length());
+            for (size_t msglen = 1; msglen <= 8000; msglen++) {
+                check(longest_line(c.relayed, target, msglen, mms) <= IRC_LINE_MAX,
+                      "line too long", c.name, msglen);
+            }
+        }
+    }
+
+    // Targets long enough that fragments can't carry any of a message
+    // are refused, and fragments for those just short of that still fit
+    for (size_t len = 1; len < IRC_LINE_MAX; len++) {
+        string target(len, 't');
+        int mms = fragment_size(cases[3].known, len);
+        if (mms == 0) {
+            check(len > 300, "no fragment size", "long target", len);
+            continue;
+        }
+        check(mms > FRAGMENT_HEADER_LEN, "fragment size too small", "long target", len);
+        for (size_t msglen : { size_t(1), size_t(mms), size_t(mms) + 1, size_t(1000) }) {
+            check(longest_line(cases[3].relayed, target, msglen, mms) <= IRC_LINE_MAX,
+                  "line too long", "long target", msglen);
+        }
+    }
+    check(fragment_size(string(400, 'n'), 6) == 0, "fragment size given", "long nick", 0);
+
+    // Fragments to a peer named "friend" from a user whose prefix is known
+    int mms = fragment_size(cases[0].known, 6);
+    check(mms == 454, "unexpected fragment size", "known", 0);
+
+    struct { size_t msglen, fragments, before; } counts[] = {
+        {  100,  1,  1 },
+        {  400,  1,  1 },
+        {  454,  1,  2 },
+        {  455,  2,  2 },
+        { 1000,  3,  3 },
+        { 2000,  5,  6 },
+        { 4000, 10, 12 },
+        { 8000, 20, 23 },
+    };
+
+    printf("%8s %10s %10s\n", "bytes", "fragments", "before");
+    for (auto &n : counts) {
+        size_t fragments = fragment_count(n.msglen, mms);
+        size_t before    = fragment_count(n.msglen, 400);
+        printf("%8zu %10zu %10zu\n", n.msglen, fragments, before);
+        check(fragments == n.fragments && before == n.before, "unexpected fragment count", "known", n.msglen);
+    }
+
+    puts(failed ? "FAILED" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef FRAGMENT_HPP
+#define FRAGMENT_HPP
+
+#include <algorithm>
+#include <string>
+
+// IRC lines are at most 512 bytes including the CRLF
+#define IRC_LINE_MAX 512
+
+// Used while the client doesn't know our user and host, which it only
+// learns on joining a channel: USERLEN 10 with ident's "~" prefix, and
+// the longest hostname servers accept
+#define ASSUMED_USER_LEN 11
+#define ASSUMED_HOST_LEN 63
+
+// Slack for a prefix the server shows differently than we last saw it,
+// such as a cloak applied later
+#define FRAGMENT_MARGIN 10
+
+// Bytes of each fragment libotr needs for its header
+#define FRAGMENT_HEADER_LEN 37
+
+// How long each OTR fragment may be so that the PRIVMSG carrying it
+// still fits in a line when the server relays it to the peer:
+//
+//   :nick!user@host PRIVMSG target :fragment\r\n
+//
+// userinfo is our nick!user@host as the client knows it, where the
+// user and host may be missing. Returns 0 when the prefix and target
+// leave no room for a fragment carrying any of the message, which
+// libotr would take to mean that messages aren't split.
+inline int fragment_size(const std::string &userinfo, size_t target_len)
+{
+    auto bang = userinfo.find('!');
+    auto at   = userinfo.find('@');
+
+    size_t nick = std::min(std::min(bang, at), userinfo.length());
+    size_t user = bang == std::string::npos ? ASSUMED_USER_LEN
+                : (at == std::string::npos || at < bang ? userinfo.length() : at) - bang - 1;
+    size_t host = at == std::string::npos ? ASSUMED_HOST_LEN
+                : userinfo.length() - at - 1;
+
+    size_t overhead = 1 + nick + 1 + user + 1 + host   // ":nick!user@host"
+                    + 9 + target_len + 2 + 2           // " PRIVMSG target :" "\r\n"
+                    + FRAGMENT_MARGIN;
+
+    return overhead + FRAGMENT_HEADER_LEN >= IRC_LINE_MAX ? 0 : IRC_LINE_MAX - overhead;
+}
+
+#endif
@@ -0,0 +1 @@
+../include/glirc-codes.h
\ No newline at end of file
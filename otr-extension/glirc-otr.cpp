@@ -1,16 +1,31 @@
 #define _GNU_SOURCE
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
 #include <cstdbool>
 #include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 #include <iomanip>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "OTR.hpp"
+#include "fragment.hpp"
+#include "prefilter.hpp"
+#include "queue.hpp"
 
 extern "C" {
     #include "glirc-api.h"
@@ -29,12 +44,22 @@ using namespace std;
 #define GREEN(x) "\00303" x PLAIN
 #define RED(x)   "\00304" x PLAIN
 
+// Changes to the fingerprints are saved together this long after the
+// first of them
+#define FINGERPRINT_SAVE_MS 2000
+
+// Channel prefixes until a server lists its own, as in the client,
+// and the ones asked about when a server's list wasn't seen
+#define DEFAULT_CHANTYPES "#&"
+#define KNOWN_CHANTYPES   "#&!+.~"
+
 #define QUERY_TEXT "?OTRv23? This message is attempting to initiate an encrypted" \
                    " session, but your client doesn't support this protocol."
 
 // These macros try to make it less error prone to marshal data
 // into and out of the void *opdata parameters
 #define GET_opdata auto opdata = static_cast<OpData*>(L)
+#define GET_ext    auto ext    = static_cast<Extension*>(L)
 
 namespace {
 
@@ -50,6 +75,9 @@ void write_fingerprints(void *);
 void new_fingerprint (void *, OtrlUserState, const char *, const char *, const char *, unsigned char[20]);
 void create_privkey(void *, const char *, const char *);
 void create_instag(void *, const char *, const char *);
+void timer_control(void *, unsigned int);
+void poll_entrypoint(struct glirc *, void *);
+void fingerprints_due(struct glirc *, void *);
 
 OtrlMessageAppOps ops = {
     .policy            = op_policy,
@@ -66,33 +94,23 @@ OtrlMessageAppOps ops = {
     .new_fingerprint   = new_fingerprint,
     .create_privkey    = create_privkey,
     .create_instag     = create_instag,
+    .timer_control     = timer_control,
 };
 
 
 
-const char *casemap =
-    "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
-    "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f"
-    " !\"#$%&'()*+,-./0123456789:;<=>?"
-    "@abcdefghijklmnopqrstuvwxyz{|}~_"
-    "`abcdefghijklmnopqrstuvwxyz{|}~\x7f"
-    "\x80\x81\x82\x83\x84\x85\x86\x87\x88\x89\x8a\x8b\x8c\x8d\x8e\x8f"
-    "\x90\x91\x92\x93\x94\x95\x96\x97\x98\x99\x9a\x9b\x9c\x9d\x9e\x9f"
-    "\xa0\xa1\xa2\xa3\xa4\xa5\xa6\xa7\xa8\xa9\xaa\xab\xac\xad\xae\xaf"
-    "\xb0\xb1\xb2\xb3\xb4\xb5\xb6\xb7\xb8\xb9\xba\xbb\xbc\xbd\xbe\xbf"
-    "\xc0\xc1\xc2\xc3\xc4\xc5\xc6\xc7\xc8\xc9\xca\xcb\xcc\xcd\xce\xcf"
-    "\xd0\xd1\xd2\xd3\xd4\xd5\xd6\xd7\xd8\xd9\xda\xdb\xdc\xdd\xde\xdf"
-    "\xe0\xe1\xe2\xe3\xe4\xe5\xe6\xe7\xe8\xe9\xea\xeb\xec\xed\xee\xef"
-    "\xf0\xf1\xf2\xf3\xf4\xf5\xf6\xf7\xf8\xf9\xfa\xfb\xfc\xfd\xfe\xff";
-
-
 // IRC identifiers use a Swedish character encoding. The important
 // distinction from normal ASCII is that "{|}~" are the lowercased
 // forms of "[\]^". We normalize account names according to this
 // convention so that OTR account names align with the meaning of
-// IRC nicknames.
+// IRC nicknames. Account names have always been stored in lowercase,
+// so the folded identifier is lowered again to keep existing key and
+// fingerprint files working.
 void normalizeCase(string *str) {
-   for (auto &x : *str) { x = casemap[(unsigned char)x]; }
+   for (auto &x : *str) {
+       unsigned char c = glirc_id_fold_char(x);
+       x = c >= 'A' && c <= '^' ? c + ('a' - 'A') : c;
+   }
 }
 
 /* Construct a glirc_string from a null-terminated C string */
@@ -105,22 +123,477 @@ string make_string(const glirc_string &s) {
         return string(s.str, s.len);
 }
 
-// It is useful to store a copy of the user state in the opdata
-// because some callbacks forget to provide it
+/* Copy a glirc_string into buf, reusing its storage */
+const string &assign_string(string *buf, const glirc_string &s) {
+        buf->assign(s.str, s.len);
+        return *buf;
+}
+
+// Writes files on a background thread. Each file is written next to
+// its destination, synced, and renamed over it, so a crash leaves the
+// old contents or the new ones. Only the latest contents queued for a
+// path are written.
+class FileWriter {
+    mutex lock;
+    condition_variable wakeup;
+    unordered_map<string, string> pending; // contents by path
+    bool stopping;
+    int error; // errno of the last failed save, 0 when none
+    thread worker;
+
+    static int replace_file(const string &path, const string &contents) {
+        auto tmp = path + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) return errno;
+
+        const char *p = contents.data();
+        size_t left = contents.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, p, left);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1) break;
+            p += n;
+            left -= n;
+        }
+
+        int err = left > 0 || fsync(fd) == -1 ? errno : 0;
+        if (close(fd) == -1 && !err) err = errno;
+        if (!err && rename(tmp.c_str(), path.c_str()) == -1) err = errno;
+        if (err) unlink(tmp.c_str());
+        return err;
+    }
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            wakeup.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+
+            auto batch = move(pending);
+            pending.clear();
+
+            guard.unlock();
+            int err = 0;
+            for (auto &file : batch) {
+                if (int e = replace_file(file.first, file.second)) err = e;
+            }
+            guard.lock();
+
+            if (err) error = err;
+        }
+    }
+
+public:
+    FileWriter() : stopping(false), error(0), worker(&FileWriter::run, this) {}
+    ~FileWriter() { finish(); }
+    FileWriter(const FileWriter &) = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    /* Queue a file to be replaced with contents */
+    void save(string path, string contents) {
+        {
+            lock_guard<mutex> guard(lock);
+            pending[move(path)] = move(contents);
+        }
+        wakeup.notify_one();
+    }
+
+    /* Write everything queued and stop the thread */
+    void finish() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    /* The errno of a save that failed since the last call, or 0 */
+    int take_error() {
+        lock_guard<mutex> guard(lock);
+        int err = error;
+        error = 0;
+        return err;
+    }
+};
+
+struct OpData;
+struct Keygen;
+
+// Work for the OTR thread. It carries copies of everything libotr's
+// callbacks need to know about the client, as that thread never calls
+// into the client.
+struct Job {
+    enum kind_type { RECEIVE, SEND, COMMAND, POLL, SAVE_FINGERPRINTS, KEYGEN_DONE, STOP };
+    kind_type kind = POLL;
+
+    /* our and the peer's normalized nicks */
+    string network, me, peer;
+
+    /* message, or command parameters */
+    string text;
+
+    /* RECEIVE: the sender as nick!user@host and as written, for
+     * showing the message. SEND: the recipient as written. */
+    string source, target;
+
+    /* our nick!user@host, for max_message_size */
+    string userinfo;
+
+    /* COMMAND: answer for is_logged_in */
+    int logged_in = -1;
+
+    void (*command)(OpData *, const Job &) = nullptr;
+    Keygen *keygen = nullptr;
+
+    /* The client counts jobs for a peer until the OTR thread reports
+     * them done, see Extension::peers */
+    bool for_peer() const { return !me.empty() && !peer.empty(); }
+};
+
+// What the callbacks libotr ran during a job would have done to the
+// client. It is carried out on the client thread by results_ready.
+struct Outcome {
+    struct send { string network, target, message; };
+    struct chat { string network, source, target, message; };
+
+    vector<send> sends;
+    vector<chat> chats;
+    vector<pair<message_code, string>> prints;
+
+    /* peers whose jobs finished, by peer_key, and whether libotr then
+     * had a session with them that isn't plain text */
+    vector<pair<string, bool>> done;
+
+    /* libotr asked for a new poll interval */
+    bool poll_changed = false;
+    unsigned int poll_interval = 0;
+
+    bool fingerprints_changed = false;
+
+    bool empty() const {
+        return sends.empty() && chats.empty() && prints.empty() && done.empty() &&
+               !poll_changed && !fingerprints_changed;
+    }
+};
+
+// A private key being generated on a thread of its own
+struct Keygen {
+    string accountname, protocol;
+    void *newkey = nullptr;
+    chrono::steady_clock::time_point started;
+    thread worker;
+    gcry_error_t err = 0;
+
+    /* SEND jobs for this account held until the key is ready */
+    vector<Job> held;
+};
+
+// Number, total, and longest of some durations
+struct Timing {
+    unsigned long n = 0;
+    chrono::nanoseconds total{0}, longest{0};
+
+    void add(chrono::nanoseconds d) {
+        n++;
+        total += d;
+        if (d > longest) longest = d;
+    }
+};
+
+// Counters for the stats command, kept for each network on the OTR
+// thread
+struct Stats {
+    unsigned long encrypted = 0, decrypted = 0;
+    unsigned long fragments_sent = 0, fragments_received = 0, reassembled = 0;
+
+    /* AKEs are timed from the first D-H commit message to the session
+     * being secured, so akes_completed.n is the number completed */
+    unsigned long akes_started = 0;
+    Timing akes_completed;
+
+    unsigned long smp_started = 0, smp_succeeded = 0, smp_failed = 0;
+
+    /* calls into libotr, including the callbacks it makes */
+    Timing libotr;
+};
+
+/* Key of a peer in Extension::peers and Outcome::done */
+const string &peer_key(string *buf, const string &network, const string &me, const string &peer)
+{
+    buf->assign(network);
+    buf->push_back('\0');
+    buf->append(me);
+    buf->push_back('\0');
+    buf->append(peer);
+    return *buf;
+}
+
+// Adds the time from its creation to its destruction to a Timing, for
+// timing calls into libotr
+class LibotrTimer {
+    Timing *timing;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit LibotrTimer(Timing *timing)
+      : timing(timing), start(chrono::steady_clock::now()) {}
+    ~LibotrTimer() { timing->add(chrono::steady_clock::now() - start); }
+    LibotrTimer(const LibotrTimer &) = delete;
+    LibotrTimer &operator=(const LibotrTimer &) = delete;
+};
+
+/* Whether a message is a protocol 2 or 3 fragment, and if so whether it
+ * is the last of its message */
+bool is_fragment(const char *msg, bool *last)
+{
+    unsigned int sender, receiver;
+    unsigned short k, n;
+    int used = 0;
+
+    if ((sscanf(msg, "?OTR|%x|%x,%hu,%hu,%n", &sender, &receiver, &k, &n, &used) == 4 && used) ||
+        (sscanf(msg, "?OTR,%hu,%hu,%n", &k, &n, &used) == 2 && used)) {
+        *last = k == n;
+        return true;
+    }
+    return false;
+}
+
+// libotr's opdata, which is the state of the OTR thread. That thread
+// is the only one to use the libotr user state, so key exchanges,
+// SMP, and encryption never hold up the client. It is fed jobs through
+// a queue and hands back outcomes through another.
 struct OpData {
 
+    /* libotr session data, only used on the OTR thread */
+    OTR otr;
+
+    /* effects of the jobs run since the last publish */
+    Outcome out;
+
+    /* fingerprints changed since they were last saved */
+    bool fingerprints_dirty = false;
+
+    /* the job being run, for the callbacks */
+    const Job *job;
+
+    vector<unique_ptr<Keygen>> keygens;
+
+    /* counters by network, and the start of AKEs in progress by
+     * peer_key */
+    map<string, Stats> stats;
+    unordered_map<string, chrono::steady_clock::time_point> akes;
+
+    /* libotr calls that don't belong to a network: polls and
+     * serializing the fingerprints */
+    Timing other_libotr;
+
+    /* saves the fingerprints off the OTR thread */
+    FileWriter writer;
+
+    /* Shared between threads. Any thread posts jobs and only the OTR
+     * thread publishes results. A byte is written to wake_pipe when
+     * the OTR thread may be waiting for a job, and to result_pipe
+     * when the client hasn't been told about new results yet. */
+    Queue<Job> jobs;
+    Queue<Outcome> results;
+    atomic<bool> sleeping, notified;
+    int wake_pipe[2], result_pipe[2];
+
+    thread worker;
+
+    OpData() : otr(&ops, this), job(nullptr), sleeping(false), notified(false),
+               wake_pipe{-1, -1}, result_pipe{-1, -1} {}
+
+    ~OpData() {
+        for (int fd : { wake_pipe[0], wake_pipe[1], result_pipe[0], result_pipe[1] }) {
+            if (fd != -1) close(fd);
+        }
+    }
+
+    bool start() {
+        if (pipe(wake_pipe) == -1 || pipe(result_pipe) == -1) return false;
+        fcntl(result_pipe[0], F_SETFL, O_NONBLOCK);
+        worker = thread(&OpData::run, this);
+        return true;
+    }
+
+    /* Run the jobs posted so far and stop the OTR thread */
+    void stop() {
+        Job stop;
+        stop.kind = Job::STOP;
+        post(move(stop));
+        worker.join();
+    }
+
+    /* Hand a job to the OTR thread, from any thread */
+    void post(Job job) {
+        jobs.push(move(job));
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleeping.exchange(false)) wake(wake_pipe[1]);
+    }
+
+    void print(enum message_code code, string msg) {
+        out.prints.emplace_back(code, move(msg));
+    }
+
+    void queue_send(string network, string target, string message) {
+        out.sends.push_back({move(network), move(target), move(message)});
+    }
+
+    void queue_chat(string network, string source, string target, string message) {
+        out.chats.push_back({move(network), move(source), move(target), move(message)});
+    }
+
+    Keygen *find_keygen(const string &accountname, const string &protocol) {
+        for (auto &k : keygens) {
+            if (k->accountname == accountname && k->protocol == protocol) return k.get();
+        }
+        return nullptr;
+    }
+
+    /* Generate a private key without blocking the OTR thread. The slow
+     * step runs on a thread of its own, which posts a KEYGEN_DONE job
+     * when it is finished. */
+    bool start_keygen(const char *accountname, const char *protocol) {
+        void *newkey = nullptr;
+        if (otr.privkey_generate_start(accountname, protocol, &newkey) || !newkey) {
+            return false;
+        }
+
+        auto k = new Keygen;
+        keygens.emplace_back(k);
+        k->accountname = accountname;
+        k->protocol    = protocol;
+        k->newkey      = newkey;
+        k->started     = chrono::steady_clock::now();
+
+        k->worker = thread([this, k] {
+            k->err = OTR::privkey_generate_calculate(k->newkey);
+            Job done;
+            done.kind   = Job::KEYGEN_DONE;
+            done.keygen = k;
+            post(move(done));
+        });
+        return true;
+    }
+
+    /* Remove a key generation whose thread posted KEYGEN_DONE */
+    unique_ptr<Keygen> take_keygen(Keygen *k) {
+        unique_ptr<Keygen> out;
+        for (auto it = keygens.begin(); it != keygens.end(); ++it) {
+            if (it->get() == k) {
+                out = move(*it);
+                keygens.erase(it);
+                out->worker.join();
+                break;
+            }
+        }
+        return out;
+    }
+
+private:
+    static void wake(int fd) {
+        char c = 0;
+        while (write(fd, &c, 1) == -1 && errno == EINTR) {}
+    }
+
+    /* Block until post may have added a job */
+    void wait() {
+        sleeping = true;
+        atomic_thread_fence(memory_order_seq_cst);
+        if (jobs.empty()) {
+            char c;
+            while (read(wake_pipe[0], &c, 1) == -1 && errno == EINTR) {}
+        }
+        sleeping = false;
+    }
+
+    /* Hand the effects of the jobs run so far to the client thread */
+    void publish() {
+        if (out.empty()) return;
+        results.push(move(out));
+        out = Outcome();
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!notified.exchange(true)) wake(result_pipe[1]);
+    }
+
+    void run();
+};
+
+// State kept on the client thread. What the OTR thread last reported
+// about each peer is enough to tell synchronously whether libotr has to
+// see a message, and so whether the client should drop it.
+struct Extension {
+
     /* client API token */
     glirc *G;
 
-    /* libotr session data */
-    OTR otr;
+    /* the OTR thread */
+    OpData *crypto;
+    watch_id result_watch;
+
+    /* timer posting POLL jobs, 0 when not scheduled */
+    timer_id poll_timer;
+
+    /* seconds between polls requested by libotr, 0 when stopped */
+    unsigned int poll_interval;
+
+    /* pending save of changed fingerprints, 0 when there is none */
+    timer_id fingerprints_timer;
+
+    /* buffers reused for the strings of received messages so that
+     * deciding about them does not allocate once they have grown */
+    string scratch_net, scratch_peer, scratch_key;
 
 private:
-    /* used to track open BATCHes by network */
-    unordered_map<string, unordered_set<string>> batch_reftags;
+    /* What is known about each network without asking the client */
+    struct network_state {
+        /* our normalized nick, empty until first needed */
+        string nick;
+
+        /* our nick!user@host as written, empty until first needed */
+        string userinfo;
+
+        /* channel prefixes, from CHANTYPES in 005, empty until first
+         * needed */
+        string chantypes;
+    };
+    unordered_map<string, network_state> networks;
+
+    /* Peers with jobs on the OTR thread or with a session that isn't
+     * plain text. Messages to and from these go through libotr, so
+     * that they stay in order and none is sent or shown in the clear
+     * by mistake. Other peers are left out. */
+    struct peer_state {
+        unsigned int in_flight = 0;
+        bool secure = false;
+    };
+    unordered_map<string, peer_state> peers;
+
+    /* PRIVMSGs and chat lines from the OTR thread, handed to the
+     * client together by flush() */
+    vector<Outcome::send> pending_sends;
+    vector<Outcome::chat> pending_chats;
 
 public:
-    OpData(glirc *G) : G(G), otr(&ops, this) {}
+    Extension(glirc *G, OpData *crypto)
+      : G(G), crypto(crypto), result_watch(0), poll_timer(0), poll_interval(0),
+        fingerprints_timer(0) {}
+
+    /* Poll libotr every interval seconds, or stop polling when 0 */
+    void set_poll_interval(unsigned int interval) {
+        if (poll_timer) {
+            glirc_timer_cancel(G, poll_timer);
+            poll_timer = 0;
+        }
+
+        poll_interval = interval;
+
+        if (interval > 0) {
+            poll_timer = glirc_timer_start(G, interval * 1000UL, poll_entrypoint, this);
+        }
+    }
 
     tuple<string,string> current_focus() {
 
@@ -138,73 +611,249 @@ public:
       return make_tuple(net_out, tgt_out);
     }
 
-    string my_nick(const string &network) {
-        auto me = glirc_my_nick(G, network.c_str(), network.length());
-        string result;
-        if (me) {
-                result = string(me);
+    /* Our normalized nick on a network, empty when not connected. The
+     * client is only asked the first time, after which the nick is kept
+     * up to date from 001 and NICK messages. */
+    const string &my_nick(const string &network) {
+        auto &state = networks[network];
+        if (state.nick.empty()) {
+            auto me = glirc_my_nick(G, network.c_str(), network.length());
+            if (me) {
+                state.nick = me;
+                normalizeCase(&state.nick);
                 glirc_free_string(me);
+            }
         }
-        return result;
+        return state.nick;
     }
 
-    ConnContext *get_current_context() {
-        string net, tgt;
-        tie(net,tgt) = current_focus();
-        if (net.empty() || tgt.empty()) return NULL;
-        normalizeCase(&tgt);
+    /* Our nick!user@host, falling back to the nick. Once complete it
+     * is kept up to date from NICK, CHGHOST, and 396 messages. The
+     * client only learns our user and host when we join a channel, so
+     * until then it is asked again each time, and fragment_size allows
+     * for the parts still missing. */
+    const string &my_userinfo(const string &network, const string &me) {
+        auto &state = networks[network];
+        if (!complete_userinfo(state.userinfo)) {
+            auto info = glirc_my_userinfo(G, network.c_str(), network.length());
+            if (info) {
+                // keeps a host from 396 over a bare nick
+                if (complete_userinfo(info) || state.userinfo.empty()) state.userinfo = info;
+                glirc_free_string(info);
+            }
+            if (state.userinfo.empty()) return me;
+        }
+        return state.userinfo;
+    }
 
-        auto me = my_nick(net);
-        if (me.empty()) return NULL;
-        normalizeCase(&me);
+    static bool complete_userinfo(const string &info) {
+        return info.find('!') != string::npos && info.find('@') != string::npos;
+    }
 
-        return otr.context_find(tgt, me, net);
+    /* Start over on a network after 001, which tells our nick */
+    void welcome(const string &network, const string &nick) {
+        auto &state = networks[network];
+        state.nick = nick;
+        normalizeCase(&state.nick);
+        state.userinfo.clear();
+        state.chantypes = DEFAULT_CHANTYPES;
     }
 
-    bool is_channel(const string &net, const string &tgt) {
-        return glirc_is_channel(G, net.c_str(), net.length(), tgt.c_str(), tgt.length());
+    /* Handle a NICK message, which may be a change of our own nick */
+    void nick_changed(const glirc_message *msg) {
+        if (msg->params_n < 1) return;
+        auto state = my_message(msg);
+        if (!state) return;
+
+        state->nick = make_string(msg->params[0]);
+        if (!state->userinfo.empty()) {
+            auto end = min(state->userinfo.find_first_of("!@"), state->userinfo.length());
+            state->userinfo.replace(0, end, state->nick);
+        }
+        normalizeCase(&state->nick);
     }
 
-    /* Populate the list of networks. This should run on startup in order to handle
-     * the case where the extension is loaded while there are already connected
-     * networks and the welcome message won't be seen
-     */
-    void populate_networks() {
-        auto networks = glirc_list_networks(G);
+    /* Handle a CHGHOST message, which may change our user and host */
+    void host_changed(const glirc_message *msg) {
+        if (msg->params_n < 2) return;
+        auto state = my_message(msg);
+        if (!state) return;
+
+        state->userinfo = make_string(msg->prefix_nick);
+        state->userinfo += '!';
+        state->userinfo.append(msg->params[0].str, msg->params[0].len);
+        state->userinfo += '@';
+        state->userinfo.append(msg->params[1].str, msg->params[1].len);
+    }
 
-        for (auto network = networks; *network; network++) {
-            batch_reftags.insert(make_tuple(string(*network), unordered_set<string>()));
+    /* Handle 396, our host as the server now shows it */
+    void host_hidden(const glirc_message *msg) {
+        if (msg->params_n < 2) return;
+        auto it = networks.find(assign_string(&scratch_net, msg->network));
+        if (it == networks.end() || it->second.userinfo.empty()) return;
+
+        // some servers send user@host
+        auto host = make_string(msg->params[1]);
+        auto &info = it->second.userinfo;
+        if (host.find('@') != string::npos) {
+            info.erase(min(info.find_first_of("!@"), info.length()));
+            info += '!';
+        } else {
+            // a user still unknown is left for fragment_size to assume
+            info.erase(min(info.find('@'), info.length()));
+            info += '@';
         }
+        info += host;
+    }
+
+    /* Handle 005, which may list the channel prefixes */
+    void isupport(const glirc_message *msg) {
+        static const char key[] = "CHANTYPES=";
+        // the first parameter is our nick and the last is text
+        for (size_t i = 1; i + 1 < msg->params_n; i++) {
+            auto &p = msg->params[i];
+            if (p.len >= sizeof key - 1 && !memcmp(p.str, key, sizeof key - 1)) {
+                networks[make_string(msg->network)].chantypes.assign(
+                    p.str + sizeof key - 1, p.len - (sizeof key - 1));
+            }
+        }
+    }
+
+    /* Copy the sender of a received message into the scratch buffer in
+     * normalized form */
+    const string &normalized_sender(const glirc_message *msg) {
+        assign_string(&scratch_peer, msg->prefix_nick);
+        normalizeCase(&scratch_peer);
+        return scratch_peer;
+    }
+
+    /* True when a message was sent to our nick rather than to a
+     * channel or some other target */
+    bool addressed_to_me(const glirc_message *msg) {
+        const string &me = my_nick(assign_string(&scratch_net, msg->network));
+        glirc_string me_str = { me.data(), me.length() };
+        return !me.empty() && glirc_id_cmp(msg->params[0], me_str) == 0;
+    }
+
+    /* True when messages with a peer must go through libotr even
+     * without an OTR marker */
+    bool needs_otr(const string &network, const string &me, const string &peer) {
+        auto it = peers.find(peer_key(&scratch_key, network, me, peer));
+        return it != peers.end() && (it->second.in_flight > 0 || it->second.secure);
+    }
 
-        glirc_free_strings(networks);
+    void post(Job job) {
+        if (job.for_peer()) {
+            peers[peer_key(&scratch_key, job.network, job.me, job.peer)].in_flight++;
+        }
+        crypto->post(move(job));
     }
 
-    /* BATCH logic */
+    /* Take in what the OTR thread did for a job */
+    void apply(Outcome &o) {
+        for (auto &p : o.prints) {
+            glirc_print(G, p.first, p.second.c_str(), p.second.length());
+        }
+
+        move(o.sends.begin(), o.sends.end(), back_inserter(pending_sends));
+        move(o.chats.begin(), o.chats.end(), back_inserter(pending_chats));
 
-    /* Initialize a network, resets the batch state */
-    void add_network(const string &net) {
-        batch_reftags.erase(net);
-        batch_reftags.insert(make_tuple(net, unordered_set<string>()));
+        for (auto &d : o.done) {
+            auto it = peers.find(d.first);
+            if (it == peers.end()) continue;
+            if (it->second.in_flight > 0) it->second.in_flight--;
+            it->second.secure = d.second;
+            if (it->second.in_flight == 0 && !it->second.secure) peers.erase(it);
+        }
+
+        if (o.poll_changed) set_poll_interval(o.poll_interval);
+        if (o.fingerprints_changed) fingerprints_changed();
+    }
+
+    /* Every new fingerprint and every change of trust rewrites the
+     * whole file, so changes close together are saved once */
+    void fingerprints_changed() {
+        if (fingerprints_timer == 0) {
+            fingerprints_timer = glirc_timer_start(G, FINGERPRINT_SAVE_MS, fingerprints_due, this);
+        }
     }
 
-    /* Start a batch for the given network tag and ref tag */
-    void start_batch(const string &net, const string &reftag) {
-        batch_reftags[net].insert(reftag);
+    /* Send the queued PRIVMSGs and show the queued chat lines, each
+     * with a single call into the client */
+    void flush() {
+        if (!pending_sends.empty()) {
+            vector<glirc_string> params;
+            vector<glirc_message> msgs;
+            params.reserve(2 * pending_sends.size());
+            msgs.reserve(pending_sends.size());
+
+            for (auto &p : pending_sends) {
+                params.push_back({p.target.c_str(), p.target.length()});
+                params.push_back({p.message.c_str(), p.message.length()});
+            }
+
+            for (size_t i = 0; i < pending_sends.size(); i++) {
+                struct glirc_message m = {
+                  .network  = { pending_sends[i].network.c_str(), pending_sends[i].network.length() },
+                  .command  = mk_glirc_string("PRIVMSG"),
+                  .params   = &params[2*i],
+                  .params_n = 2,
+                };
+                msgs.push_back(m);
+            }
+
+            glirc_send_messages(G, msgs.data(), msgs.size());
+            pending_sends.clear();
+        }
+
+        if (!pending_chats.empty()) {
+            vector<glirc_injected_chat> chats;
+            chats.reserve(pending_chats.size());
+
+            for (auto &c : pending_chats) {
+                chats.push_back({
+                  { c.network.c_str(), c.network.length() },
+                  { c.source.c_str() , c.source.length()  },
+                  { c.target.c_str() , c.target.length()  },
+                  { c.message.c_str(), c.message.length() },
+                });
+            }
+
+            glirc_inject_chats(G, chats.data(), chats.size());
+            pending_chats.clear();
+        }
     }
 
-    /* End a batch for the given network tag and ref tag */
-    void end_batch(const string &net, const string &reftag) {
-        batch_reftags[net].erase(reftag);
+    /* True when a target is a channel on a network. The prefixes are
+     * kept from 001 and 005. When the extension starts on a network
+     * that is already connected, the client is asked once about the
+     * prefixes servers use. */
+    bool is_channel(const string &net, const string &tgt) {
+        auto &state = networks[net];
+        if (state.chantypes.empty()) {
+            for (char c : string(KNOWN_CHANTYPES)) {
+                char name[] = { c, 'x', '\0' };
+                if (glirc_is_channel(G, net.c_str(), net.length(), name, 2)) {
+                    state.chantypes += c;
+                }
+            }
+            // so that the client is not asked again
+            if (state.chantypes.empty()) state.chantypes = DEFAULT_CHANTYPES;
+        }
+        return !tgt.empty() && state.chantypes.find(tgt[0]) != string::npos;
     }
 
-    /* Predicate to check if any batch is active on a particular network */
-    bool in_batch(const string &net) {
-        auto it = batch_reftags.find(net);
-        return it != end(batch_reftags) && !it->second.empty();
+private:
+    /* State of the network of a message sent by us, or nullptr */
+    network_state *my_message(const glirc_message *msg) {
+        auto it = networks.find(assign_string(&scratch_net, msg->network));
+        if (it == networks.end() || it->second.nick.empty()) return nullptr;
+        glirc_string me = { it->second.nick.data(), it->second.nick.length() };
+        return glirc_id_cmp(msg->prefix_nick, me) == 0 ? &it->second : nullptr;
     }
 };
 
-void glirc_vprintf (struct glirc *G, const char *net, const char *src, const char *tgt,
+void glirc_vprintf (OpData *opdata, const char *net, const char *src, const char *tgt,
                     const char *fmt, va_list ap)
 {
   char *msg = NULL;
@@ -212,31 +861,27 @@ void glirc_vprintf (struct glirc *G, const char *net, const char *src, const cha
 
   if (0 > len || !msg) abort();
 
-  glirc_inject_chat
-    (G, net, strlen(net),
-     src, strlen(src),
-     tgt, strlen(tgt),
-     msg, len);
+  opdata->queue_chat(net, src, tgt, string(msg, len));
 
   free(msg);
 }
 
-void glirc_printf(struct glirc *, const char *, const char *, const char *, const char *, ...)
+void glirc_printf(OpData *, const char *, const char *, const char *, const char *, ...)
 __attribute__ ((format (printf, 5, 6)));
 
-void glirc_printf (struct glirc *G, const char *net, const char *src,
+void glirc_printf (OpData *opdata, const char *net, const char *src,
                    const char *tgt, const char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  glirc_vprintf(G, net, src, tgt, fmt, ap);
+  glirc_vprintf(opdata, net, src, tgt, fmt, ap);
   va_end(ap);
 }
 
-void print_status(struct glirc *, ConnContext *, const char *, ...)
+void print_status(OpData *, ConnContext *, const char *, ...)
 __attribute__ ((format (printf, 3, 4)));
 
-void print_status(struct glirc *G, ConnContext *context, const char *fmt, ...)
+void print_status(OpData *opdata, ConnContext *context, const char *fmt, ...)
 {
   const char *net = context->protocol;
   const char *src = PLUGIN_USER;
@@ -244,11 +889,10 @@ void print_status(struct glirc *G, ConnContext *context, const char *fmt, ...)
 
   va_list ap;
   va_start(ap, fmt);
-  glirc_vprintf(G, net, src, tgt, fmt, ap);
+  glirc_vprintf(opdata, net, src, tgt, fmt, ap);
   va_end(ap);
 }
 
-
 char *state_path(const char *what)
 {
   const char *home = getenv("HOME");
@@ -266,6 +910,29 @@ OtrlPolicy op_policy(void *L, ConnContext *context)
   return OTRL_POLICY_DEFAULT & ~OTRL_POLICY_SEND_WHITESPACE_TAG;
 }
 
+/* An AKE with a peer started with a D-H commit message, sent or
+ * received. A later one restarts its timing. */
+void ake_started(OpData *opdata, const string &network, const string &me, const string &peer)
+{
+  string key;
+  peer_key(&key, network, me, peer);
+  opdata->akes[key] = chrono::steady_clock::now();
+  opdata->stats[network].akes_started++;
+}
+
+/* The session with a context's peer was secured or refreshed */
+void ake_finished(OpData *opdata, ConnContext *context)
+{
+  string key;
+  peer_key(&key, context->protocol, context->accountname, context->username);
+
+  auto it = opdata->akes.find(key);
+  if (it == opdata->akes.end()) return;
+
+  opdata->stats[context->protocol].akes_completed.add(chrono::steady_clock::now() - it->second);
+  opdata->akes.erase(it);
+}
+
 void handle_smp_event
   (void *L, OtrlSMPEvent smp_event, ConnContext *context,
    unsigned short progress_percent, char *question)
@@ -275,6 +942,25 @@ void handle_smp_event
 
   if (smp_event >= 9) return;
 
+  auto &stats = opdata->stats[context->protocol];
+  switch (smp_event) {
+    case OTRL_SMPEVENT_ASK_FOR_ANSWER:
+    case OTRL_SMPEVENT_ASK_FOR_SECRET:
+      stats.smp_started++;
+      break;
+    case OTRL_SMPEVENT_SUCCESS:
+      stats.smp_succeeded++;
+      break;
+    case OTRL_SMPEVENT_FAILURE:
+    case OTRL_SMPEVENT_CHEATED:
+    case OTRL_SMPEVENT_ABORT:
+    case OTRL_SMPEVENT_ERROR:
+      stats.smp_failed++;
+      break;
+    default:
+      break;
+  }
+
   const char *messages[9] = {};
   messages[OTRL_SMPEVENT_NONE          ] = BOLD("none");
   messages[OTRL_SMPEVENT_ERROR         ] = RED("error");
@@ -289,13 +975,13 @@ void handle_smp_event
   const char *message = messages[smp_event];
 
   if (question) {
-    print_status(opdata->G, context, "Peer verification [%s] [%s]", message, question);
+    print_status(opdata, context, "Peer verification [%s] [%s]", message, question);
   } else {
-    print_status(opdata->G, context, "Peer verification [%s]", message);
+    print_status(opdata, context, "Peer verification [%s]", message);
   }
 
   if (smp_event == OTRL_SMPEVENT_ASK_FOR_ANSWER || smp_event == OTRL_SMPEVENT_ASK_FOR_SECRET) {
-    print_status(opdata->G, context, "Reply with: /extension " NAME " secret <answer>");
+    print_status(opdata, context, "Reply with: /extension " NAME " secret <answer>");
   }
 }
 
@@ -304,7 +990,6 @@ inject_message
   (void *L, const char *accountname,
   const char *protocol, const char *recipient, const char *message)
 {
-  (void)accountname;
   GET_opdata;
 
   OtrlMessageType msgtype = otrl_proto_message_type(message);
@@ -314,19 +999,14 @@ inject_message
     message = QUERY_TEXT;
   }
 
-  struct glirc_string params[2] = {
-    mk_glirc_string(recipient),
-    mk_glirc_string(message),
-  };
-
-  struct glirc_message m = {
-    .network  = mk_glirc_string(protocol),
-    .command  = mk_glirc_string("PRIVMSG"),
-    .params   = params,
-    .params_n = 2,
-  };
+  bool last;
+  if (is_fragment(message, &last)) {
+    opdata->stats[protocol].fragments_sent++;
+  } else if (msgtype == OTRL_MSGTYPE_DH_COMMIT) {
+    ake_started(opdata, protocol, accountname, recipient);
+  }
 
-  glirc_send_message(opdata->G, &m);
+  opdata->queue_send(protocol, recipient, message);
 }
 
 void
@@ -360,40 +1040,44 @@ handle_msg_event
 
   if (desc) {
     if (message) {
-      print_status(opdata->G, context, "%s [%s]", desc, message);
+      print_status(opdata, context, "%s [%s]", desc, message);
     } else {
-      print_status(opdata->G, context, "%s", desc);
+      print_status(opdata, context, "%s", desc);
     }
   }
 }
 
+// Fragments are as long as fit in the line the server relays to the
+// peer, which depends on our prefix and the peer's nick. When none fit
+// this is 0 and send_job refuses encrypted messages.
 int max_message_size(void *L, ConnContext *context)
 {
-  (void)L, (void)context;
+  GET_opdata;
 
-  return 400; // pessimistic
+  auto job = opdata->job;
+  string userinfo = job && !job->userinfo.empty() ? job->userinfo : context->accountname;
+
+  return fragment_size(userinfo, strlen(context->username));
 }
 
+// The client thread asks the client for the commands that need this
 int is_logged_in
   (void *L, const char *accountname, const char *protocol,
    const char *recipient)
 {
-  (void)accountname;
+  (void)accountname, (void)protocol, (void)recipient;
   GET_opdata;
 
-  int seen = glirc_is_logged_on(opdata->G,
-                                protocol,  strlen(protocol),
-                                recipient, strlen(recipient));
-
-  return seen ? 1 : -1; // not seen just means we might not share a channel
+  return opdata->job ? opdata->job->logged_in : -1;
 }
 
 void gone_secure(void *L, ConnContext *context)
 {
   GET_opdata;
+  ake_finished(opdata, context);
 
   auto trusted = otrl_context_is_fingerprint_trusted(context->active_fingerprint);
-  print_status(opdata->G, context,
+  print_status(opdata, context,
       "Connection secured [%s]",
       trusted  ? GREEN("trusted") : RED("untrusted"));
 }
@@ -401,10 +1085,11 @@ void gone_secure(void *L, ConnContext *context)
 void still_secure(void *L, ConnContext *context, int is_reply)
 {
   GET_opdata;
+  ake_finished(opdata, context);
 
   auto trusted = otrl_context_is_fingerprint_trusted(context->active_fingerprint);
 
-  print_status(opdata->G, context,
+  print_status(opdata, context,
       "Connection refreshed [%s] [%s]",
       is_reply ? BOLD("remotely") : BOLD("locally"),
       trusted  ? GREEN("trusted") : RED("untrusted"));
@@ -421,25 +1106,76 @@ new_fingerprint
   char human[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
   otrl_privkey_hash_to_human(human, fp);
 
-  glirc_printf(opdata->G, net, PLUGIN_USER, tgt, "New fingerprint: [" BOLD("%s") "]", human);
+  glirc_printf(opdata, net, PLUGIN_USER, tgt, "New fingerprint: [" BOLD("%s") "]", human);
+}
+
+// Serialize the fingerprints on the OTR thread, which owns the user
+// state, and leave writing the file to the writer thread
+void save_fingerprints(OpData *opdata)
+{
+  char *path = state_path("fingerprints");
+  if (!path) return;
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  if (out) {
+    gcry_error_t err;
+    {
+      LibotrTimer timer(&opdata->other_libotr);
+      err = opdata->otr.privkey_write_fingerprints(out);
+    }
+    fclose(out);
+    if (!err) {
+      opdata->writer.save(path, string(buf, len));
+      opdata->fingerprints_dirty = false;
+    }
+    free(buf);
+  }
+  free(path);
 }
 
 void write_fingerprints(void *L)
 {
   GET_opdata;
+  opdata->out.fingerprints_changed = true;
+  opdata->fingerprints_dirty = true;
+}
 
-  char *path = state_path("fingerprints");
-  if (path) opdata->otr.privkey_write_fingerprints(path);
-  free(path);
+void glirc_print_fmt(OpData *, enum message_code, const char *, ...)
+__attribute__ ((format (printf, 3, 4)));
+
+void glirc_print_fmt(OpData *opdata, enum message_code code, const char *fmt, ...)
+{
+  char *msg = NULL;
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vasprintf(&msg, fmt, ap);
+  va_end(ap);
+
+  if (0 > len || !msg) abort();
+
+  opdata->print(code, string(msg, len));
+  free(msg);
 }
 
+// libotr asks for a key when it needs one for an AKE. Generating it
+// takes seconds, so it is only started here. The AKE that asked fails
+// and the peer can start another once the key is ready.
 void create_privkey(void *L, const char *accountname, const char *protocol)
 {
     GET_opdata;
 
-    char *path = state_path("keys");
-    if (path) opdata->otr.privkey_generate(path, accountname, protocol);
-    free(path);
+    if (opdata->find_keygen(accountname, protocol)) return;
+
+    if (opdata->start_keygen(accountname, protocol)) {
+      glirc_print_fmt(opdata, NORMAL_MESSAGE,
+          "OTR: Generating a private key for %s on %s, "
+          "OTR messages sent meanwhile are held until it is ready", accountname, protocol);
+    } else {
+      glirc_print_fmt(opdata, ERROR_MESSAGE,
+          "OTR: Failed to start generating a private key for %s on %s", accountname, protocol);
+    }
 }
 
 
@@ -452,43 +1188,159 @@ void create_instag(void *L, const char *accountname, const char *protocol)
     free(path);
 }
 
+void results_ready(struct glirc *, void *, int, int);
+
 void *start_entrypoint(struct glirc *G, const char *libpath)
 {
   (void)libpath;
 
   OTRL_INIT;
-  auto opdata = new OpData(G);
-
-  opdata->populate_networks();
+  auto crypto = new OpData;
 
+  // Read before the OTR thread starts, which owns the user state after
   char *path = state_path("keys");
-  if (path) opdata->otr.privkey_read(path);
+  if (path) crypto->otr.privkey_read(path);
   free(path);
 
   path = state_path("fingerprints");
-  if (path) opdata->otr.privkey_read_fingerprints(path);
+  if (path) crypto->otr.privkey_read_fingerprints(path);
   free(path);
 
   path = state_path("instags");
-  if (path) opdata->otr.instag_read(path);
+  if (path) crypto->otr.instag_read(path);
   free(path);
 
-  return opdata;
+  if (!crypto->start()) {
+    const char *msg = "OTR: Failed to start the OTR thread";
+    glirc_print(G, ERROR_MESSAGE, msg, strlen(msg));
+    delete crypto;
+    return nullptr;
+  }
+
+  auto ext = new Extension(G, crypto);
+  ext->result_watch = glirc_watch_fd(G, crypto->result_pipe[0], GLIRC_FD_READ, results_ready, ext);
+  return ext;
 }
 
-void stop_entrypoint(struct glirc *G, void *L)
+void report_save_error(Extension *ext)
+{
+  if (int err = ext->crypto->writer.take_error()) {
+    auto msg = string("OTR: Failed to save fingerprints: ") + strerror(err);
+    glirc_print(ext->G, ERROR_MESSAGE, msg.c_str(), msg.length());
+  }
+}
+
+void fingerprints_due(struct glirc *G, void *L)
 {
   (void)G;
+  GET_ext;
+  ext->fingerprints_timer = 0;
+  report_save_error(ext);
+
+  Job job;
+  job.kind = Job::SAVE_FINGERPRINTS;
+  ext->post(move(job));
+}
+
+void stop_entrypoint(struct glirc *G, void *L)
+{
+  GET_ext;
+  if (!ext) return;
+  ext->set_poll_interval(0);
+
+  if (ext->fingerprints_timer) {
+    glirc_timer_cancel(G, ext->fingerprints_timer);
+    ext->fingerprints_timer = 0;
+  }
+
+  // Changes not yet saved are written before unloading, including
+  // those in results not yet applied. The jobs run in order, so this
+  // runs after every job posted before it, and the OTR thread saves
+  // again on stopping if a later job changed anything.
+  Job job;
+  job.kind = Job::SAVE_FINGERPRINTS;
+  ext->post(move(job));
+
+  // Runs the jobs already posted and waits for keys being generated
+  ext->crypto->stop();
+  ext->crypto->writer.finish();
+  report_save_error(ext);
+
+  // Messages from the last jobs are sent even though results_ready
+  // won't run again. Their fingerprint changes are already saved.
+  Outcome outcome;
+  while (ext->crypto->results.pop(&outcome)) {
+    outcome.fingerprints_changed = false;
+    ext->apply(outcome);
+  }
+  ext->flush();
+
+  // and no poll timer they started outlives the extension
+  ext->set_poll_interval(0);
+
+  glirc_unwatch_fd(G, ext->result_watch);
+  delete ext->crypto;
+  delete ext;
+}
+
+// libotr asks for otrl_message_poll to be called every interval seconds
+void timer_control(void *L, unsigned int interval)
+{
   GET_opdata;
-  delete opdata;
+  opdata->out.poll_changed  = true;
+  opdata->out.poll_interval = interval;
+}
+
+// Timers fire once, so the poll timer is rescheduled. The OTR thread
+// reports when libotr changes the interval while polling.
+void poll_entrypoint(struct glirc *G, void *L)
+{
+  (void)G;
+  GET_ext;
+  ext->poll_timer = 0;
+
+  Job job;
+  job.kind = Job::POLL;
+  ext->post(move(job));
+
+  if (ext->poll_interval > 0) {
+    ext->set_poll_interval(ext->poll_interval);
+  }
+}
+
+// Carry out on the client thread what the OTR thread did
+void results_ready(struct glirc *G, void *L, int fd, int events)
+{
+  (void)G, (void)events;
+  GET_ext;
+
+  char buf[64];
+  while (read(fd, buf, sizeof buf) > 0) {}
+
+  // cleared before looking at the results so that the OTR thread
+  // writes another byte for any it publishes after this
+  ext->crypto->notified = false;
+  atomic_thread_fence(memory_order_seq_cst);
+
+  Outcome outcome;
+  while (ext->crypto->results.pop(&outcome)) {
+    ext->apply(outcome);
+  }
+  ext->flush();
 }
 
 
-// Rebuild the userinfo "nick!user@host" from the prefix
-// fields of a glirc message
+// Recover the userinfo "nick!user@host" of a glirc message, slicing
+// it from the received line when available and rebuilding it from
+// the prefix fields otherwise
 string
 rebuild_userinfo(const struct glirc_message *msg)
 {
+    if (msg->raw.str != nullptr) {
+        return string(msg->raw.str + msg->prefix_span.offset,
+                      msg->prefix_span.len);
+    }
+
     ostringstream out;
     out << msg->prefix_nick.str;
 
@@ -503,42 +1355,23 @@ rebuild_userinfo(const struct glirc_message *msg)
     return out.str();
 }
 
+// Decide right away whether the client shows a received message. OTR
+// messages are dropped and handed to the OTR thread, which shows what
+// they decrypt to. Plain text is only handed over when libotr has to
+// see it, to keep it in order or to warn that it wasn't encrypted.
 enum process_result
-process_welcome(OpData *opdata, const struct glirc_message *msg) {
-        opdata->add_network(make_string(msg->network));
-        return PASS_MESSAGE;
-}
-
-enum process_result
-process_batch(OpData *opdata, const struct glirc_message *msg) {
-
-        if (msg->params_n < 1) return PASS_MESSAGE;
-
-        auto reftag_ptr = msg->params[0].str;
-        auto reftag = string(reftag_ptr+1, msg->params[0].len - 1);
-        auto net = make_string(msg->network);
-
-        switch (*reftag_ptr) {
-                case '+':
-                        opdata->start_batch(net, reftag);
-                        break;
-                case '-':
-                        opdata->end_batch(net, reftag);
-                        break;
-        }
-
-        return PASS_MESSAGE;
-}
-
-enum process_result
-process_privmsg(OpData *opdata, const struct glirc_message *msg)
+process_privmsg(Extension *ext, const struct glirc_message *msg)
 {
     if (msg->params_n != 2) {
         return PASS_MESSAGE;
     }
 
-    auto net = make_string(msg->network);
-    if (opdata->in_batch(net)) {
+    bool marked = maybe_otr(msg->params[1].str, msg->params[1].len);
+
+    // Messages in a batch are playback, so don't feed them to the OTR
+    // state machine
+    if (msg->batch_ref.len > 0) {
+        if (!marked) return PASS_MESSAGE;
         switch (otrl_proto_message_type(msg->params[1].str)) {
                 default: return DROP_MESSAGE;
                 case OTRL_MSGTYPE_NOTOTR:
@@ -547,135 +1380,379 @@ process_privmsg(OpData *opdata, const struct glirc_message *msg)
         }
     }
 
-    auto target  = make_string(msg->params[0]);
-    if (opdata->is_channel(net, target)) {
+    // Only messages sent to our own nick can be OTR messages. This
+    // also fills in scratch_net.
+    if (!ext->addressed_to_me(msg)) {
         return PASS_MESSAGE;
     }
 
-    auto message = make_string(msg->params[1]);
-    auto sender = make_string(msg->prefix_nick);
-    normalizeCase(&sender);
-    normalizeCase(&target);
+    const string &net    = ext->scratch_net;
+    const string &me     = ext->my_nick(net);
+    const string &sender = ext->normalized_sender(msg);
 
-    int internal;
-    bool has_newmsg;
-    string newmessage;
-    tie(internal, has_newmsg, newmessage) =
-        opdata->otr.message_receiving(target, net, sender, message);
-
-    if (!internal && has_newmsg) {
-        auto userinfo = rebuild_userinfo(msg);
-        glirc_inject_chat(opdata->G,
-                             msg->network.str    , msg->network.len,
-                             userinfo.c_str()    , userinfo.length(),
-                             msg->prefix_nick.str, msg->prefix_nick.len,
-                             newmessage.c_str()  , newmessage.length());
+    // libotr passes plain text from a peer without a session through
+    // unchanged, so it is left alone without copying the message
+    if (!marked && !ext->needs_otr(net, me, sender)) {
+        return PASS_MESSAGE;
     }
 
-    return (internal || has_newmsg) ? DROP_MESSAGE : PASS_MESSAGE;
+    Job job;
+    job.kind     = Job::RECEIVE;
+    job.network  = net;
+    job.me       = me;
+    job.peer     = sender;
+    job.text     = make_string(msg->params[1]);
+    job.source   = rebuild_userinfo(msg);
+    job.target   = make_string(msg->prefix_nick);
+    job.userinfo = ext->my_userinfo(net, me);
+    ext->post(move(job));
+
+    return DROP_MESSAGE;
 }
 
 enum process_result
-message_entrypoint(struct glirc *G, void *L, const struct glirc_message *msg)
+process_message(Extension *ext, const struct glirc_message *msg)
 {
-    GET_opdata;
-    auto cmd = make_string(msg->command);
-
-    if (cmd == "PRIVMSG") {
-        return process_privmsg(opdata, msg);
-    } else if (cmd == "BATCH") {
-        return process_batch(opdata, msg);
-    } else if (cmd == "001") {
-        return process_welcome(opdata, msg);
-    } else {
-        return PASS_MESSAGE;
+    switch (msg->command_code) {
+        case GLIRC_CMD_PRIVMSG:
+            return process_privmsg(ext, msg);
+        case GLIRC_RPL_WELCOME:
+            if (msg->params_n >= 1) {
+                ext->welcome(make_string(msg->network), make_string(msg->params[0]));
+            }
+            return PASS_MESSAGE;
+        case GLIRC_RPL_ISUPPORT:
+            ext->isupport(msg);
+            return PASS_MESSAGE;
+        case GLIRC_RPL_HOSTHIDDEN:
+            ext->host_hidden(msg);
+            return PASS_MESSAGE;
+        case GLIRC_CMD_NICK:
+            ext->nick_changed(msg);
+            return PASS_MESSAGE;
+        case GLIRC_CMD_CHGHOST:
+            ext->host_changed(msg);
+            return PASS_MESSAGE;
+        default:
+            return PASS_MESSAGE;
     }
 }
 
+enum process_result
+message_entrypoint(struct glirc *G, void *L, const struct glirc_message *msg)
+{
+    (void)G;
+    GET_ext;
+    if (!ext) return PASS_MESSAGE;
+    return process_message(ext, msg);
+}
 
+void
+messages_entrypoint
+  (struct glirc *G, void *L, const struct glirc_message * const *msgs,
+   size_t n, unsigned char *drops)
+{
+    (void)G;
+    GET_ext;
+    if (!ext) return;
+    for (size_t i = 0; i < n; i++) {
+        if (process_message(ext, msgs[i]) == DROP_MESSAGE) {
+            glirc_drop_message(drops, i);
+        }
+    }
+}
+
+// Chat messages are sent as written unless libotr has to see them,
+// otherwise they are dropped and the OTR thread sends what libotr
+// makes of them
 enum process_result chat_entrypoint(struct glirc *G, void *L, const struct glirc_chat *chat)
 {
     (void)G;
-    GET_opdata;
+    GET_ext;
+    if (!ext) return PASS_MESSAGE;
 
     auto network = make_string(chat->network);
     auto target  = make_string(chat->target);
-    auto msg     = make_string(chat->message);
 
-    if (opdata->is_channel(network, target)) {
+    if (ext->is_channel(network, target)) {
         return PASS_MESSAGE;
     }
 
-    auto me = opdata->my_nick(network);
+    auto &me = ext->my_nick(network);
     if (me.empty()) return DROP_MESSAGE;
-    normalizeCase(&me);
 
-    normalizeCase(&target);
+    auto peer = target;
+    normalizeCase(&peer);
+
+    if (!maybe_otr(chat->message.str, chat->message.len) && !ext->needs_otr(network, me, peer)) {
+        return PASS_MESSAGE;
+    }
+
+    Job job;
+    job.kind     = Job::SEND;
+    job.network  = network;
+    job.me       = me;
+    job.peer     = move(peer);
+    job.text     = make_string(chat->message);
+    job.target   = move(target);
+    job.userinfo = ext->my_userinfo(network, me);
+    ext->post(move(job));
+
+    return DROP_MESSAGE;
+}
+
+/* Report to the client thread that a job for a peer is done, and
+ * whether the peer now has a session that isn't plain text */
+void report_done(OpData *opdata, const Job &job)
+{
+    auto master = opdata->otr.context_find(job.peer, job.me, job.network, OTRL_INSTAG_MASTER);
+
+    bool secure = false;
+    for (auto c = master; c && c->m_context == master; c = c->next) {
+        if (c->msgstate != OTRL_MSGSTATE_PLAINTEXT) secure = true;
+    }
+
+    string key;
+    peer_key(&key, job.network, job.me, job.peer);
+    opdata->out.done.emplace_back(move(key), secure);
+}
+
+void receive_job(OpData *opdata, const Job &job)
+{
+    auto &stats = opdata->stats[job.network];
+
+    auto msgtype = otrl_proto_message_type(job.text.c_str());
+    bool last = false;
+    bool fragment = is_fragment(job.text.c_str(), &last);
+    if (fragment) {
+        stats.fragments_received++;
+    } else if (msgtype == OTRL_MSGTYPE_DH_COMMIT) {
+        ake_started(opdata, job.network, job.me, job.peer);
+    }
+
+    int internal;
+    bool has_newmsg;
+    string newmessage;
+    {
+        LibotrTimer timer(&stats.libotr);
+        tie(internal, has_newmsg, newmessage) =
+            opdata->otr.message_receiving(job.me, job.network, job.peer, job.text);
+    }
+
+    if (fragment && last) stats.reassembled++;
+    if (has_newmsg && (msgtype == OTRL_MSGTYPE_DATA || (fragment && last))) stats.decrypted++;
+
+    // The client dropped the message, so plain text libotr passes
+    // through is shown from here
+    if (!internal) {
+        opdata->queue_chat(job.network, job.source, job.target,
+                           has_newmsg ? move(newmessage) : job.text);
+    }
+}
+
+// Hand an outgoing chat message to libotr, and send it as written when
+// libotr leaves it alone
+void send_job(OpData *opdata, const Job &job)
+{
+    auto &stats = opdata->stats[job.network];
+
+    auto context = opdata->otr.context_find(job.peer, job.me, job.network);
+    bool encrypting = context && context->msgstate == OTRL_MSGSTATE_ENCRYPTED;
+
+    // libotr would send it whole when no fragment fits in a line
+    if (encrypting && fragment_size(job.userinfo, job.target.length()) == 0) {
+        glirc_printf(opdata, job.network.c_str(), PLUGIN_USER, job.peer.c_str(),
+                     "Message not sent: our prefix and the nick leave no room for OTR fragments");
+        return;
+    }
 
     gcry_error_t err;
     bool has_newmsg;
+    {
+        LibotrTimer timer(&stats.libotr);
+        tie(err,has_newmsg) = opdata->otr.message_sending(job.me, job.network, job.peer, job.text);
+    }
 
-    tie(err,has_newmsg) = opdata->otr.message_sending(me, network, target, msg);
+    if (!err && has_newmsg && encrypting) stats.encrypted++;
 
     if (err) {
-        glirc_printf(opdata->G, network.c_str(), PLUGIN_USER, target.c_str(), "PANIC: OTR encryption error");
+        glirc_printf(opdata, job.network.c_str(), PLUGIN_USER, job.peer.c_str(), "PANIC: OTR encryption error");
+    } else if (!has_newmsg) {
+        // the client didn't show the message when it was handed over
+        opdata->queue_send(job.network, job.target, job.text);
+        opdata->queue_chat(job.network, job.userinfo, job.target, job.text);
     }
+}
+
+// Save a key generated on its own thread and send the messages held
+// while it was generated
+void keygen_done(OpData *opdata, Keygen *keygen)
+{
+    auto k = opdata->take_keygen(keygen);
+    if (!k) return;
+
+    auto seconds = chrono::duration<double>(chrono::steady_clock::now() - k->started).count();
 
-    return err || has_newmsg ? DROP_MESSAGE : PASS_MESSAGE;
+    char *path = state_path("keys");
+    gcry_error_t err = k->err;
+    if (err || !path) {
+        opdata->otr.privkey_generate_cancelled(k->newkey);
+    } else {
+        err = opdata->otr.privkey_generate_finish(k->newkey, path);
+    }
+    free(path);
+
+    if (err) {
+        glirc_print_fmt(opdata, ERROR_MESSAGE,
+            "OTR: Failed to generate a private key for %s on %s, %zu held messages dropped",
+            k->accountname.c_str(), k->protocol.c_str(), k->held.size());
+    } else {
+        glirc_print_fmt(opdata, NORMAL_MESSAGE,
+            "OTR: Private key for %s on %s ready after %.1f s",
+            k->accountname.c_str(), k->protocol.c_str(), seconds);
+    }
+
+    for (auto &h : k->held) {
+        opdata->job = &h;
+        if (!err) send_job(opdata, h);
+        report_done(opdata, h);
+    }
+}
+
+// Keys still being generated when the extension stops are waited for
+// and saved. Held messages are dropped.
+void stop_keygens(OpData *opdata)
+{
+  char *path = state_path("keys");
+  for (auto &k : opdata->keygens) {
+    k->worker.join();
+    if (k->err || !path) {
+      opdata->otr.privkey_generate_cancelled(k->newkey);
+    } else {
+      opdata->otr.privkey_generate_finish(k->newkey, path);
+    }
+  }
+  opdata->keygens.clear();
+  free(path);
 }
 
-void cmd_end (OpData *opdata, const string &params)
+void run_job(OpData *opdata, Job &job)
 {
-  (void)params;
+    opdata->job = &job;
+
+    switch (job.kind) {
+        case Job::RECEIVE:
+            receive_job(opdata, job);
+            break;
+
+        case Job::SEND:
+            // libotr can't use an account while its key is being generated
+            if (auto k = opdata->find_keygen(job.me, job.network)) {
+                glirc_printf(opdata, job.network.c_str(), PLUGIN_USER, job.target.c_str(),
+                             "Message held until the private key is ready");
+                k->held.push_back(move(job));
+                opdata->job = nullptr;
+                return;
+            }
+            send_job(opdata, job);
+            break;
+
+        case Job::COMMAND:
+            job.command(opdata, job);
+            break;
+
+        case Job::POLL: {
+            LibotrTimer timer(&opdata->other_libotr);
+            opdata->otr.message_poll();
+            break;
+        }
+
+        case Job::SAVE_FINGERPRINTS:
+            save_fingerprints(opdata);
+            break;
+
+        case Job::KEYGEN_DONE:
+            keygen_done(opdata, job.keygen);
+            break;
 
-  string net, tgt;
-  tie(net,tgt) = opdata->current_focus();
-  if (net.empty() || tgt.empty()) return;
-  normalizeCase(&tgt);
+        case Job::STOP:
+            break;
+    }
+
+    if (job.for_peer()) report_done(opdata, job);
+    opdata->job = nullptr;
+}
+
+void OpData::run()
+{
+    for (;;) {
+        Job next;
+        if (!jobs.pop(&next)) {
+            publish();
+            wait();
+            continue;
+        }
+        if (next.kind == Job::STOP) {
+            if (fingerprints_dirty) save_fingerprints(this);
+            publish();
+            break;
+        }
+        run_job(this, next);
+        if (jobs.empty()) publish();
+    }
+    stop_keygens(this);
+}
 
-  auto me = opdata->my_nick(net);
-  if (me.empty()) return;
-  normalizeCase(&me);
+/* The context of the peer in the window a command was given in */
+ConnContext *get_current_context(OpData *opdata, const Job &job)
+{
+    if (!job.for_peer()) return NULL;
+    return opdata->otr.context_find(job.peer, job.me, job.network);
+}
 
-  opdata->otr.message_disconnect_all_instances(me, net, tgt);
+void cmd_end (OpData *opdata, const Job &job)
+{
+  if (!job.for_peer()) return;
 
-  const char * const src = PLUGIN_USER;
-  const char * const msg = RED("Session terminated");
+  {
+    LibotrTimer timer(&opdata->stats[job.network].libotr);
+    opdata->otr.message_disconnect_all_instances(job.me, job.network, job.peer);
+  }
 
-  glirc_inject_chat
-    (opdata->G,
-        net.c_str(), net.length(),
-        src, strlen(src),
-        tgt.c_str(), tgt.length(),
-        msg, strlen(msg));
+  opdata->queue_chat(job.network, PLUGIN_USER, job.peer, RED("Session terminated"));
 }
 
 
-void cmd_ask (OpData *opdata, const string &params)
+void cmd_ask (OpData *opdata, const Job &job)
 {
-    auto context = opdata->get_current_context();
+    auto context = get_current_context(opdata, job);
 
     if (context) {
-        opdata->otr.message_initiate_smp(context, params);
+        auto &stats = opdata->stats[job.network];
+        stats.smp_started++;
+        LibotrTimer timer(&stats.libotr);
+        opdata->otr.message_initiate_smp(context, job.text);
     }
 }
 
 
-void cmd_secret (OpData *opdata, const string &params)
+void cmd_secret (OpData *opdata, const Job &job)
 {
-    auto context = opdata->get_current_context();
+    auto context = get_current_context(opdata, job);
 
     // without this extra checking libotr will segfault if an exchange
     // is not active
     if (context && context->smstate && context->smstate->secret) {
-        opdata->otr.message_respond_smp(context, params);
+        LibotrTimer timer(&opdata->stats[job.network].libotr);
+        opdata->otr.message_respond_smp(context, job.text);
     }
 }
 
 
-void cmd_poll (OpData *opdata, const string &params)
+void cmd_poll (OpData *opdata, const Job &job)
 {
-  (void)params;
+  (void)job;
+  LibotrTimer timer(&opdata->other_libotr);
   opdata->otr.message_poll();
 }
 
@@ -683,56 +1760,45 @@ void cmd_poll (OpData *opdata, const string &params)
 /*
  * Manually mark the fingerprint associated with the current window trusted.
  */
-void cmd_trust (OpData *opdata, const string &params)
+void cmd_trust (OpData *opdata, const Job &job)
 {
-  (void)params;
-
-  auto context = opdata->get_current_context();
+  auto context = get_current_context(opdata, job);
   if (!context || !context->active_fingerprint) return;
 
   otrl_context_set_trust(context->active_fingerprint, "manual");
-
-  char *path = state_path("fingerprints");
-  if (path) otrl_privkey_write_fingerprints(opdata->otr.us, path);
-  free(path);
+  opdata->out.fingerprints_changed = true;
+  opdata->fingerprints_dirty = true;
 
   char human[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
   otrl_privkey_hash_to_human(human, context->active_fingerprint->fingerprint);
-  print_status(opdata->G, context, "Fingerprint trusted [" BOLD("%s") "]", human);
+  print_status(opdata, context, "Fingerprint trusted [" BOLD("%s") "]", human);
 }
 
 /*
  * Manually mark the fingerprint associated with the current window untrusted.
  */
-void cmd_untrust (OpData *opdata, const string &params)
+void cmd_untrust (OpData *opdata, const Job &job)
 {
-  (void)params;
-
-  auto context = opdata->get_current_context();
+  auto context = get_current_context(opdata, job);
   if (!context || !context->active_fingerprint) return;
 
   otrl_context_set_trust(context->active_fingerprint, "");
-
-  char *path = state_path("fingerprints");
-  if (path) otrl_privkey_write_fingerprints(opdata->otr.us, path);
-  free(path);
+  opdata->out.fingerprints_changed = true;
+  opdata->fingerprints_dirty = true;
 
   char human[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
   otrl_privkey_hash_to_human(human, context->active_fingerprint->fingerprint);
-  print_status(opdata->G, context, "Fingerprint untrusted [" BOLD("%s") "]", human);
+  print_status(opdata, context, "Fingerprint untrusted [" BOLD("%s") "]", human);
 }
 
 /*
  * Print status information for the current context to the chat window
  */
-void cmd_status (OpData *opdata, const string &params)
+void cmd_status (OpData *opdata, const Job &job)
 {
-  (void)params;
-
-  auto context = opdata->get_current_context();
+  auto context = get_current_context(opdata, job);
   if (!context) {
-    const char *msg = "No OTR context for current window";
-    glirc_print(opdata->G, ERROR_MESSAGE, msg, strlen(msg));
+    opdata->print(ERROR_MESSAGE, "No OTR context for current window");
     return;
   }
 
@@ -741,7 +1807,7 @@ void cmd_status (OpData *opdata, const string &params)
           otrl_privkey_fingerprint(opdata->otr.us, human, context->accountname, context->protocol);
 
   if (myfp) {
-    print_status(opdata->G, context, "Local  fingerprint [" BOLD("%s") "]", myfp);
+    print_status(opdata, context, "Local  fingerprint [" BOLD("%s") "]", myfp);
   }
 
   Fingerprint *fp = context->active_fingerprint;
@@ -749,13 +1815,13 @@ void cmd_status (OpData *opdata, const string &params)
     otrl_privkey_hash_to_human(human, fp->fingerprint);
 
     if (otrl_context_is_fingerprint_trusted(fp)) {
-      print_status(opdata->G, context, "Remote fingerprint [" BOLD("%s") "] [" GREEN("%s") "]", human, fp->trust);
+      print_status(opdata, context, "Remote fingerprint [" BOLD("%s") "] [" GREEN("%s") "]", human, fp->trust);
     } else {
-      print_status(opdata->G, context, "Remote fingerprint [" BOLD("%s") "] [" RED("untrusted") "]", human);
+      print_status(opdata, context, "Remote fingerprint [" BOLD("%s") "] [" RED("untrusted") "]", human);
     }
   }
 
-  print_status(opdata->G, context,
+  print_status(opdata, context,
       "Local instance [" BOLD("%08X") "] Remote instance [" BOLD("%08X") "] Protocol [" BOLD("%u") "]",
       context->our_instance, context->their_instance, context->protocol_version);
 
@@ -765,18 +1831,61 @@ void cmd_status (OpData *opdata, const string &params)
     [OTRL_MSGSTATE_FINISHED ] = RED  ("finished" ),
   };
 
-  print_status(opdata->G, context, "Connection state [%s]", statuses[context->msgstate]);
+  print_status(opdata, context, "Connection state [%s]", statuses[context->msgstate]);
 }
 
-// Command metadata
+/*
+ * Print the counters of every network, to tell how much OTR costs
+ */
+void cmd_stats (OpData *opdata, const Job &job)
+{
+  (void)job;
+
+  auto ms   = [](chrono::nanoseconds d) { return chrono::duration<double, milli>(d).count(); };
+  auto mean = [ms](const Timing &t) { return t.n ? ms(t.total) / t.n : 0.0; };
+
+  if (opdata->stats.empty() && !opdata->other_libotr.n) {
+    glirc_print_fmt(opdata, NORMAL_MESSAGE, "OTR: No statistics yet");
+    return;
+  }
+
+  for (auto &entry : opdata->stats) {
+    auto net = entry.first.c_str();
+    auto &s  = entry.second;
+
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: %s: messages encrypted %lu, decrypted %lu",
+        net, s.encrypted, s.decrypted);
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: %s: fragments sent %lu, received %lu, reassembled %lu",
+        net, s.fragments_sent, s.fragments_received, s.reassembled);
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: %s: AKEs started %lu, completed %lu, mean %.1f ms, max %.1f ms",
+        net, s.akes_started, s.akes_completed.n, mean(s.akes_completed), ms(s.akes_completed.longest));
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: %s: SMP started %lu, succeeded %lu, failed %lu",
+        net, s.smp_started, s.smp_succeeded, s.smp_failed);
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: %s: libotr calls %lu, %.1f ms total, mean %.3f ms, max %.1f ms",
+        net, s.libotr.n, ms(s.libotr.total), mean(s.libotr), ms(s.libotr.longest));
+  }
+
+  auto &o = opdata->other_libotr;
+  if (o.n) {
+    glirc_print_fmt(opdata, NORMAL_MESSAGE,
+        "OTR: polls and fingerprint saves: libotr calls %lu, %.1f ms total, mean %.3f ms, max %.1f ms",
+        o.n, ms(o.total), mean(o), ms(o.longest));
+  }
+}
+
+// Command metadata. Commands run on the OTR thread, except for help,
+// which has no implementation there.
 struct cmd_impl {
   const char *name; // Name of command
-  void (*func)(OpData*, const string &); // Implementation
+  void (*func)(OpData*, const Job &); // Implementation
   const char *doc; // Documentation string
 };
 
-void cmd_help(OpData *, const string&);
-
 struct cmd_impl cmd_impls[] = {
   { "status" , cmd_status , "Display the current window's OTR context"              },
   { "secret" , cmd_secret , "Reply to a peer verification request (1 argument)"     },
@@ -784,26 +1893,26 @@ struct cmd_impl cmd_impls[] = {
   { "end"    , cmd_end    , "Close the current window's OTR context"                },
   { "trust"  , cmd_trust  , "Trust the current remote user's fingerprint"           },
   { "untrust", cmd_untrust, "Revoke trust in the current remote user's fingerprint" },
-  { "poll"   , cmd_poll   , "Manually trigger an OTR poll event"                    },
-  { "help"   , cmd_help   , "Show available commands"                               },
+  { "poll"   , cmd_poll   , "Trigger an OTR poll event now (also runs on a timer)"  },
+  { "stats"  , cmd_stats  , "Show OTR counters and time spent in libotr per network" },
+  { "help"   , nullptr    , "Show available commands"                               },
 };
 
-void cmd_help(OpData *opdata, const string &params)
+void cmd_help(Extension *ext)
 {
-  (void)params;
-
-  for_each(begin(cmd_impls), end(cmd_impls), [opdata](auto &&c) {
+  for_each(begin(cmd_impls), end(cmd_impls), [ext](auto &&c) {
       ostringstream out;
       out << "OTR: " << left << setw(7) << c.name << " - " << c.doc;
       auto s = out.str();
-      glirc_print(opdata->G, NORMAL_MESSAGE, s.c_str(), s.length());
+      glirc_print(ext->G, NORMAL_MESSAGE, s.c_str(), s.length());
   });
 }
 
 void command_entrypoint
   (struct glirc *G, void *L, const struct glirc_command *cmd)
 {
-  GET_opdata;
+  GET_ext;
+  if (!ext) return;
 
   auto input = istringstream(make_string(cmd->command));
 
@@ -816,17 +1925,40 @@ void command_entrypoint
   if (entry == end(cmd_impls)) {
       const char *errmsg = "OTR: Unknown command";
       glirc_print(G, ERROR_MESSAGE, errmsg, strlen(errmsg));
+  } else if (!entry->func) {
+      cmd_help(ext);
   } else {
-      string parameters;
-      getline(input, parameters);
-      parameters.erase(0, parameters.find_first_not_of(" "));
-
-      entry->func(opdata, parameters);
+      Job job;
+      job.kind    = Job::COMMAND;
+      job.command = entry->func;
+
+      getline(input, job.text);
+      job.text.erase(0, job.text.find_first_not_of(" "));
+
+      string net, tgt;
+      tie(net,tgt) = ext->current_focus();
+      if (!net.empty() && !tgt.empty()) {
+        job.network   = net;
+        job.me        = ext->my_nick(net);
+        job.userinfo  = ext->my_userinfo(net, job.me);
+        job.logged_in = glirc_is_logged_on(G, net.c_str(), net.length(), tgt.c_str(), tgt.length())
+                      ? 1 : -1; // not seen just means we might not share a channel
+        job.peer      = move(tgt);
+        normalizeCase(&job.peer);
+      }
+
+      ext->post(move(job));
   }
 }
 
+// Only these commands are delivered to message_entrypoint. The others
+// keep what is cached about each network current.
+const char * const message_commands[] = { "PRIVMSG", "001", "005", "396", "NICK", "CHGHOST", NULL };
+
 } /* end namespace */
 
+GLIRC_EXTENSION_API_VERSION;
+
 struct glirc_extension extension __attribute__ ((visibility ("default"))) = {
         .name            = NAME,
         .major_version   = MAJOR,
@@ -836,4 +1968,6 @@ struct glirc_extension extension __attribute__ ((visibility ("default"))) = {
         .process_message = message_entrypoint,
         .process_chat    = chat_entrypoint,
         .process_command = command_entrypoint,
+        .message_commands = message_commands,
+        .process_messages = messages_entrypoint,
 };
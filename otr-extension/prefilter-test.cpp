@@ -0,0 +1,81 @@
+// Test of the prefilter for messages libotr has to see. maybe_otr is
+// compared with a plain substring search on random text, with markers
+// and cut off markers placed at every offset so that they straddle the
+// 16 byte blocks it checks at a time.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "prefilter.hpp"
+
+using namespace std;
+
+namespace {
+
+bool reference(const string &s)
+{
+    return s.find("?OTR") != string::npos || s.find(OTR_TAG_BASE) != string::npos;
+}
+
+int failed;
+
+void check(const string &s)
+{
+    // a copy without spare bytes after it, so reads past the end are
+    // caught by sanitizers
+    auto buf = unique_ptr<char[]>(new char[s.length()]);
+    memcpy(buf.get(), s.data(), s.length());
+
+    if (maybe_otr(buf.get(), s.length()) != reference(s)) {
+        fprintf(stderr, "wrong answer for a message of %zu bytes: ", s.length());
+        for (auto c : s) fprintf(stderr, c == '\t' ? "\\t" : "%c", c);
+        fputc('\n', stderr);
+        failed = 1;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const string markers[] = { "?OTR", "?OTR?v23?", "?OTR:AAMG", OTR_TAG_BASE "  \t\t  \t\t" };
+    mt19937 gen(1);
+
+    // Text that is full of the bytes candidates are found by
+    const char alphabet[] = "?OTR \t\tab";
+    uniform_int_distribution<size_t> pick(0, sizeof alphabet - 2);
+
+    for (size_t len = 0; len <= 80; len++) {
+        for (int n = 0; n < 2000; n++) {
+            string s(len, ' ');
+            for (auto &c : s) c = alphabet[pick(gen)];
+            check(s);
+        }
+    }
+
+    for (size_t len = 0; len <= 64; len++) {
+        string text(len, 'x');
+        for (auto &marker : markers) {
+            for (size_t at = 0; at <= len; at++) {
+                auto s = text;
+                s.insert(at, marker);
+                check(s);
+
+                // every cut off version of the marker
+                for (size_t cut = 1; cut < marker.length(); cut++) {
+                    check(s.substr(0, at + cut));
+                }
+            }
+        }
+    }
+
+    check("Is this OTR? Or not?");
+    check("tab\tseparated\tcolumns");
+
+    puts(failed ? "FAILED" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
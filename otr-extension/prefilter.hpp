@@ -0,0 +1,60 @@
+#pragma once
+#ifndef PREFILTER_HPP
+#define PREFILTER_HPP
+
+#include <cstddef>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// libotr's OTRL_MESSAGE_TAG_BASE, which starts every whitespace tag
+#define OTR_TAG_BASE     " \t  \t\t\t\t \t \t \t  "
+#define OTR_TAG_BASE_LEN 16
+
+namespace prefilter {
+
+// Candidates are found by the '?' of "?OTR" and the first '\t' of the
+// whitespace tag, one byte into it
+inline bool match_at(const char *s, size_t len, size_t i)
+{
+    if (s[i] == '?') {
+        return len - i >= 4 && !memcmp(s + i, "?OTR", 4);
+    }
+    return i >= 1 && len - (i - 1) >= OTR_TAG_BASE_LEN &&
+           !memcmp(s + i - 1, OTR_TAG_BASE, OTR_TAG_BASE_LEN);
+}
+
+} // namespace prefilter
+
+// True when libotr could treat a message as something other than plain
+// text: it contains "?OTR", which starts every OTR message, query and
+// error, or the start of a whitespace tag. This is what
+// otrl_proto_message_type looks for, but it works on the message in
+// place, with no terminating NUL, and checks 16 bytes at a time.
+inline bool maybe_otr(const char *s, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i question = _mm_set1_epi8('?');
+    const __m128i tab      = _mm_set1_epi8('\t');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, question),
+                                                       _mm_cmpeq_epi8(block, tab)));
+        for (; mask; mask &= mask - 1) {
+            if (prefilter::match_at(s, len, i + __builtin_ctz(mask))) return true;
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if ((s[i] == '?' || s[i] == '\t') && prefilter::match_at(s, len, i)) return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,61 @@
+// Test of the queue that feeds the OTR thread. Several threads push
+// numbered items while one thread pops them, and every item must come
+// out exactly once and in the order its producer pushed it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "queue.hpp"
+
+using namespace std;
+
+namespace {
+
+const int PRODUCERS = 4;
+const long ITEMS    = 200000; // per producer
+
+} // namespace
+
+int main()
+{
+    Queue<pair<int, long>> queue;
+    vector<thread> producers;
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&queue, p] {
+            for (long i = 0; i < ITEMS; i++) queue.push(make_pair(p, i));
+        });
+    }
+
+    vector<long> next(PRODUCERS, 0);
+    long received = 0;
+    int failed = 0;
+
+    while (received < PRODUCERS * ITEMS) {
+        pair<int, long> item;
+        if (!queue.pop(&item)) {
+            this_thread::yield();
+            continue;
+        }
+        if (item.second != next[item.first]) {
+            fprintf(stderr, "producer %d: got item %ld, expected %ld\n",
+                    item.first, item.second, next[item.first]);
+            failed = 1;
+        }
+        next[item.first] = item.second + 1;
+        received++;
+    }
+
+    for (auto &t : producers) t.join();
+
+    if (!queue.empty()) {
+        fputs("items left after all were received\n", stderr);
+        failed = 1;
+    }
+
+    puts(failed ? "FAILED" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+// Unbounded queue that any number of threads push to and one thread
+// pops from, without locks. Producers link a new node in with a single
+// exchange. A node whose producer has not finished linking it is not
+// popped yet, so pop may briefly see the queue as empty while a push is
+// under way; whoever waits for items must be woken after push returns.
+template <typename T>
+class Queue {
+        struct node {
+                std::atomic<node *> next;
+                T value;
+                node() : next(nullptr) {}
+        };
+
+        std::atomic<node *> head; // most recently pushed
+        node *tail;               // already popped, its next is the oldest item
+
+public:
+        Queue() : head(new node), tail(head.load()) {}
+        ~Queue() {
+                T value;
+                while (pop(&value)) {}
+                delete tail;
+        }
+        Queue(const Queue &) = delete;
+        Queue &operator=(const Queue &) = delete;
+
+        void push(T value) {
+                auto n = new node;
+                n->value = std::move(value);
+                node *prev = head.exchange(n, std::memory_order_acq_rel);
+                prev->next.store(n, std::memory_order_release);
+        }
+
+        // Only called by the consuming thread
+        bool pop(T *out) {
+                node *next = tail->next.load(std::memory_order_acquire);
+                if (!next) return false;
+                *out = std::move(next->value);
+                delete tail;
+                tail = next;
+                return true;
+        }
+
+        // Only called by the consuming thread
+        bool empty() const {
+                return tail->next.load(std::memory_order_acquire) == nullptr;
+        }
+};
+
+#endif
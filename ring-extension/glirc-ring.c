@@ -0,0 +1,171 @@
+/* Publishes every message the client keeps into a shared-memory ring so
+ * that other local processes can follow the message stream without an
+ * extension of their own, see ring.h.
+ *
+ * Readers connect to the unix socket $GLIRC_RING_SOCKET (default
+ * glirc-ring.sock in $XDG_RUNTIME_DIR, or the current directory) and are
+ * sent the ring's descriptor. ring_reader_connect in ring-reader.c does
+ * this. The ring holds $GLIRC_RING_MB megabytes (default 16).
+ *
+ * The extension is observe-only, so the client delivers to it from its
+ * own thread and publishing never delays the client.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "glirc-api.h"
+#include "ring.h"
+
+#define SOCKET_NAME "glirc-ring.sock"
+#define RING_MB     16
+
+struct ring_ext {
+        struct ring *ring;
+        int listener;          /* listening socket or -1 */
+        watch_id listen_watch;
+        unsigned long readers; /* descriptors handed out */
+        char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+};
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_error(struct glirc *G, const char *what) {
+        char msg[256];
+        int len = snprintf(msg, sizeof msg, "ring: %s: %s", what, strerror(errno));
+        glirc_print(G, ERROR_MESSAGE, msg, len < (int)sizeof msg ? (size_t)len : sizeof msg - 1);
+}
+
+/* Each connection is sent the descriptor and closed */
+static void on_listener(struct glirc *G, void *dat, int fd, int events) {
+        struct ring_ext *s = dat;
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) return;
+
+        if (ring_send_fd(s->ring, client) == 0) s->readers++;
+        close(client);
+}
+
+static int open_listener(struct glirc *G, struct ring_ext *s) {
+        const char *path = getenv("GLIRC_RING_SOCKET");
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        int len = path ? snprintf(s->path, sizeof s->path, "%s", path)
+                : dir  ? snprintf(s->path, sizeof s->path, "%s/%s", dir, SOCKET_NAME)
+                :        snprintf(s->path, sizeof s->path, "%s", SOCKET_NAME);
+        if (len < 0 || len >= (int)sizeof s->path) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strcpy(addr.sun_path, s->path);
+        unlink(s->path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) return -1;
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(fd, 8) == -1) {
+                int saved = errno;
+                close(fd);
+                errno = saved;
+                return -1;
+        }
+
+        s->listener = fd;
+        s->listen_watch = glirc_watch_fd(G, fd, GLIRC_FD_READ, on_listener, s);
+        return 0;
+}
+
+static void *start(struct glirc *G, const char *path) {
+        struct ring_ext *s = calloc(1, sizeof *s);
+        if (!s) return NULL;
+        s->listener = -1;
+
+        const char *mb = getenv("GLIRC_RING_MB");
+        size_t size = (size_t)(mb ? strtoul(mb, NULL, 10) : RING_MB) << 20;
+
+        s->ring = ring_create(size);
+        if (!s->ring) {
+                print_error(G, "creating ring");
+                free(s);
+                return NULL;
+        }
+
+        if (open_listener(G, s) == -1) print_error(G, "opening socket");
+        return s;
+}
+
+static void stop(struct glirc *G, void *S) {
+        struct ring_ext *s = S;
+        if (!s) return;
+
+        if (s->listener != -1) {
+                glirc_unwatch_fd(G, s->listen_watch);
+                close(s->listener);
+                unlink(s->path);
+        }
+        ring_destroy(s->ring);
+        free(s);
+}
+
+static enum process_result process_message(struct glirc *G, void *S, const struct glirc_message *msg) {
+        struct ring_ext *s = S;
+        if (s) ring_publish(s->ring, now_ns(), msg);
+        return PASS_MESSAGE;
+}
+
+static void process_messages(struct glirc *G, void *S, const struct glirc_message * const *msgs, size_t n, unsigned char *drops) {
+        struct ring_ext *s = S;
+        if (!s) return;
+
+        uint64_t now = now_ns();
+        for (size_t i = 0; i < n; i++) {
+                ring_publish(s->ring, now, msgs[i]);
+        }
+}
+
+/* /extension ring   show the ring's counters */
+static void process_command(struct glirc *G, void *S, const struct glirc_command *cmd) {
+        struct ring_ext *s = S;
+        if (!s) {
+                glirc_print(G, ERROR_MESSAGE, "ring: not running", 17);
+                return;
+        }
+
+        struct ring_stats st;
+        ring_stats(s->ring, &st);
+
+        char msg[512];
+        int len = snprintf(msg, sizeof msg,
+                "ring: %llu published, %llu too large, %llu byte ring, %lu readers connected to %s",
+                (unsigned long long)st.published, (unsigned long long)st.too_large,
+                (unsigned long long)st.capacity, s->readers,
+                s->listener != -1 ? s->path : "no socket");
+        glirc_print(G, NORMAL_MESSAGE, msg, len < (int)sizeof msg ? (size_t)len : sizeof msg - 1);
+}
+
+GLIRC_EXTENSION_API_VERSION;
+
+struct glirc_extension extension = {
+        .name             = "ring",
+        .major_version    = 1,
+        .minor_version    = 0,
+        .start            = start,
+        .stop             = stop,
+        .process_message  = process_message,
+        .process_command  = process_command,
+        .process_messages = process_messages,
+        .observe_only     = 1,
+};
@@ -0,0 +1,283 @@
+/* Reader side of the shared-memory ring, see ring.h. This file only
+ * depends on the C library so that it can be built into programs that
+ * are not extensions. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+struct ring_reader {
+        const struct ring_header *header;
+        const char *data;
+        size_t map_size;
+        uint64_t capacity;
+
+        uint64_t pos;       /* offset of the next record */
+        uint64_t next_seq;  /* sequence number expected next */
+        uint64_t lost;
+
+        const struct ring_record *cur; /* returned by peek */
+        uint32_t cur_size;
+};
+
+/* Nothing read since the reader's position was loaded can be trusted
+ * once the producer has moved tail beyond that position */
+static int still_valid(const struct ring_reader *r) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&r->header->tail, __ATOMIC_RELAXED) <= r->pos;
+}
+
+/* Start at the oldest record. Its sequence number is what the reader
+ * expects next, so messages overwritten before the reader gets to them
+ * are counted as lost. Padding records carry the sequence number of the
+ * message after them for this reason. */
+static void start_at_tail(struct ring_reader *r) {
+        for (;;) {
+                r->pos = __atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE);
+
+                /* tail only equals head when nothing was published yet */
+                if (r->pos == __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE)) {
+                        r->next_seq = 0;
+                        return;
+                }
+
+                struct ring_record rec;
+                memcpy(&rec, r->data + (r->pos & (r->capacity - 1)), sizeof rec);
+                if (still_valid(r)) {
+                        r->next_seq = rec.seq;
+                        return;
+                }
+        }
+}
+
+struct ring_reader *ring_reader_open(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) return NULL;
+
+        size_t size = st.st_size;
+        if (size < sizeof(struct ring_header)) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return NULL;
+
+        const struct ring_header *h = p;
+        uint64_t cap = h->capacity;
+        if (memcmp(h->magic, RING_MAGIC, sizeof h->magic) ||
+            h->version != RING_VERSION ||
+            h->header_size != sizeof(struct ring_header) ||
+            cap == 0 || (cap & (cap - 1)) ||
+            cap > size - sizeof(struct ring_header)) {
+                munmap(p, size);
+                errno = EINVAL;
+                return NULL;
+        }
+
+        struct ring_reader *r = calloc(1, sizeof *r);
+        if (!r) {
+                munmap(p, size);
+                return NULL;
+        }
+
+        r->header = h;
+        r->data = (const char *)p + sizeof(struct ring_header);
+        r->map_size = size;
+        r->capacity = cap;
+        start_at_tail(r);
+        return r;
+}
+
+/* Receive a descriptor sent with SCM_RIGHTS */
+static int recv_fd(int sock) {
+        char byte;
+        struct iovec iov = { &byte, 1 };
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control.buf,
+                .msg_controllen = sizeof control.buf,
+        };
+
+        if (recvmsg(sock, &mh, 0) != 1) return -1;
+
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+                errno = EPROTO;
+                return -1;
+        }
+
+        int fd;
+        memcpy(&fd, CMSG_DATA(cm), sizeof fd);
+        return fd;
+}
+
+struct ring_reader *ring_reader_connect(const char *path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(path) >= sizeof addr.sun_path) {
+                errno = ENAMETOOLONG;
+                return NULL;
+        }
+        strcpy(addr.sun_path, path);
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock == -1) return NULL;
+
+        int fd = -1;
+        if (connect(sock, (struct sockaddr *)&addr, sizeof addr) == 0) {
+                fd = recv_fd(sock);
+        }
+
+        int saved = errno;
+        close(sock);
+        if (fd == -1) {
+                errno = saved;
+                return NULL;
+        }
+
+        struct ring_reader *r = ring_reader_open(fd);
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return r;
+}
+
+const struct ring_record *ring_reader_peek(struct ring_reader *r) {
+        for (;;) {
+                uint64_t head = __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE);
+                if (r->pos == head) return NULL;
+
+                uint64_t tail = __atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE);
+                if (tail > r->pos) r->pos = tail; /* fell behind */
+
+                uint64_t offset = r->pos & (r->capacity - 1);
+                const struct ring_record *rec = (const void *)(r->data + offset);
+                struct ring_record copy;
+                memcpy(&copy, rec, sizeof copy);
+                if (!still_valid(r)) continue;
+
+                if (copy.size < sizeof copy || copy.size % RING_ALIGN ||
+                    copy.size > r->capacity - offset) {
+                        /* can only happen if the ring is not from ring_create */
+                        r->pos = head;
+                        return NULL;
+                }
+
+                if (copy.kind == RING_RECORD_PADDING) {
+                        r->pos += copy.size;
+                        continue;
+                }
+
+                if (copy.seq > r->next_seq) {
+                        r->lost += copy.seq - r->next_seq;
+                }
+                r->next_seq = copy.seq + 1;
+                r->cur = rec;
+                r->cur_size = copy.size;
+                return rec;
+        }
+}
+
+int ring_reader_advance(struct ring_reader *r) {
+        if (!r->cur) return 0;
+
+        int ok = still_valid(r);
+        if (!ok) r->lost++;
+
+        r->pos += r->cur_size;
+        r->cur = NULL;
+        return ok ? 0 : -1;
+}
+
+uint64_t ring_reader_lost(const struct ring_reader *r) {
+        return r->lost;
+}
+
+void ring_reader_close(struct ring_reader *r) {
+        if (!r) return;
+        munmap((void *)r->header, r->map_size);
+        free(r);
+}
+
+/* Decoding only trusts the bounds of the record, as its contents may be
+ * changing underneath */
+
+struct cursor {
+        const char *p, *end;
+        int bad;
+};
+
+static void get_bytes(struct cursor *c, void *x, size_t n) {
+        if ((size_t)(c->end - c->p) < n) {
+                c->bad = 1;
+                memset(x, 0, n);
+                return;
+        }
+        memcpy(x, c->p, n);
+        c->p += n;
+}
+
+static struct glirc_string get_string(struct cursor *c) {
+        struct glirc_string s = { "", 0 };
+        uint32_t len;
+        get_bytes(c, &len, 4);
+        if (c->bad || (size_t)(c->end - c->p) < len) {
+                c->bad = 1;
+                return s;
+        }
+        s.str = c->p;
+        s.len = len;
+        c->p += len;
+        return s;
+}
+
+int ring_decode(const struct ring_reader *r, struct ring_message *msg) {
+        if (!r->cur) return 0;
+
+        /* cur_size was checked against the end of the data area */
+        const char *start = (const char *)r->cur;
+        struct cursor c = { start + sizeof(struct ring_record), start + r->cur_size, 0 };
+
+        msg->seq = r->next_seq - 1;
+        get_bytes(&c, &msg->time, 8);
+        msg->network     = get_string(&c);
+        msg->prefix_nick = get_string(&c);
+        msg->prefix_user = get_string(&c);
+        msg->prefix_host = get_string(&c);
+        msg->command     = get_string(&c);
+
+        uint16_t n;
+        get_bytes(&c, &n, 2);
+        if (n > RING_MAX_PARAMS) return 0;
+        msg->params_n = n;
+        for (size_t i = 0; i < n; i++) msg->params[i] = get_string(&c);
+
+        get_bytes(&c, &n, 2);
+        msg->tags_n = 0;
+        for (size_t i = 0; i < n; i++) {
+                struct glirc_string key = get_string(&c);
+                struct glirc_string val = get_string(&c);
+                if (msg->tags_n < RING_MAX_TAGS) {
+                        msg->tag_keys[msg->tags_n] = key;
+                        msg->tag_vals[msg->tags_n] = val;
+                        msg->tags_n++;
+                }
+        }
+
+        return !c.bad;
+}
@@ -0,0 +1,231 @@
+/* Test of the shared-memory ring: a synthetic producer publishes numbered
+ * messages while two reader processes, which got the ring through the
+ * unix socket like a sidecar would, check every message they read.
+ *
+ * With a ring large enough for all messages the readers must see every
+ * one of them. With a small ring readers may lose messages, but each one
+ * must be either read intact or counted as lost.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+#define READERS  2
+#define MESSAGES 200000
+
+static char socket_path[108];
+
+static struct glirc_string str(const char *s, size_t len) {
+        struct glirc_string g = { s, len };
+        return g;
+}
+
+/* Text of message seq, of varying length so that records wrap around
+ * the ring at different offsets */
+static size_t message_text(uint64_t seq, char *buf, size_t bufsize) {
+        int len = snprintf(buf, bufsize, "message %llu ", (unsigned long long)seq);
+        size_t pad = seq % 97;
+        memset(buf + len, 'x', pad);
+        return len + pad;
+}
+
+static int check_message(const struct ring_message *m) {
+        char text[256];
+        size_t len = message_text(m->seq, text, sizeof text);
+        return m->time == m->seq * 1000
+            && m->network.len == 4 && !memcmp(m->network.str, "test", 4)
+            && m->command.len == 7 && !memcmp(m->command.str, "PRIVMSG", 7)
+            && m->params_n == 2
+            && m->params[1].len == len && !memcmp(m->params[1].str, text, len)
+            && m->tags_n == 1
+            && m->tag_keys[0].len == 5 && !memcmp(m->tag_keys[0].str, "msgid", 5);
+}
+
+static int reader(int lossless, int ready) {
+        alarm(60);
+
+        struct ring_reader *r = ring_reader_connect(socket_path);
+        if (!r) {
+                perror("ring_reader_connect");
+                return 1;
+        }
+
+        /* tell the producer this reader starts at message 0 */
+        close(ready);
+
+        uint64_t received = 0, last = 0;
+        for (;;) {
+                if (!ring_reader_peek(r)) {
+                        sched_yield();
+                        continue;
+                }
+
+                struct ring_message m;
+                int decoded = ring_decode(r, &m);
+                int good = decoded && check_message(&m);
+                if (ring_reader_advance(r) == 0) {
+                        if (!good) {
+                                fprintf(stderr, "reader %d: bad message %llu\n",
+                                        (int)getpid(), (unsigned long long)m.seq);
+                                return 1;
+                        }
+                        if (received && m.seq <= last) {
+                                fprintf(stderr, "reader %d: %llu after %llu\n", (int)getpid(),
+                                        (unsigned long long)m.seq, (unsigned long long)last);
+                                return 1;
+                        }
+                        received++;
+                        last = m.seq;
+                }
+                if (decoded && m.seq == MESSAGES - 1) break;
+        }
+
+        uint64_t lost = ring_reader_lost(r);
+        ring_reader_close(r);
+        printf("  reader %d: %llu read, %llu lost\n", (int)getpid(),
+               (unsigned long long)received, (unsigned long long)lost);
+
+        if (received + lost != MESSAGES) {
+                fprintf(stderr, "reader %d: %llu messages unaccounted for\n", (int)getpid(),
+                        (unsigned long long)(MESSAGES - received - lost));
+                return 1;
+        }
+        if (received == 0 || (lossless && lost)) return 1;
+        return 0;
+}
+
+static void produce(struct ring *r) {
+        char text[256];
+        char id[32];
+        struct glirc_string params[2], keys[1], vals[1];
+        struct glirc_message msg = {
+                .network     = str("test", 4),
+                .prefix_nick = str("producer", 8),
+                .command     = str("PRIVMSG", 7),
+                .params      = params,
+                .params_n    = 2,
+                .tagkeys     = keys,
+                .tagvals     = vals,
+                .tags_n      = 1,
+        };
+        params[0] = str("#ring", 5);
+        keys[0] = str("msgid", 5);
+
+        for (uint64_t seq = 0; seq < MESSAGES; seq++) {
+                params[1] = str(text, message_text(seq, text, sizeof text));
+                vals[0] = str(id, snprintf(id, sizeof id, "%llx", (unsigned long long)seq));
+                if (ring_publish(r, seq * 1000, &msg)) {
+                        fprintf(stderr, "message %llu did not fit\n", (unsigned long long)seq);
+                        exit(1);
+                }
+
+                /* interleave with the readers even on a single core */
+                if (seq % 1024 == 0) sched_yield();
+        }
+}
+
+static int run(size_t capacity, int lossless) {
+        printf("ring of %zu bytes:\n", capacity);
+        fflush(stdout);
+
+        struct ring *r = ring_create(capacity);
+        if (!r) {
+                perror("ring_create");
+                return 1;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strcpy(addr.sun_path, socket_path);
+        unlink(socket_path);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == -1 ||
+            bind(listener, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+            listen(listener, READERS) == -1) {
+                perror("listen");
+                return 1;
+        }
+
+        int ready[2];
+        if (pipe(ready) == -1) {
+                perror("pipe");
+                return 1;
+        }
+
+        pid_t pids[READERS];
+        for (int i = 0; i < READERS; i++) {
+                pids[i] = fork();
+                if (pids[i] == -1) {
+                        perror("fork");
+                        return 1;
+                }
+                if (pids[i] == 0) {
+                        close(listener);
+                        close(ready[0]);
+                        ring_destroy(r);
+                        int status = reader(lossless, ready[1]);
+                        fflush(stdout);
+                        _exit(status);
+                }
+        }
+
+        close(ready[1]);
+
+        for (int i = 0; i < READERS; i++) {
+                int client = accept(listener, NULL, NULL);
+                if (client == -1 || ring_send_fd(r, client) == -1) {
+                        perror("sending ring");
+                        return 1;
+                }
+                close(client);
+        }
+        close(listener);
+        unlink(socket_path);
+
+        /* start once every reader has mapped the ring, so they all begin
+         * at message 0; the pipe reaches end of file when all have closed
+         * their end */
+        char byte;
+        while (read(ready[0], &byte, 1) == -1 && errno == EINTR) {}
+        close(ready[0]);
+
+        produce(r);
+
+        int failed = 0;
+        for (int i = 0; i < READERS; i++) {
+                int status;
+                if (waitpid(pids[i], &status, 0) == -1 ||
+                    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                        failed = 1;
+                }
+        }
+
+        ring_destroy(r);
+        return failed;
+}
+
+int main(void) {
+        char dir[] = "/tmp/ring-test-XXXXXX";
+        if (!mkdtemp(dir)) {
+                perror("mkdtemp");
+                return 1;
+        }
+        snprintf(socket_path, sizeof socket_path, "%s/ring.sock", dir);
+
+        int failed = run(64 << 20, 1) || run(64 << 10, 0);
+
+        rmdir(dir);
+        puts(failed ? "FAIL" : "OK");
+        return failed;
+}
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+/* Messages larger than this fraction of the ring are not published */
+#define MAX_RECORD_FRACTION 4
+
+struct ring {
+        struct ring_header *header;
+        char *data;
+        size_t map_size;
+        uint64_t capacity;
+
+        /* producer's copies of the shared offsets */
+        uint64_t head, tail;
+        uint64_t seq;  /* also read by ring_stats */
+
+        int fd;        /* read-write descriptor */
+        int reader_fd; /* read-only when possible, else fd */
+
+        uint64_t too_large;
+};
+
+static size_t align(size_t n) {
+        return (n + RING_ALIGN - 1) & ~(size_t)(RING_ALIGN - 1);
+}
+
+/* The descriptor is a memfd where available and otherwise a POSIX shared
+ * memory object that is unlinked as soon as it is open */
+static int create_fd(void) {
+#ifdef MFD_CLOEXEC
+        int fd = memfd_create("glirc-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd != -1 || errno != ENOSYS) return fd;
+#endif
+        char name[64];
+        snprintf(name, sizeof name, "/glirc-ring-%ld", (long)getpid());
+        int shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (shm != -1) shm_unlink(name);
+        return shm;
+}
+
+struct ring *ring_create(size_t capacity) {
+        uint64_t cap = 4096;
+        while (cap < capacity) cap <<= 1;
+
+        struct ring *r = calloc(1, sizeof *r);
+        if (!r) return NULL;
+
+        r->capacity = cap;
+        r->map_size = sizeof(struct ring_header) + cap;
+        r->fd = create_fd();
+        r->reader_fd = -1;
+        if (r->fd == -1 || ftruncate(r->fd, r->map_size) == -1) goto fail;
+
+#ifdef F_ADD_SEALS
+        /* readers can rely on the size not changing under their mapping */
+        fcntl(r->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+        void *p = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+        if (p == MAP_FAILED) goto fail;
+
+        r->header = p;
+        r->data = (char *)p + sizeof(struct ring_header);
+        memcpy(r->header->magic, RING_MAGIC, sizeof r->header->magic);
+        r->header->version = RING_VERSION;
+        r->header->header_size = sizeof(struct ring_header);
+        r->header->capacity = cap;
+
+        /* readers get a descriptor they can't map for writing */
+        char path[64];
+        snprintf(path, sizeof path, "/proc/self/fd/%d", r->fd);
+        r->reader_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (r->reader_fd == -1) r->reader_fd = r->fd;
+
+        return r;
+
+fail:
+        {
+                int saved = errno;
+                if (r->fd != -1) close(r->fd);
+                free(r);
+                errno = saved;
+                return NULL;
+        }
+}
+
+/* Move tail past every record that overlaps the space up to end */
+static void make_room(struct ring *r, uint64_t end) {
+        if (end - r->tail <= r->capacity) return;
+
+        while (end - r->tail > r->capacity) {
+                const struct ring_record *rec =
+                        (const void *)(r->data + (r->tail & (r->capacity - 1)));
+                r->tail += rec->size;
+        }
+
+        /* readers must see the new tail before any of the old records
+         * change, see ring_reader_advance */
+        __atomic_store_n(&r->header->tail, r->tail, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static size_t string_size(struct glirc_string s) {
+        return 4 + s.len;
+}
+
+static char *put_bytes(char *p, const void *x, size_t n) {
+        memcpy(p, x, n);
+        return p + n;
+}
+
+static char *put_string(char *p, struct glirc_string s) {
+        uint32_t len = s.len;
+        p = put_bytes(p, &len, 4);
+        return s.len ? put_bytes(p, s.str, s.len) : p;
+}
+
+int ring_publish(struct ring *r, uint64_t time, const struct glirc_message *msg) {
+        size_t size = sizeof(struct ring_record) + 8
+                + string_size(msg->network)
+                + string_size(msg->prefix_nick)
+                + string_size(msg->prefix_user)
+                + string_size(msg->prefix_host)
+                + string_size(msg->command)
+                + 2 + 2;
+        for (size_t i = 0; i < msg->params_n; i++) size += string_size(msg->params[i]);
+        for (size_t i = 0; i < msg->tags_n; i++) {
+                size += string_size(msg->tagkeys[i]) + string_size(msg->tagvals[i]);
+        }
+        size = align(size);
+
+        if (size > r->capacity / MAX_RECORD_FRACTION || msg->params_n > 0xffff || msg->tags_n > 0xffff) {
+                __atomic_add_fetch(&r->too_large, 1, __ATOMIC_RELAXED);
+                return -1;
+        }
+
+        /* pad out the end of the data area when the record doesn't fit */
+        uint64_t room = r->capacity - (r->head & (r->capacity - 1));
+        if (room < size) {
+                make_room(r, r->head + room);
+                struct ring_record pad = { r->seq, room, RING_RECORD_PADDING };
+                memcpy(r->data + (r->head & (r->capacity - 1)), &pad, sizeof pad);
+                r->head += room;
+        }
+
+        make_room(r, r->head + size);
+
+        char *start = r->data + (r->head & (r->capacity - 1));
+        struct ring_record rec = { r->seq, size, RING_RECORD_MESSAGE };
+        char *p = put_bytes(start, &rec, sizeof rec);
+        p = put_bytes(p, &time, 8);
+        p = put_string(p, msg->network);
+        p = put_string(p, msg->prefix_nick);
+        p = put_string(p, msg->prefix_user);
+        p = put_string(p, msg->prefix_host);
+        p = put_string(p, msg->command);
+
+        uint16_t n = msg->params_n;
+        p = put_bytes(p, &n, 2);
+        for (size_t i = 0; i < msg->params_n; i++) p = put_string(p, msg->params[i]);
+
+        n = msg->tags_n;
+        p = put_bytes(p, &n, 2);
+        for (size_t i = 0; i < msg->tags_n; i++) {
+                p = put_string(p, msg->tagkeys[i]);
+                p = put_string(p, msg->tagvals[i]);
+        }
+
+        r->head += size;
+        __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->header->head, r->head, __ATOMIC_RELEASE);
+        return 0;
+}
+
+int ring_fd(const struct ring *r) {
+        return r->reader_fd;
+}
+
+int ring_send_fd(const struct ring *r, int sock) {
+        char byte = 0;
+        struct iovec iov = { &byte, 1 };
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        memset(&control, 0, sizeof control);
+
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control.buf,
+                .msg_controllen = sizeof control.buf,
+        };
+
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &r->reader_fd, sizeof(int));
+
+        return sendmsg(sock, &mh, 0) == 1 ? 0 : -1;
+}
+
+void ring_stats(const struct ring *r, struct ring_stats *stats) {
+        stats->published = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+        stats->too_large = __atomic_load_n(&r->too_large, __ATOMIC_RELAXED);
+        stats->capacity = r->capacity;
+}
+
+void ring_destroy(struct ring *r) {
+        if (!r) return;
+        munmap(r->header, r->map_size);
+        if (r->reader_fd != r->fd) close(r->reader_fd);
+        close(r->fd);
+        free(r);
+}
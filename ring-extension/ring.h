@@ -0,0 +1,145 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "glirc-api.h"
+
+/* Shared-memory ring of the messages the client received, written by the
+ * ring extension and read by other processes on the same machine.
+ *
+ * The ring is one file descriptor (a memfd on Linux) holding a header and
+ * a data area of capacity bytes. There is a single producer and any number
+ * of readers. Readers never write to the ring, so they can't slow the
+ * producer down: the producer overwrites the oldest records when it needs
+ * room and a reader that falls behind loses messages, which it detects
+ * from the gaps in the sequence numbers.
+ *
+ * head and tail are byte offsets that only grow; a record at offset o is
+ * stored at o % capacity. Records never wrap around the end of the data
+ * area, the producer fills the space there with a padding record instead.
+ *
+ *   record  = struct ring_record payload pad-to-16
+ *   payload = u64:time string:network string:nick string:user string:host
+ *             string:command u16:params_n string{params_n}
+ *             u16:tags_n (string:key string:value){tags_n}
+ *   string  = u32:len byte{len}
+ *
+ * All integers are in the byte order of the machine and time is in
+ * nanoseconds since the epoch.
+ *
+ * Before overwriting a record the producer moves tail past it, so a reader
+ * that finds tail still at or before its record after using it knows the
+ * record was intact the whole time. ring_reader_advance does this check.
+ */
+
+#define RING_MAGIC   "GLIRCRNG"
+#define RING_VERSION 1
+#define RING_ALIGN   16
+
+struct ring_header {
+        char magic[8];        /* RING_MAGIC */
+        uint32_t version;     /* RING_VERSION */
+        uint32_t header_size; /* offset of the data area */
+        uint64_t capacity;    /* bytes in the data area, a power of two */
+        char pad0[40];
+
+        /* each on its own cache line as they are written by the producer
+         * and polled by every reader */
+        uint64_t head;        /* offset after the newest record */
+        char pad1[56];
+        uint64_t tail;        /* offset of the oldest record */
+        char pad2[56];
+};
+
+#define RING_RECORD_MESSAGE 0
+#define RING_RECORD_PADDING 1
+
+struct ring_record {
+        uint64_t seq;         /* sequence number, counting from 0 */
+        uint32_t size;        /* of the record including this header */
+        uint32_t kind;        /* RING_RECORD_MESSAGE or RING_RECORD_PADDING */
+};
+
+/* Producer */
+
+struct ring;
+
+/* Create a ring with a data area of at least capacity bytes. Returns NULL
+ * and sets errno on failure. */
+struct ring *ring_create(size_t capacity);
+
+/* Add a message received at time. Returns 0, or -1 when the message is
+ * too large for the ring. */
+int ring_publish(struct ring *r, uint64_t time, const struct glirc_message *msg);
+
+/* Descriptor to give to readers. It is read-only where the system allows
+ * the ring to be reopened that way. */
+int ring_fd(const struct ring *r);
+
+/* Pass the ring's descriptor over a connected unix socket */
+int ring_send_fd(const struct ring *r, int sock);
+
+struct ring_stats {
+        uint64_t published;   /* messages added */
+        uint64_t too_large;   /* messages that did not fit */
+        uint64_t capacity;
+};
+
+void ring_stats(const struct ring *r, struct ring_stats *stats);
+
+void ring_destroy(struct ring *r);
+
+/* Reader, see ring-reader.c */
+
+struct ring_reader;
+
+/* Map a ring from its descriptor. The descriptor can be closed afterward.
+ * Reading starts at the oldest record in the ring. Returns NULL and sets
+ * errno on failure. */
+struct ring_reader *ring_reader_open(int fd);
+
+/* Connect to the unix socket of the ring extension and map the ring it
+ * sends. */
+struct ring_reader *ring_reader_connect(const char *path);
+
+/* Next record, or NULL when the reader has caught up. The record points
+ * into the shared mapping and must not be used after ring_reader_advance. */
+const struct ring_record *ring_reader_peek(struct ring_reader *r);
+
+/* Move past the record returned by ring_reader_peek. Returns 0 when the
+ * record was intact while it was used, and -1 when the producer overwrote
+ * it meanwhile, in which case anything read from it must be discarded. */
+int ring_reader_advance(struct ring_reader *r);
+
+/* Number of messages overwritten before this reader got to them, or while
+ * it was reading them */
+uint64_t ring_reader_lost(const struct ring_reader *r);
+
+void ring_reader_close(struct ring_reader *r);
+
+/* Decoded view of a record. The strings point into the shared mapping. */
+
+#define RING_MAX_PARAMS 15
+#define RING_MAX_TAGS   32
+
+struct ring_message {
+        uint64_t seq;
+        uint64_t time;
+        struct glirc_string network;
+        struct glirc_string prefix_nick, prefix_user, prefix_host;
+        struct glirc_string command;
+        struct glirc_string params[RING_MAX_PARAMS];
+        size_t params_n;
+        struct glirc_string tag_keys[RING_MAX_TAGS]; /* tags past RING_MAX_TAGS are skipped */
+        struct glirc_string tag_vals[RING_MAX_TAGS];
+        size_t tags_n;
+};
+
+/* Decode the record returned by the last ring_reader_peek. Returns 0 when
+ * the record is malformed, which happens when it is overwritten while
+ * decoding. Check ring_reader_advance before trusting the result. */
+int ring_decode(const struct ring_reader *r, struct ring_message *msg);
+
+#endif
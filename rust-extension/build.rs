@@ -18,6 +18,7 @@ fn main() {
         .generate_comments(true)
         .whitelisted_function("glirc_.*")
         .whitelisted_type("glirc_.*")
+        .whitelisted_var("GLIRC_.*")
         .derive_default(true)
         // Finish the builder and generate the bindings.
         .generate()
@@ -8,6 +8,7 @@ use std::collections::HashMap;
 use std::ffi::CStr;
 use std::mem;
 use std::os::raw::c_char;
+use std::os::raw::c_int;
 use std::os::raw::c_void;
 use std::panic;
 use std::ptr;
@@ -240,6 +241,9 @@ fn handle_panics<F: FnOnce() -> R + panic::UnwindSafe, R>(G: &glirc, f: F, def:
  * Extension metadata
  */
 
+#[no_mangle]
+pub static glirc_extension_api_version: c_int = GLIRC_API_VERSION as c_int;
+
 #[no_mangle]
 pub static mut extension: glirc_extension = glirc_extension {
     name: "rust\0" as *const str as *const c_char,
@@ -250,4 +254,8 @@ pub static mut extension: glirc_extension = glirc_extension {
     process_message: None,
     process_chat: None,
     process_command: Some(process_command_entry),
+    message_commands: ptr::null(),
+    process_messages: None,
+    observe_only: 0,
+    process_member_changes: None,
 };
@@ -0,0 +1,299 @@
+/* Print the messages in capture files written by the sample extension.
+ *
+ * usage: capture-read [-n NETWORK] [-c] FILE...
+ *
+ * Each record is printed as a timestamp, the network, and the message as
+ * an IRC line. -n only prints messages from one network and -c only
+ * counts them. Files are mapped into memory and, when they have an
+ * index, filtered by network without decoding the skipped records.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+struct cursor {
+        const unsigned char *p, *end;
+        int bad;
+};
+
+static uint16_t get_u16(struct cursor *c) {
+        uint16_t x = 0;
+        if (c->end - c->p < 2) { c->bad = 1; return 0; }
+        memcpy(&x, c->p, 2);
+        c->p += 2;
+        return x;
+}
+
+static uint32_t get_u32(struct cursor *c) {
+        uint32_t x = 0;
+        if (c->end - c->p < 4) { c->bad = 1; return 0; }
+        memcpy(&x, c->p, 4);
+        c->p += 4;
+        return x;
+}
+
+static uint64_t get_u64(struct cursor *c) {
+        uint64_t x = 0;
+        if (c->end - c->p < 8) { c->bad = 1; return 0; }
+        memcpy(&x, c->p, 8);
+        c->p += 8;
+        return x;
+}
+
+static struct glirc_string get_string(struct cursor *c) {
+        struct glirc_string s = { "", 0 };
+        size_t len = get_u16(c);
+        if ((size_t)(c->end - c->p) < len) { c->bad = 1; return s; }
+        s.str = (const char *)c->p;
+        s.len = len;
+        c->p += len;
+        return s;
+}
+
+static void put(struct glirc_string s) {
+        fwrite(s.str, 1, s.len, stdout);
+}
+
+/* Tag values are escaped as in IRCv3 message tags */
+static void put_tag_value(struct glirc_string s) {
+        for (size_t i = 0; i < s.len; i++) {
+                switch (s.str[i]) {
+                        case ';':  fputs("\\:", stdout); break;
+                        case ' ':  fputs("\\s", stdout); break;
+                        case '\\': fputs("\\\\", stdout); break;
+                        case '\r': fputs("\\r", stdout); break;
+                        case '\n': fputs("\\n", stdout); break;
+                        default:   putchar(s.str[i]); break;
+                }
+        }
+}
+
+static void put_time(uint64_t ns) {
+        static time_t cached_sec = -1;
+        static char cached[32];
+
+        time_t sec = (time_t)(ns / 1000000000);
+        if (sec != cached_sec) {
+                struct tm tm;
+                gmtime_r(&sec, &tm);
+                strftime(cached, sizeof cached, "%Y-%m-%dT%H:%M:%S", &tm);
+                cached_sec = sec;
+        }
+        printf("%s.%03uZ", cached, (unsigned)(ns / 1000000 % 1000));
+}
+
+/* Decode and print one record. Returns 0 when it is malformed. */
+static int print_record(const unsigned char *p, size_t size) {
+        struct cursor c = { p + 4, p + size, 0 };
+        uint64_t time = get_u64(&c);
+        struct glirc_string network = get_string(&c);
+        struct glirc_string nick    = get_string(&c);
+        struct glirc_string user    = get_string(&c);
+        struct glirc_string host    = get_string(&c);
+        struct glirc_string command = get_string(&c);
+        if (c.bad) return 0;
+
+        put_time(time);
+        putchar(' ');
+        put(network);
+        putchar(' ');
+
+        /* the parameters and tags are printed as they are decoded, so
+         * skip over them once to validate the record first */
+        struct cursor params = c;
+        uint16_t params_n = get_u16(&c);
+        for (uint16_t i = 0; i < params_n; i++) get_string(&c);
+        uint16_t tags_n = get_u16(&c);
+        if (c.bad) return 0;
+
+        for (uint16_t i = 0; i < tags_n; i++) {
+                struct glirc_string key = get_string(&c);
+                struct glirc_string val = get_string(&c);
+                if (c.bad) return 0;
+                putchar(i == 0 ? '@' : ';');
+                put(key);
+                if (val.len) {
+                        putchar('=');
+                        put_tag_value(val);
+                }
+        }
+        if (tags_n) putchar(' ');
+
+        if (nick.len) {
+                putchar(':');
+                put(nick);
+                if (user.len) { putchar('!'); put(user); }
+                if (host.len) { putchar('@'); put(host); }
+                putchar(' ');
+        }
+        put(command);
+
+        get_u16(&params);
+        for (uint16_t i = 0; i < params_n; i++) {
+                struct glirc_string param = get_string(&params);
+                int last = i + 1 == params_n &&
+                           (param.len == 0 || param.str[0] == ':' || memchr(param.str, ' ', param.len));
+                fputs(last ? " :" : " ", stdout);
+                put(param);
+        }
+        putchar('\n');
+        return 1;
+}
+
+/* Network of a record, used to filter files without an index */
+static struct glirc_string record_network(const unsigned char *p, size_t size) {
+        struct cursor c = { p + 12, p + size, 0 };
+        return get_string(&c);
+}
+
+static int network_is(struct glirc_string s, const char *network) {
+        return s.len == strlen(network) && !memcmp(s.str, network, s.len);
+}
+
+/* Find the trailer written when the file was finished */
+static const struct capture_footer *find_footer(const unsigned char *base, size_t size) {
+        static struct capture_footer footer;
+        if (size < sizeof(struct capture_header) + sizeof footer) return NULL;
+        memcpy(&footer, base + size - sizeof footer, sizeof footer);
+        if (memcmp(footer.magic, CAPTURE_INDEX_MAGIC, sizeof footer.magic)) return NULL;
+        if (footer.entries_offset > size - sizeof footer ||
+            footer.entries_n > (size - sizeof footer - footer.entries_offset) / sizeof(struct capture_index_entry) ||
+            footer.networks_offset > footer.entries_offset) {
+                return NULL;
+        }
+        return &footer;
+}
+
+/* Look up the filter's position in the network table, -1 if absent */
+static long network_id(const unsigned char *base, const struct capture_footer *footer, const char *network) {
+        struct cursor c = { base + footer->networks_offset, base + footer->entries_offset, 0 };
+        uint32_t n = get_u32(&c);
+        for (uint32_t i = 0; i < n && !c.bad; i++) {
+                if (network_is(get_string(&c), network)) return (long)i;
+        }
+        return -1;
+}
+
+static int read_file(const char *path, const char *network, int count_only, unsigned long long *count) {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                return 0;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                close(fd);
+                return 0;
+        }
+
+        size_t size = (size_t)st.st_size;
+        if (size < sizeof(struct capture_header)) {
+                fprintf(stderr, "%s: not a capture file\n", path);
+                close(fd);
+                return 0;
+        }
+
+        const unsigned char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                return 0;
+        }
+        posix_madvise((void *)base, size, POSIX_MADV_SEQUENTIAL);
+
+        struct capture_header header;
+        memcpy(&header, base, sizeof header);
+        if (memcmp(header.magic, CAPTURE_MAGIC, sizeof header.magic) || header.version != CAPTURE_VERSION) {
+                fprintf(stderr, "%s: not a capture file of this version and byte order\n", path);
+                munmap((void *)base, size);
+                return 0;
+        }
+
+        int ok = 1;
+        const struct capture_footer *footer = find_footer(base, size);
+
+        if (footer) {
+                long id = network ? network_id(base, footer, network) : -1;
+                const unsigned char *entries = base + footer->entries_offset;
+
+                for (uint64_t i = 0; i < footer->entries_n; i++) {
+                        struct capture_index_entry e;
+                        memcpy(&e, entries + i * sizeof e, sizeof e);
+                        if (network && e.network != (uint64_t)id) continue;
+                        if (e.offset > footer->networks_offset || e.size > footer->networks_offset - e.offset) {
+                                ok = 0;
+                                break;
+                        }
+                        ++*count;
+                        if (!count_only && !print_record(base + e.offset, e.size)) {
+                                ok = 0;
+                                break;
+                        }
+                }
+        } else {
+                /* unfinished file: read records until one is cut off */
+                struct cursor c = { base + sizeof header, base + size, 0 };
+                while (c.p < c.end) {
+                        const unsigned char *p = c.p;
+                        uint32_t len = get_u32(&c);
+                        if (c.bad || len < 12 || len > (size_t)(c.end - p)) break;
+                        c.p = p + len;
+
+                        if (network && !network_is(record_network(p, len), network)) continue;
+                        ++*count;
+                        if (!count_only && !print_record(p, len)) {
+                                ok = 0;
+                                break;
+                        }
+                }
+        }
+
+        if (!ok) fprintf(stderr, "%s: malformed record\n", path);
+        munmap((void *)base, size);
+        return ok;
+}
+
+int main(int argc, char **argv) {
+        const char *network = NULL;
+        int count_only = 0;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "n:c")) != -1) {
+                switch (opt) {
+                        case 'n': network = optarg; break;
+                        case 'c': count_only = 1; break;
+                        default:
+                                fprintf(stderr, "usage: %s [-n NETWORK] [-c] FILE...\n", argv[0]);
+                                return EXIT_FAILURE;
+                }
+        }
+        if (optind == argc) {
+                fprintf(stderr, "usage: %s [-n NETWORK] [-c] FILE...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        static char buf[1 << 16];
+        setvbuf(stdout, buf, _IOFBF, sizeof buf);
+
+        int ok = 1;
+        unsigned long long count = 0;
+        for (int i = optind; i < argc; i++) {
+                ok &= read_file(argv[i], network, count_only, &count);
+        }
+
+        if (count_only) printf("%llu\n", count);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,464 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+/* Records are gathered in a buffer of this size before they are written */
+#define BUFFER_SIZE (1 << 20)
+
+/* A partly filled buffer is written after this many seconds */
+#define FLUSH_SECONDS 1
+
+#define MAX_STRING 0xffff
+
+struct network {
+        char *name;
+        size_t len;
+};
+
+/* Index of the records in one file */
+struct index {
+        struct capture_index_entry *entries;
+        size_t entries_n, entries_cap;
+        struct network *networks;
+        size_t networks_n, networks_cap;
+};
+
+struct buffer {
+        char *data;
+        size_t len;
+        struct index *close; /* finish the file with this index after data */
+        int last;            /* stop the writer after this buffer */
+};
+
+/* The message callbacks fill cur. Full buffers are handed to the writer
+ * thread as pending and come back as spare, so exactly one of pending and
+ * spare is set at any time. */
+struct capture {
+        pthread_mutex_t lock;
+        pthread_cond_t ready;   /* pending was set */
+        pthread_cond_t drained; /* pending was cleared */
+        pthread_t writer;
+
+        struct buffer *cur, *pending, *spare;
+        struct buffer buffers[2];
+
+        /* current file, as seen by the callbacks */
+        struct index *index;
+        uint64_t file_bytes;
+        uint64_t file_start;
+
+        uint64_t max_bytes;
+        uint64_t max_ns;
+
+        struct capture_status status;
+
+        /* only used by the writer thread after capture_open */
+        int fd;
+        uint64_t offset;
+        unsigned long seq;
+        char *dir;
+};
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t string_size(struct glirc_string s) {
+        return 2 + (s.len < MAX_STRING ? s.len : MAX_STRING);
+}
+
+static size_t record_size(const struct glirc_message *msg) {
+        size_t size = 4 + 8
+                    + string_size(msg->network)
+                    + string_size(msg->prefix_nick)
+                    + string_size(msg->prefix_user)
+                    + string_size(msg->prefix_host)
+                    + string_size(msg->command)
+                    + 2 + 2;
+        for (size_t i = 0; i < msg->params_n; i++) {
+                size += string_size(msg->params[i]);
+        }
+        for (size_t i = 0; i < msg->tags_n; i++) {
+                size += string_size(msg->tagkeys[i]) + string_size(msg->tagvals[i]);
+        }
+        return size;
+}
+
+static char *put_u16(char *p, uint16_t x) { memcpy(p, &x, sizeof x); return p + sizeof x; }
+static char *put_u32(char *p, uint32_t x) { memcpy(p, &x, sizeof x); return p + sizeof x; }
+static char *put_u64(char *p, uint64_t x) { memcpy(p, &x, sizeof x); return p + sizeof x; }
+
+static char *put_string(char *p, struct glirc_string s) {
+        size_t len = s.len < MAX_STRING ? s.len : MAX_STRING;
+        p = put_u16(p, (uint16_t)len);
+        if (len) memcpy(p, s.str, len);
+        return p + len;
+}
+
+static void encode_record(char *p, size_t size, uint64_t time, const struct glirc_message *msg) {
+        p = put_u32(p, (uint32_t)size);
+        p = put_u64(p, time);
+        p = put_string(p, msg->network);
+        p = put_string(p, msg->prefix_nick);
+        p = put_string(p, msg->prefix_user);
+        p = put_string(p, msg->prefix_host);
+        p = put_string(p, msg->command);
+        p = put_u16(p, (uint16_t)msg->params_n);
+        for (size_t i = 0; i < msg->params_n; i++) {
+                p = put_string(p, msg->params[i]);
+        }
+        p = put_u16(p, (uint16_t)msg->tags_n);
+        for (size_t i = 0; i < msg->tags_n; i++) {
+                p = put_string(p, msg->tagkeys[i]);
+                p = put_string(p, msg->tagvals[i]);
+        }
+}
+
+static void index_free(struct index *ix) {
+        if (!ix) return;
+        for (size_t i = 0; i < ix->networks_n; i++) free(ix->networks[i].name);
+        free(ix->networks);
+        free(ix->entries);
+        free(ix);
+}
+
+/* Position of the network in the index's table, added when missing */
+static long index_network(struct index *ix, struct glirc_string net) {
+        for (size_t i = 0; i < ix->networks_n; i++) {
+                if (ix->networks[i].len == net.len && !memcmp(ix->networks[i].name, net.str, net.len)) {
+                        return (long)i;
+                }
+        }
+
+        if (ix->networks_n == ix->networks_cap) {
+                size_t cap = ix->networks_cap ? 2 * ix->networks_cap : 4;
+                struct network *n = realloc(ix->networks, cap * sizeof *n);
+                if (!n) return -1;
+                ix->networks = n;
+                ix->networks_cap = cap;
+        }
+
+        char *name = malloc(net.len ? net.len : 1);
+        if (!name) return -1;
+        memcpy(name, net.str, net.len);
+        ix->networks[ix->networks_n].name = name;
+        ix->networks[ix->networks_n].len = net.len;
+        return (long)ix->networks_n++;
+}
+
+static int index_add(struct index *ix, uint64_t time, uint64_t offset, uint32_t size, struct glirc_string net) {
+        long network = index_network(ix, net);
+        if (network < 0) return -1;
+
+        if (ix->entries_n == ix->entries_cap) {
+                size_t cap = ix->entries_cap ? 2 * ix->entries_cap : 1024;
+                struct capture_index_entry *e = realloc(ix->entries, cap * sizeof *e);
+                if (!e) return -1;
+                ix->entries = e;
+                ix->entries_cap = cap;
+        }
+
+        ix->entries[ix->entries_n++] = (struct capture_index_entry) {
+                .time = time, .offset = offset, .network = (uint32_t)network, .size = size
+        };
+        return 0;
+}
+
+/*
+ * Writer thread
+ */
+
+static int write_all(int fd, const void *buf, size_t len) {
+        const char *p = buf;
+        while (len > 0) {
+                ssize_t n = write(fd, p, len);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return errno;
+                }
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Open the next capture file and write its header */
+static int open_file(struct capture *c) {
+        char name[64];
+        time_t t = time(NULL);
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        size_t n = strftime(name, sizeof name, "capture-%Y%m%d-%H%M%S", &tm);
+
+        size_t pathlen = strlen(c->dir) + 1 + sizeof name;
+        char *path = malloc(pathlen);
+        if (!path) return ENOMEM;
+
+        /* the sequence number only restarts when the extension does */
+        do {
+                snprintf(name + n, sizeof name - n, "-%lu.glcap", c->seq++);
+                snprintf(path, pathlen, "%s/%s", c->dir, name);
+                c->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        } while (c->fd == -1 && errno == EEXIST);
+
+        int err = errno;
+        free(path);
+        if (c->fd == -1) return err;
+
+        struct capture_header header = { .version = CAPTURE_VERSION };
+        memcpy(header.magic, CAPTURE_MAGIC, sizeof header.magic);
+        c->offset = sizeof header;
+        return write_all(c->fd, &header, sizeof header);
+}
+
+/* Write the index of the finished file after its records */
+static int write_trailer(struct capture *c, const struct index *ix) {
+        size_t size = 4;
+        for (size_t i = 0; i < ix->networks_n; i++) size += 2 + ix->networks[i].len;
+        size_t pad = (8 - (c->offset + size) % 8) % 8;
+
+        char *table = calloc(1, size + pad);
+        if (!table) return ENOMEM;
+        char *p = put_u32(table, (uint32_t)ix->networks_n);
+        for (size_t i = 0; i < ix->networks_n; i++) {
+                struct glirc_string s = { ix->networks[i].name, ix->networks[i].len };
+                p = put_string(p, s);
+        }
+
+        struct capture_footer footer = {
+                .networks_offset = c->offset,
+                .entries_offset  = c->offset + size + pad,
+                .entries_n       = ix->entries_n,
+        };
+        memcpy(footer.magic, CAPTURE_INDEX_MAGIC, sizeof footer.magic);
+
+        int err = write_all(c->fd, table, size + pad);
+        free(table);
+        if (!err) err = write_all(c->fd, ix->entries, ix->entries_n * sizeof *ix->entries);
+        if (!err) err = write_all(c->fd, &footer, sizeof footer);
+        return err;
+}
+
+/* Write a buffer, returning 0 or an errno value. After a failed write the
+ * offsets in the index no longer match the file, so it gets no trailer
+ * and is read record by record instead. */
+static int write_buffer(struct capture *c, struct buffer *b, int *broken, uint64_t *written) {
+        int err = 0;
+
+        if (c->fd != -1 && b->len > 0 && !*broken) {
+                err = write_all(c->fd, b->data, b->len);
+                if (err) {
+                        *broken = 1;
+                } else {
+                        *written += b->len;
+                }
+                c->offset += b->len;
+        }
+
+        if (b->close) {
+                if (c->fd != -1) {
+                        if (!*broken) {
+                                int e = write_trailer(c, b->close);
+                                if (e) err = e;
+                        }
+                        close(c->fd);
+                        c->fd = -1;
+                }
+                *broken = 0;
+                if (!b->last) {
+                        int e = open_file(c);
+                        if (e) {
+                                err = e;
+                                *broken = 1;
+                        }
+                }
+        }
+        return err;
+}
+
+static void *writer_main(void *arg) {
+        struct capture *c = arg;
+        int broken = 0;
+
+        pthread_mutex_lock(&c->lock);
+        for (;;) {
+                while (!c->pending) {
+                        struct timespec deadline;
+                        clock_gettime(CLOCK_REALTIME, &deadline);
+                        deadline.tv_sec += FLUSH_SECONDS;
+                        int r = pthread_cond_timedwait(&c->ready, &c->lock, &deadline);
+                        if (r == ETIMEDOUT && !c->pending && c->cur->len > 0) {
+                                c->pending = c->cur;
+                                c->cur = c->spare;
+                                c->spare = NULL;
+                        }
+                }
+
+                struct buffer *b = c->pending;
+                pthread_mutex_unlock(&c->lock);
+
+                uint64_t written = 0;
+                int err = write_buffer(c, b, &broken, &written);
+                int last = b->last;
+                int opened = b->close && !last && c->fd != -1;
+                index_free(b->close);
+
+                pthread_mutex_lock(&c->lock);
+                c->status.bytes += written;
+                if (opened) c->status.files++;
+                if (err) c->status.error = err;
+                b->len = 0;
+                b->close = NULL;
+                b->last = 0;
+                c->spare = b;
+                c->pending = NULL;
+                pthread_cond_broadcast(&c->drained);
+                if (last) break;
+        }
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+}
+
+/*
+ * Callback side
+ */
+
+/* Give cur to the writer, waiting for it to finish the previous buffer */
+static void hand_off(struct capture *c) {
+        while (c->pending) pthread_cond_wait(&c->drained, &c->lock);
+        c->pending = c->cur;
+        c->cur = c->spare;
+        c->spare = NULL;
+        pthread_cond_signal(&c->ready);
+}
+
+/* Finish the current file after the records queued so far */
+static int finish_file(struct capture *c, int last) {
+        struct index *next = NULL;
+        if (!last) {
+                next = calloc(1, sizeof *next);
+                if (!next) return -1;
+        }
+
+        c->cur->close = c->index;
+        c->cur->last = last;
+        c->index = next;
+        c->file_bytes = sizeof(struct capture_header);
+        c->file_start = now_ns();
+        hand_off(c);
+        return 0;
+}
+
+struct capture *capture_open(const char *dir, uint64_t max_bytes, unsigned long max_seconds) {
+        struct capture *c = calloc(1, sizeof *c);
+        if (!c) return NULL;
+
+        c->fd = -1;
+        c->max_bytes = max_bytes;
+        c->max_ns = (uint64_t)max_seconds * 1000000000;
+        c->dir = strdup(dir);
+        c->index = calloc(1, sizeof *c->index);
+        c->buffers[0].data = malloc(BUFFER_SIZE);
+        c->buffers[1].data = malloc(BUFFER_SIZE);
+        if (!c->dir || !c->index || !c->buffers[0].data || !c->buffers[1].data) {
+                errno = ENOMEM;
+                goto error;
+        }
+        c->cur = &c->buffers[0];
+        c->spare = &c->buffers[1];
+
+        int err = open_file(c);
+        if (err) {
+                errno = err;
+                goto error;
+        }
+        c->file_bytes = c->offset;
+        c->file_start = now_ns();
+        c->status.files = 1;
+
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->ready, NULL);
+        pthread_cond_init(&c->drained, NULL);
+        err = pthread_create(&c->writer, NULL, writer_main, c);
+        if (err) {
+                pthread_mutex_destroy(&c->lock);
+                pthread_cond_destroy(&c->ready);
+                pthread_cond_destroy(&c->drained);
+                errno = err;
+                goto error;
+        }
+        return c;
+
+error:
+        if (c->fd != -1) close(c->fd);
+        index_free(c->index);
+        free(c->buffers[0].data);
+        free(c->buffers[1].data);
+        free(c->dir);
+        free(c);
+        return NULL;
+}
+
+void capture_message(struct capture *c, const struct glirc_message *msg) {
+        size_t size = record_size(msg);
+        uint64_t time = now_ns();
+
+        pthread_mutex_lock(&c->lock);
+
+        if (c->index->entries_n > 0 &&
+            ((c->max_bytes && c->file_bytes + size > c->max_bytes) ||
+             (c->max_ns && time - c->file_start >= c->max_ns))) {
+                finish_file(c, 0);
+        }
+
+        if (c->cur->len + size > BUFFER_SIZE) hand_off(c);
+
+        if (size > BUFFER_SIZE || index_add(c->index, time, c->file_bytes, (uint32_t)size, msg->network)) {
+                c->status.dropped++;
+        } else {
+                encode_record(c->cur->data + c->cur->len, size, time, msg);
+                c->cur->len += size;
+                c->file_bytes += size;
+                c->status.records++;
+        }
+
+        pthread_mutex_unlock(&c->lock);
+}
+
+void capture_rotate(struct capture *c) {
+        pthread_mutex_lock(&c->lock);
+        finish_file(c, 0);
+        pthread_mutex_unlock(&c->lock);
+}
+
+void capture_close(struct capture *c) {
+        if (!c) return;
+
+        pthread_mutex_lock(&c->lock);
+        finish_file(c, 1);
+        pthread_mutex_unlock(&c->lock);
+        pthread_join(c->writer, NULL);
+
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->ready);
+        pthread_cond_destroy(&c->drained);
+        free(c->buffers[0].data);
+        free(c->buffers[1].data);
+        free(c->dir);
+        free(c);
+}
+
+void capture_status(struct capture *c, struct capture_status *status) {
+        pthread_mutex_lock(&c->lock);
+        *status = c->status;
+        pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,82 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "glirc-api.h"
+
+/* Capture files written by the sample extension and read by capture-read.
+ * All integers are in the byte order of the machine that wrote the file.
+ *
+ *   file    = header record* trailer?
+ *   header  = struct capture_header
+ *   record  = u32:size u64:time string:network string:nick string:user
+ *             string:host string:command u16:params_n string{params_n}
+ *             u16:tags_n (string:key string:value){tags_n}
+ *   string  = u16:len byte{len}
+ *
+ * size counts every byte of the record including itself and time is in
+ * nanoseconds since the epoch. Strings longer than 65535 bytes are cut.
+ *
+ * The trailer is added when the file is rotated or closed. A file without
+ * one, e.g. after a crash, can still be read record by record.
+ *
+ *   trailer  = u32:networks_n string{networks_n} pad-to-8
+ *              struct capture_index_entry{entries_n}
+ *              struct capture_footer
+ */
+
+#define CAPTURE_MAGIC       "GLIRCCAP"
+#define CAPTURE_INDEX_MAGIC "GLIRCIDX"
+#define CAPTURE_VERSION     1
+
+struct capture_header {
+        char magic[8];    /* CAPTURE_MAGIC */
+        uint32_t version; /* CAPTURE_VERSION, also detects byte order */
+        uint32_t reserved;
+};
+
+/* One entry for each record in the file, in file order */
+struct capture_index_entry {
+        uint64_t time;    /* nanoseconds since the epoch */
+        uint64_t offset;  /* of the record from the start of the file */
+        uint32_t network; /* position in the trailer's network table */
+        uint32_t size;    /* of the record */
+};
+
+/* Last bytes of a file with a trailer */
+struct capture_footer {
+        uint64_t networks_offset;
+        uint64_t entries_offset;
+        uint64_t entries_n;
+        char magic[8];    /* CAPTURE_INDEX_MAGIC */
+};
+
+struct capture;
+
+/* Start a new capture file in dir. A new file is started when the
+ * current one reaches max_bytes or is max_seconds old, 0 for no limit.
+ * Records are written by a background thread. Returns NULL and sets
+ * errno on failure. */
+struct capture *capture_open(const char *dir, uint64_t max_bytes, unsigned long max_seconds);
+
+/* Queue a message to be written to the capture */
+void capture_message(struct capture *c, const struct glirc_message *msg);
+
+/* Finish the current file and start a new one */
+void capture_rotate(struct capture *c);
+
+/* Write everything queued, finish the current file, and free c */
+void capture_close(struct capture *c);
+
+struct capture_status {
+        uint64_t records;   /* queued since capture_open */
+        uint64_t bytes;     /* written to disk since capture_open */
+        uint64_t dropped;   /* records that did not fit in a buffer */
+        unsigned long files;
+        int error;          /* errno of the last failed write, or 0 */
+};
+
+void capture_status(struct capture *c, struct capture_status *status);
+
+#endif
@@ -1,31 +1,202 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "glirc-api.h"
+#include "capture.h"
 
-static void *start(void *glirc, const char *path ) {
-        FILE *file = fopen("sample-output.txt", "w");
-        return file;
+/* Lines written to this socket are shown in the client window, e.g.
+ *   echo hello | nc -U sample.sock
+ */
+#define SOCKET_PATH "sample.sock"
+
+/* Every message is recorded to capture files, see capture.h. The files
+ * are written to $GLIRC_CAPTURE_DIR (default: current directory) and a
+ * new one is started after $GLIRC_CAPTURE_MAX_MB megabytes (default 64)
+ * or $GLIRC_CAPTURE_MAX_SECONDS seconds (default 3600). Use capture-read
+ * to print them. */
+#define CAPTURE_DIR         "."
+#define CAPTURE_MAX_MB      64
+#define CAPTURE_MAX_SECONDS 3600
+
+struct sample {
+        struct capture *capture;
+
+        int listener;          /* listening socket or -1 */
+        watch_id listen_watch;
+
+        int client;            /* connected socket or -1 */
+        watch_id client_watch;
+
+        char buf[512];         /* partial line read from client */
+        size_t buflen;
+};
+
+static void close_client(struct glirc *G, struct sample *s) {
+        if (s->client != -1) {
+                if (s->buflen > 0) {
+                        glirc_print(G, NORMAL_MESSAGE, s->buf, s->buflen);
+                }
+                glirc_unwatch_fd(G, s->client_watch);
+                close(s->client);
+                s->client = -1;
+                s->buflen = 0;
+        }
+}
+
+/* Print each complete line in the buffer to the client window */
+static void flush_lines(struct glirc *G, struct sample *s) {
+        char *start = s->buf;
+        char *nl;
+        while ((nl = memchr(start, '\n', s->buflen - (start - s->buf)))) {
+                glirc_print(G, NORMAL_MESSAGE, start, nl - start);
+                start = nl + 1;
+        }
+        s->buflen -= start - s->buf;
+        memmove(s->buf, start, s->buflen);
+
+        /* print overlong lines in pieces */
+        if (s->buflen == sizeof s->buf) {
+                glirc_print(G, NORMAL_MESSAGE, s->buf, s->buflen);
+                s->buflen = 0;
+        }
+}
+
+static void on_client(struct glirc *G, void *dat, int fd, int events) {
+        struct sample *s = dat;
+        ssize_t n = read(fd, s->buf + s->buflen, sizeof s->buf - s->buflen);
+
+        if (n > 0) {
+                s->buflen += n;
+                flush_lines(G, s);
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR) || (events & GLIRC_FD_ERROR)) {
+                close_client(G, s);
+        }
+}
+
+static void on_listener(struct glirc *G, void *dat, int fd, int events) {
+        struct sample *s = dat;
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) return;
+
+        /* one client at a time, newest wins */
+        close_client(G, s);
+        s->client = client;
+        s->client_watch = glirc_watch_fd(G, client, GLIRC_FD_READ, on_client, s);
+}
+
+static void open_listener(struct glirc *G, struct sample *s) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, SOCKET_PATH, sizeof addr.sun_path - 1);
+        unlink(SOCKET_PATH);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) return;
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(fd, 1) == -1) {
+                close(fd);
+                return;
+        }
+
+        s->listener = fd;
+        s->listen_watch = glirc_watch_fd(G, fd, GLIRC_FD_READ, on_listener, s);
+}
+
+static unsigned long env_number(const char *name, unsigned long def) {
+        const char *str = getenv(name);
+        return str ? strtoul(str, NULL, 10) : def;
+}
+
+static void print_error(struct glirc *G, const char *what) {
+        char msg[256];
+        int len = snprintf(msg, sizeof msg, "sample: %s: %s", what, strerror(errno));
+        glirc_print(G, ERROR_MESSAGE, msg, len < (int)sizeof msg ? (size_t)len : sizeof msg - 1);
 }
 
-static void stop(void *glirc, void * S) {
-        FILE *file = S;
-        fclose(file);
+static void *start(struct glirc *G, const char *path ) {
+        struct sample *s = calloc(1, sizeof *s);
+        if (!s) return NULL;
+
+        const char *dir = getenv("GLIRC_CAPTURE_DIR");
+        s->capture = capture_open(dir ? dir : CAPTURE_DIR,
+                        (uint64_t)env_number("GLIRC_CAPTURE_MAX_MB", CAPTURE_MAX_MB) << 20,
+                        env_number("GLIRC_CAPTURE_MAX_SECONDS", CAPTURE_MAX_SECONDS));
+        if (!s->capture) print_error(G, "capture");
+
+        s->listener = -1;
+        s->client = -1;
+        open_listener(G, s);
+        return s;
 }
 
-static enum process_result process_message(void *glirc, void *S, const struct glirc_message *msg) {
-        FILE *file = S;
-        fwrite(msg->command.str, 1, msg->command.len, file);
-        fputs("\n",file);
-        fflush(file);
+static void stop(struct glirc *G, void * S) {
+        struct sample *s = S;
+        if (!s) return;
+
+        close_client(G, s);
+        if (s->listener != -1) {
+                glirc_unwatch_fd(G, s->listen_watch);
+                close(s->listener);
+                unlink(SOCKET_PATH);
+        }
+        capture_close(s->capture);
+        free(s);
+}
+
+static enum process_result process_message(struct glirc *G, void *S, const struct glirc_message *msg) {
+        struct sample *s = S;
+        if (s && s->capture) capture_message(s->capture, msg);
         return PASS_MESSAGE;
 }
 
+static void process_messages(struct glirc *G, void *S, const struct glirc_message * const *msgs, size_t n, unsigned char *drops) {
+        struct sample *s = S;
+        if (!s || !s->capture) return;
+
+        for (size_t i = 0; i < n; i++) {
+                capture_message(s->capture, msgs[i]);
+        }
+}
+
+/* /extension sample rotate   start a new capture file
+ * /extension sample status   show capture counters */
+static void process_command(struct glirc *G, void *S, const struct glirc_command *cmd) {
+        struct sample *s = S;
+        if (!s || !s->capture) {
+                glirc_print(G, ERROR_MESSAGE, "sample: not capturing", 21);
+                return;
+        }
+
+        if (cmd->command.len == 6 && !memcmp(cmd->command.str, "rotate", 6)) {
+                capture_rotate(s->capture);
+        } else {
+                struct capture_status st;
+                capture_status(s->capture, &st);
+
+                char msg[256];
+                int len = snprintf(msg, sizeof msg,
+                        "sample: %llu records, %llu bytes written, %llu dropped, %lu files%s%s",
+                        (unsigned long long)st.records, (unsigned long long)st.bytes,
+                        (unsigned long long)st.dropped, st.files,
+                        st.error ? ", last error: " : "", st.error ? strerror(st.error) : "");
+                glirc_print(G, NORMAL_MESSAGE, msg, len < (int)sizeof msg ? (size_t)len : sizeof msg - 1);
+        }
+}
+
+GLIRC_EXTENSION_API_VERSION;
+
 struct glirc_extension extension = {
-        .name            = "sample",
-        .major_version   = 1,
-        .minor_version   = 0,
-        .start           = start,
-        .stop            = stop,
-        .process_message = process_message,
-        .process_command = NULL
+        .name             = "sample",
+        .major_version    = 1,
+        .minor_version    = 0,
+        .start            = start,
+        .stop             = stop,
+        .process_message  = process_message,
+        .process_command  = process_command,
+        .process_messages = process_messages,
+        .observe_only     = 1,
 };
@@ -1,4 +1,4 @@
-{-# Language GeneralizedNewtypeDeriving, RankNTypes, RecordWildCards #-}
+{-# Language GeneralizedNewtypeDeriving, OverloadedStrings, RankNTypes, RecordWildCards #-}
 {-|
 Module      : Client.CApi
 Description : Dynamically loaded extension API
@@ -15,29 +15,73 @@ module Client.CApi
   ( -- * Extension type
     ActiveExtension(..)
 
+  -- * Message dispatch
+  , MessageDispatch
+  , buildMessageDispatch
+  , dispatchMessage
+  , hasMessageListeners
+  , memberListeners
+  , wantsCommand
+
   -- * Extension callbacks
   , extensionSymbol
   , activateExtension
   , deactivateExtension
   , notifyExtensions
+  , observeExtension
   , commandExtension
   , chatExtension
+  , notifyMemberChanges
+
+  -- * File descriptor watches
+  , FdWatch(..)
+  , prepareFdWatch
+  , runFdWatch
+
+  -- * Message marshaling
+  , withRawIrcMsgs
+  , withRawIrcMsg
+  , burstBatchTypes
+  , serverTimeNanos
   ) where
 
+import           Client.CApi.Arena
+import           Client.CApi.Stats
 import           Client.CApi.Types
+import           Client.State.Network (MemberChange(..))
+import           Control.Concurrent.STM
+import           Control.Exception
 import           Control.Monad
 import           Control.Monad.IO.Class
 import           Control.Monad.Codensity
+import           Data.Bits
+import           Data.ByteString (ByteString)
+import qualified Data.ByteString as B
+import qualified Data.ByteString.Unsafe as B
+import           Data.Char (isDigit)
+import           Data.Foldable (foldl', for_, traverse_)
+import           Data.HashMap.Strict (HashMap)
+import qualified Data.HashMap.Strict as HashMap
+import           Data.Int
+import           Data.IORef
+import qualified Data.IntSet as IntSet
+import           Data.List (find, nub)
+import           Data.Maybe (fromMaybe, isNothing, listToMaybe, mapMaybe)
 import           Data.Text (Text)
 import qualified Data.Text as Text
+import           Data.Time (fromGregorianValid, toModifiedJulianDay)
+import           Data.Traversable (for)
+import           Data.Word
 import           Foreign.C
 import           Foreign.Marshal
 import           Foreign.Ptr
 import           Foreign.Storable
+import           GHC.Conc (threadWaitReadSTM, threadWaitWriteSTM)
 import           Irc.Identifier
 import           Irc.RawIrcMsg
 import           Irc.UserInfo
 import           System.Posix.DynamicLinker
+import           System.Posix.Types (Fd(..))
 
 ------------------------------------------------------------------------
 
@@ -60,6 +104,9 @@ data ActiveExtension = ActiveExtension
   , aeSession :: !(Ptr ())       -- ^ State value generated by start callback
   , aeName    :: !Text
   , aeMajorVersion, aeMinorVersion :: !Int
+  , aeCommands :: !(Maybe [Text]) -- ^ Commands delivered to process_message, 'Nothing' for all
+  , aeObserveOnly :: !Bool        -- ^ Messages are delivered asynchronously and can't be dropped
+  , aeStats       :: !ExtensionStats -- ^ Callback latency and throughput counters
   }
 
 -- | Load the extension from the given path and call the start
@@ -67,17 +114,22 @@ data ActiveExtension = ActiveExtension
 -- passed to any subsequent calls into the extension.
 activateExtension ::
   Ptr () ->
+  Int      {- ^ slow callback threshold in milliseconds -} ->
   FilePath {- ^ path to extension -} ->
   IO ActiveExtension
-activateExtension stab path =
+activateExtension stab slow path =
   do dl   <- dlopen path [RTLD_NOW, RTLD_LOCAL]
      p    <- dlsym dl extensionSymbol
-     fgn  <- peek (castFunPtrToPtr p)
+     api  <- peekApiVersion dl
+     fgn  <- peekFgnExtension api (castFunPtrToPtr p)
      name <- peekCString (fgnName fgn)
+     cmds <- peekMessageCommands (fgnMessageCommands fgn)
+     stats <- newExtensionStats slow
      let f = fgnStart fgn
      s  <- if nullFunPtr == f
              then return nullPtr
-             else withCString path (runStartExtension f stab)
+             else timeCallback stats CallbackStart 0 (const 0)
+                    (withCString path (runStartExtension f stab))
      return $! ActiveExtension
        { aeFgn     = fgn
        , aeDL      = dl
@@ -85,8 +137,32 @@ activateExtension stab path =
        , aeName    = Text.pack name
        , aeMajorVersion = fromIntegral (fgnMajorVersion fgn)
        , aeMinorVersion = fromIntegral (fgnMinorVersion fgn)
+       , aeCommands     = cmds
+       , aeObserveOnly  = fgnObserveOnly fgn /= 0
+                       && (fgnMessage  fgn /= nullFunPtr || fgnMessages fgn /= nullFunPtr)
+       , aeStats        = stats
        }
 
+-- | Layout version an extension was built with, read from
+-- 'apiVersionSymbol'. Extensions that don't export it are version 0.
+-- 'dlsym' throws for missing symbols, so the lookup calls @dlsym@
+-- directly.
+peekApiVersion :: DL -> IO CInt
+peekApiVersion dl =
+  do p <- withCString apiVersionSymbol (c_dlsym (packDL dl))
+     if p == nullFunPtr
+       then return 0
+       else peek (castFunPtrToPtr p)
+
+-- | Import the optional null-terminated list of commands an extension
+-- subscribed to. Commands are normalized to upper-case.
+peekMessageCommands :: Ptr CString -> IO (Maybe [Text])
+peekMessageCommands p
+  | nullPtr == p = return Nothing
+  | otherwise    =
+      do strs <- traverse peekCString =<< peekArray0 nullPtr p
+         return $! Just $! map (Text.toUpper . Text.pack) strs
+
 -- | Call the stop callback of the extension if it is defined
 -- and unload the shared object.
 deactivateExtension :: Ptr () -> ActiveExtension -> IO ()
@@ -96,39 +172,134 @@ deactivateExtension stab ae =
        runStopExtension f stab (aeSession ae)
      dlclose (aeDL ae)
 
+------------------------------------------------------------------------
+
+-- | Index from IRC command to the extensions with a process message
+-- callback that want to see that command. Extensions without a
+-- subscription list receive every message. Observe-only extensions
+-- are not included as they are delivered messages asynchronously.
+-- The index also tracks the extensions with a membership callback.
+data MessageDispatch = MessageDispatch
+  { mdListeners :: [ActiveExtension]                 -- ^ extensions with a message callback
+  , mdAny       :: [ActiveExtension]                 -- ^ extensions receiving all commands
+  , mdCommands  :: !(HashMap Text [ActiveExtension]) -- ^ receivers of subscribed commands
+  , mdMembers   :: [ActiveExtension]                 -- ^ extensions with a membership callback
+  }
 
--- | Call all of the process message callbacks in the list of extensions.
--- This operation marshals the IRC message once and shares that across
--- all of the callbacks.
+-- | Build the dispatch index for a list of active extensions. Each list
+-- in the index preserves the order of the original extension list.
+buildMessageDispatch :: [ActiveExtension] -> MessageDispatch
+buildMessageDispatch aes = MessageDispatch
+  { mdListeners = listeners
+  , mdAny       = filter (isNothing . aeCommands) listeners
+  , mdCommands  = HashMap.fromList
+                    [ (cmd, filter (wantsCommand cmd) listeners)
+                      | cmd <- nub (concat (mapMaybe aeCommands listeners)) ]
+  , mdMembers   = filter (\ae -> fgnMemberChanges (aeFgn ae) /= nullFunPtr) aes
+  }
+  where
+    listeners = filter (\ae -> hasCallback ae && not (aeObserveOnly ae)) aes
+    hasCallback ae = fgnMessage  (aeFgn ae) /= nullFunPtr
+                  || fgnMessages (aeFgn ae) /= nullFunPtr
+
+-- | Returns 'True' when the extension subscribed to the given command.
+wantsCommand :: Text {- ^ command -} -> ActiveExtension -> Bool
+wantsCommand cmd ae = maybe True (elem cmd) (aeCommands ae)
+
+-- | Find the extensions that should be notified of a message with the
+-- given command.
+dispatchMessage :: MessageDispatch -> Text {- ^ command -} -> [ActiveExtension]
+dispatchMessage md cmd = HashMap.lookupDefault (mdAny md) cmd (mdCommands md)
+
+-- | Returns 'True' when any extension has a process message callback.
+hasMessageListeners :: MessageDispatch -> Bool
+hasMessageListeners md = not (null (mdAny md) && HashMap.null (mdCommands md))
+
+-- | Extensions with a membership change callback.
+memberListeners :: MessageDispatch -> [ActiveExtension]
+memberListeners = mdMembers
+
+
+-- | Call all of the process message callbacks in the list of extensions
+-- for a burst of messages received together. Each message is marshaled
+-- once into the arena and shared across all of the callbacks. Extensions
+-- with a batched callback are called once with all of the messages they
+-- subscribed to that have not already been dropped.
 --
 -- Returns 'True' to pass message to client.  Returns 'False to drop message.
 notifyExtensions ::
   Ptr ()            {- ^ clientstate stable pointer -} ->
+  Arena             {- ^ marshaling buffer          -} ->
   Text              {- ^ network                    -} ->
-  RawIrcMsg         {- ^ current message            -} ->
-  [ActiveExtension] {- ^ all active extensions      -} ->
-  IO Bool           {- ^ should pass message        -}
-notifyExtensions stab network msg aes
-  | null aes' = return True
+  MessageDispatch   {- ^ active extensions          -} ->
+  [(ByteString, RawIrcMsg, Text)] {- ^ received lines, messages, and batch types -} ->
+  IO [Bool]         {- ^ should pass each message   -}
+notifyExtensions stab arena network md msgs
+  | null (mdListeners md) = return (map (const True) msgs)
   | otherwise = doNotifications
   where
-    -- only the extensions that have a incoming message callback
-    aes' = [ (f,s) | ae <- aes
-                  , let f = fgnMessage (aeFgn ae)
-                        s = aeSession ae
-                  , f /= nullFunPtr ]
+    -- only marshal messages that at least one extension subscribed to
+    wanted = [ (i, entry) | (i, entry@(_, msg, _)) <- zip [0..] msgs
+                          , not (null (dispatchMessage md (_msgCommand msg))) ]
 
-    doNotifications = evalNestedIO $
-      do raw <- withRawIrcMsg network msg
-         liftIO (go aes' raw)
+    doNotifications =
+      withRawIrcMsgs arena network (map snd wanted) $ \ptrs ->
+        do let entries = [ (i, _msgCommand msg, p)
+                           | ((i, (_, msg, _)), p) <- zip wanted ptrs ]
+           dropped <- foldM (notify entries) IntSet.empty (mdListeners md)
+           return [ not (IntSet.member i dropped) | i <- [0 .. length msgs - 1] ]
 
-    -- run handlers until one of them drops the message
-    go [] _ = return True
-    go ((f,s):rest) msgPtr =
-       do res <- runProcessMessage f stab s msgPtr
-          if res == passMessage
-            then go rest msgPtr
-            else return False
+    -- run one extension on its messages that haven't been dropped yet
+    notify entries dropped ae =
+      do let todo = [ (i,p) | (i,cmd,p) <- entries
+                            , not (IntSet.member i dropped)
+                            , wantsCommand cmd ae ]
+             s    = aeSession ae
+             fs   = fgnMessages (aeFgn ae)
+             f    = fgnMessage  (aeFgn ae)
+         drops <- if fs /= nullFunPtr
+                    then runBatch ae fs s (map snd todo)
+                    else for todo $ \(_,p) ->
+                           timeCallback (aeStats ae) CallbackMessage 1 fromEnum
+                             ((dropMessage ==) <$> runProcessMessage f stab s p)
+         return $! foldl' (flip IntSet.insert) dropped
+                   [ i | ((i,_),True) <- zip todo drops ]
+
+    runBatch _ _ _ [] = return []
+    runBatch ae fs s ptrs =
+      timeCallback (aeStats ae) CallbackMessage (length ptrs) (length . filter id) $
+      withArrayLen ptrs $ \n arr ->
+      allocaBytes (bitmapBytes n) $ \bits ->
+        do fillBytes bits 0 (bitmapBytes n)
+           runProcessMessages fs stab s arr (fromIntegral n) bits
+           for [0 .. n-1] $ \j ->
+             do b <- peekByteOff bits (j `div` 8)
+                return (testBit (b :: Word8) (j `mod` 8))
+
+-- | Deliver messages to the process message callbacks of an
+-- observe-only extension. The results of the callbacks are ignored.
+observeExtension ::
+  Ptr ()          {- ^ clientstate stable pointer -} ->
+  ActiveExtension {- ^ observing extension        -} ->
+  [Ptr FgnMsg]    {- ^ marshaled messages         -} ->
+  IO ()
+observeExtension _ _ [] = return ()
+observeExtension stab ae ptrs
+  | fs /= nullFunPtr =
+      timed (length ptrs) $
+      withArrayLen ptrs $ \n arr ->
+      allocaBytes (bitmapBytes n) $ \bits ->
+        runProcessMessages fs stab s arr (fromIntegral n) bits
+  | otherwise = traverse_ (timed 1 . void . runProcessMessage f stab s) ptrs
+  where
+    s  = aeSession ae
+    fs = fgnMessages (aeFgn ae)
+    f  = fgnMessage  (aeFgn ae)
+    timed n = timeCallback (aeStats ae) CallbackMessage n (const 0)
+
+-- | Number of bytes in a drop bitmap for a burst of messages.
+bitmapBytes :: Int -> Int
+bitmapBytes n = (n + 7) `div` 8
 
 -- | Call all of the process chat callbacks in the list of extensions.
 -- This operation marshals the IRC message once and shares that across
@@ -147,7 +318,7 @@ chatExtension stab net tgt msg aes
   | otherwise = doNotifications
   where
     -- only the extensions that have a chat callback
-    aes' = [ (f, aeSession ae)
+    aes' = [ (f, ae)
              | ae <- aes
              , let f = fgnChat (aeFgn ae)
              , f /= nullFunPtr ]
@@ -158,12 +329,34 @@ chatExtension stab net tgt msg aes
 
     -- run handlers until one of them drops the message
     go [] _ = return True
-    go ((f,s):rest) ptr =
-       do res <- runProcessChat f stab s ptr
+    go ((f,ae):rest) ptr =
+       do res <- timeCallback (aeStats ae) CallbackChat 1 (fromEnum . (passMessage /=))
+                   (runProcessChat f stab (aeSession ae) ptr)
           if res == passMessage
             then go rest ptr
             else return False
 
+-- | Call the membership change callbacks of the extensions with the
+-- changes on one network. The changes are marshaled once into the arena
+-- and shared across all of the callbacks.
+notifyMemberChanges ::
+  Ptr ()            {- ^ clientstate stable pointer -} ->
+  Arena             {- ^ marshaling buffer          -} ->
+  Text              {- ^ network                    -} ->
+  [ActiveExtension] {- ^ membership listeners       -} ->
+  [MemberChange]    {- ^ changes in order           -} ->
+  IO ()
+notifyMemberChanges stab arena network aes changes
+  | null aes' || null changes = return ()
+  | otherwise =
+      withMemberChanges arena network changes $ \n arr ->
+        for_ aes' $ \(f, s) -> runProcessMemberChanges f stab s arr (fromIntegral n)
+  where
+    aes' = [ (f, aeSession ae)
+             | ae <- aes
+             , let f = fgnMemberChanges (aeFgn ae)
+             , f /= nullFunPtr ]
+
 -- | Notify an extension of a client command with the given parameters.
 commandExtension ::
   Ptr ()          {- ^ client state stableptr -} ->
@@ -174,15 +367,349 @@ commandExtension stab command ae = evalNestedIO $
   do cmd <- withCommand command
      let f = fgnCommand (aeFgn ae)
      liftIO $ unless (f == nullFunPtr)
+            $ timeCallback (aeStats ae) CallbackCommand 0 (const 0)
             $ runProcessCommand f stab (aeSession ae) cmd
 
+-- | File descriptor watched on behalf of an extension with
+-- @glirc_watch_fd@.
+data FdWatch = FdWatch
+  { fwFd       :: !Fd                  -- ^ watched file descriptor
+  , fwEvents   :: !FdEvents            -- ^ conditions of interest
+  , fwCallback :: !(FunPtr FdCallback) -- ^ readiness callback
+  , fwData     :: !(Ptr ())            -- ^ callback data
+  }
+
+-- | Register a watch with the GHC IO manager. Returns a transaction that
+-- completes with a condition that holds and an action that releases the
+-- registration. A descriptor that can't be registered is reported
+-- immediately with 'glircFdError'.
+prepareFdWatch :: FdWatch -> IO (STM FdEvents, IO ())
+prepareFdWatch fw =
+  do (rd, releaseRd) <- register glircFdRead threadWaitReadSTM
+     (wr, releaseWr) <- register glircFdWrite threadWaitWriteSTM
+                          `onException` releaseRd
+     return (rd `orElse` wr, releaseRd >> releaseWr)
+  `catch` \SomeException{} -> return (return glircFdError, return ())
+  where
+    FdEvents wanted = fwEvents fw
+
+    register ev@(FdEvents bit) wait
+      | wanted .&. bit /= 0 = do (ready, release) <- wait (fwFd fw)
+                                 return (ev <$ ready, release)
+      | otherwise           = return (retry, return ())
+
+-- | Notify an extension that a watched file descriptor is ready.
+runFdWatch ::
+  Ptr ()   {- ^ clientstate stable pointer -} ->
+  FdWatch  {- ^ ready watch                -} ->
+  FdEvents {- ^ conditions that hold       -} ->
+  IO ()
+runFdWatch stab fw events =
+  runFdCallback (fwCallback fw) stab (fwData fw) fd events
+  where
+    Fd fd = fwFd fw
+
+-- | Marshal a burst of messages received on one network into a single
+-- region of the arena. The network name is written once and shared by
+-- all of the messages. Each message is laid out as its 'FgnMsg' followed
+-- by its parameter, tag, and span arrays and then the string data they
+-- point to, including a copy of the line as received.
+--
+-- The 'FgnMsg' pointers are only valid for the duration of the
+-- continuation.
+withRawIrcMsgs ::
+  Arena                     {- ^ marshaling buffer       -} ->
+  Text                      {- ^ network                 -} ->
+  [(ByteString, RawIrcMsg, Text)] {- ^ lines, their parses, and batch types -} ->
+  ([Ptr FgnMsg] -> IO a) {- ^ continuation      -} ->
+  IO a
+withRawIrcMsgs arena network msgs k =
+  withArena arena size $ \base ->
+    do (net, start) <- pokeString base network
+       k =<< pokeAll net (alignPtr start arenaAlignment) msgs
+  where
+    size = alignUp arenaAlignment (utf8Length network + 1)
+         + sum (map rawIrcMsgBytes msgs)
+
+    pokeAll _   _ [] = return []
+    pokeAll net p ((line,m,ty):ms) =
+      do (ptr, p') <- pokeRawIrcMsg p net line m ty
+         (ptr :) <$> pokeAll net p' ms
+
+-- | Alignment used for each message laid out in an arena.
+arenaAlignment :: Int
+arenaAlignment = maximum [ alignment (undefined :: FgnMsg)
+                         , alignment (undefined :: FgnStringLen)
+                         , alignment (undefined :: FgnSpan) ]
+
+-- | Number of arena bytes needed to marshal a message, excluding the
+-- shared network name.
+rawIrcMsgBytes :: (ByteString, RawIrcMsg, Text) -> Int
+rawIrcMsgBytes (line, RawIrcMsg{..}, batchType) = alignUp arenaAlignment (structs + strings)
+  where
+    structs = sizeOf (undefined :: FgnMsg)
+            + (length _msgParams + 2 * length _msgTags)
+              * sizeOf (undefined :: FgnStringLen)
+            + length _msgParams * sizeOf (undefined :: FgnSpan)
+
+    (nick, user, host) = prefixFields _msgPrefix
+
+    strings = stringBytes nick + stringBytes user + stringBytes host
+            + stringBytes _msgCommand
+            + sum (map stringBytes _msgParams)
+            + sum [ stringBytes key + stringBytes val | TagEntry key val <- _msgTags ]
+            + stringBytes batchType + 1 -- and the empty string for absent tags
+            + B.length line + 1
+
+    stringBytes txt = utf8Length txt + 1
+
+-- | Nick, user, and host fields of an optional message prefix.
+prefixFields :: Maybe UserInfo -> (Text, Text, Text)
+prefixFields pfx =
+  ( maybe Text.empty (idText.userNick) pfx
+  , maybe Text.empty userName pfx
+  , maybe Text.empty userHost pfx )
+
+-- | Write a message at an aligned position in the arena. Returns the
+-- pointer to the message and the next aligned free position.
+pokeRawIrcMsg ::
+  Ptr Word8    {- ^ destination     -} ->
+  FgnStringLen {- ^ network         -} ->
+  ByteString   {- ^ raw line        -} ->
+  RawIrcMsg    {- ^ parsed line     -} ->
+  Text         {- ^ batch type      -} ->
+  IO (Ptr FgnMsg, Ptr Word8)
+pokeRawIrcMsg base net line RawIrcMsg{..} batchType =
+  do cursor <- newIORef (castPtr (spansPtr `advancePtr` nParams))
+     let pokeNext txt =
+           do p <- readIORef cursor
+              (str, p') <- pokeString p txt
+              writeIORef cursor p'
+              return str
+
+     let (nick, user, host) = prefixFields _msgPrefix
+     pfxN <- pokeNext nick
+     pfxU <- pokeNext user
+     pfxH <- pokeNext host
+     cmd <- pokeNext _msgCommand
+     forM_ (zip [0..] _msgParams) $ \(i, prm) ->
+       pokeElemOff prmPtr i =<< pokeNext prm
+     tagVals <- for (zip [0..] _msgTags) $ \(i, TagEntry key val) ->
+       do pokeElemOff keysPtr i =<< pokeNext key
+          val' <- pokeNext val
+          pokeElemOff valsPtr i val'
+          return (key, val')
+     poke msgPtr $ FgnMsg net pfxN pfxU pfxH cmd
+                          prmPtr (fromIntegral nParams)
+                          keysPtr valsPtr (fromIntegral nTags)
+
+     -- decoded tags share the strings written for the tag array
+     absent <- pokeNext Text.empty
+     ty     <- pokeNext batchType
+     let tagStr key = maybe absent snd (find ((key ==) . fst) tagVals)
+         time = fromMaybe 0 (serverTimeNanos =<< lookupTag "time" _msgTags)
+     pokeMsgDecoded msgPtr (commandCode _msgCommand) time (tagStr "msgid") (tagStr "account") (tagStr "batch") ty
+
+     let (pfxSpan, cmdSpan, prmSpans) = lineSpans line
+     pokeArray spansPtr (take nParams (prmSpans ++ repeat (FgnSpan 0 0)))
+     rawPtr <- readIORef cursor
+     B.unsafeUseAsCStringLen line $ \(src, len) ->
+       do copyBytes rawPtr (castPtr src) len
+          pokeByteOff rawPtr len (0 :: Word8)
+     let raw = FgnStringLen (castPtr rawPtr) (fromIntegral (B.length line))
+     pokeMsgRaw msgPtr raw pfxSpan cmdSpan spansPtr
+
+     return (msgPtr, alignPtr (rawPtr `plusPtr` (B.length line + 1)) arenaAlignment)
+  where
+    nParams = length _msgParams
+    nTags   = length _msgTags
+    msgPtr :: Ptr FgnMsg
+    msgPtr  = castPtr base
+
+    prmPtr, keysPtr, valsPtr :: Ptr FgnStringLen
+    prmPtr  = castPtr (base `plusPtr` sizeOf (undefined :: FgnMsg))
+    keysPtr = prmPtr  `advancePtr` nParams
+    valsPtr = keysPtr `advancePtr` nTags
+
+    spansPtr :: Ptr FgnSpan
+    spansPtr = castPtr (valsPtr `advancePtr` nTags)
+
+-- | Value of the first tag with the given key.
+lookupTag :: Text -> [TagEntry] -> Maybe Text
+lookupTag key tags = listToMaybe [ val | TagEntry k val <- tags, k == key ]
+
+-- | Types of the batches enclosing each message of a burst, empty for
+-- messages outside of a batch. A message's @batch@ tag is looked up
+-- among the batches open before the burst and those started by earlier
+-- messages in it.
+burstBatchTypes ::
+  HashMap Text Text {- ^ types of open batches by reference tag -} ->
+  [RawIrcMsg]       {- ^ messages of a burst                    -} ->
+  [Text]
+burstBatchTypes _ [] = []
+burstBatchTypes open (m:ms) = ty : burstBatchTypes open' ms
+  where
+    ty = maybe Text.empty (\ref -> HashMap.lookupDefault Text.empty ref open)
+               (lookupTag "batch" (_msgTags m))
+
+    open' =
+      case (_msgCommand m, _msgParams m) of
+        ("BATCH", ref : t : _) | Just ('+', r) <- Text.uncons ref -> HashMap.insert r t open
+        ("BATCH", [ref])       | Just ('-', r) <- Text.uncons ref -> HashMap.delete r open
+        _                                                      -> open
+
+-- | Nanoseconds since the epoch of an IRCv3 @server-time@ tag value
+-- like @2018-04-30T12:00:00.000Z@. Digits of the fraction past
+-- nanoseconds are ignored.
+serverTimeNanos :: Text -> Maybe Int64
+serverTimeNanos txt =
+  do (y , t1) <- number 4 txt
+     t2       <- expect '-' t1
+     (mo, t3) <- number 2 t2
+     t4       <- expect '-' t3
+     (d , t5) <- number 2 t4
+     t6       <- expect 'T' t5
+     (h , t7) <- number 2 t6
+     t8       <- expect ':' t7
+     (mi, t9) <- number 2 t8
+     t10      <- expect ':' t9
+     (s , t11) <- number 2 t10
+     (ns, t12) <- fraction t11
+     guard (t12 == "Z" && h < 24 && mi < 60 && s < 61)
+     day <- fromGregorianValid (fromIntegral y) mo d
+     let days = fromIntegral (toModifiedJulianDay day) - 40587 -- 1970-01-01
+         secs = ((days * 24 + fromIntegral h) * 60 + fromIntegral mi) * 60 + fromIntegral s
+     return $! secs * 1000000000 + ns
+  where
+    expect c t =
+      case Text.uncons t of
+        Just (c', t') | c == c' -> Just t'
+        _                       -> Nothing
+
+    number :: Int -> Text -> Maybe (Int, Text)
+    number n t
+      | Text.length ds == n, Text.all isDigit ds = Just (digits ds, rest)
+      | otherwise                               = Nothing
+      where
+        (ds, rest) = Text.splitAt n t
+
+    fraction t =
+      case Text.uncons t of
+        Just ('.', t')
+          | not (Text.null ds) ->
+              Just (fromIntegral (digits (Text.take 9 (ds <> "000000000"))), rest)
+          where (ds, rest) = Text.span isDigit t'
+        _ -> Just (0, t)
+
+    digits = Text.foldl' (\acc c -> acc * 10 + fromEnum c - fromEnum '0') 0
+
+-- | Byte ranges of the prefix, command, and parameters of a line. This
+-- follows the same rules as 'parseRawIrcMsg', which only splits on
+-- spaces and colons and so agrees on positions whether the line was
+-- decoded as UTF-8 or CP1252.
+lineSpans :: ByteString -> (FgnSpan, FgnSpan, [FgnSpan])
+lineSpans line = (pfx, span' cmdStart cmdEnd, params maxMiddleParams (spacesEnd cmdEnd))
+  where
+    len            = B.length line
+    byteAt i c     = i < len && B.index line i == c
+    tokenEnd i     = maybe len (i +) (B.elemIndex space (B.drop i line))
+    spacesEnd i    = i + B.length (B.takeWhile (== space) (B.drop i line))
+    span' start end = FgnSpan (fromIntegral start) (fromIntegral (end - start))
+
+    space = 0x20
+    colon = 0x3a
+
+    afterTags
+      | byteAt 0 0x40 = spacesEnd (tokenEnd 0)
+      | otherwise     = 0
+
+    (pfx, cmdStart)
+      | byteAt afterTags colon = let end = tokenEnd (afterTags + 1)
+                                 in (span' (afterTags + 1) end, spacesEnd end)
+      | otherwise              = (FgnSpan 0 0, afterTags)
+
+    cmdEnd = tokenEnd cmdStart
+
+    params :: Int -> Int -> [FgnSpan]
+    params n i
+      | i >= len          = []
+      | byteAt i colon    = [span' (i + 1) len]
+      | n == 0            = [span' i len]
+      | otherwise         = let end = tokenEnd i
+                            in span' i end : params (n - 1) (spacesEnd end)
+
+-- | RFC 2812 allows 14 middle parameters before the final one.
+maxMiddleParams :: Int
+maxMiddleParams = 14
+
+-- | Write a NUL-terminated string into the arena. Returns the string
+-- and the position immediately following its terminator.
+pokeString :: Ptr Word8 -> Text -> IO (FgnStringLen, Ptr Word8)
+pokeString p txt =
+  do n <- pokeUtf8 p txt
+     return (FgnStringLen (castPtr p) (fromIntegral n), p `plusPtr` (n + 1))
+
+-- | Marshal membership changes on one network into the arena as an
+-- array of 'FgnMemberChange' followed by the strings they point to.
+-- The array is only valid for the duration of the continuation.
+withMemberChanges ::
+  Arena                                  {- ^ marshaling buffer -} ->
+  Text                                   {- ^ network           -} ->
+  [MemberChange]                         {- ^ changes           -} ->
+  (Int -> Ptr FgnMemberChange -> IO a)   {- ^ continuation      -} ->
+  IO a
+withMemberChanges arena network changes k =
+  withArena arena size $ \base ->
+    do let arr = castPtr base :: Ptr FgnMemberChange
+       (net, start) <- pokeString (base `plusPtr` arrBytes) network
+       cursor <- newIORef start
+       let pokeNext txt =
+             do p <- readIORef cursor
+                (str, p') <- pokeString p txt
+                writeIORef cursor p'
+                return str
+       forM_ (zip [0..] fields) $ \(i, (kind, chan, nick, new)) ->
+         do chan' <- pokeNext chan
+            nick' <- pokeNext nick
+            new'  <- pokeNext new
+            pokeElemOff arr i (FgnMemberChange kind net chan' nick' new')
+       k n arr
+  where
+    n        = length changes
+    fields   = map memberChangeFields changes
+    arrBytes = n * sizeOf (undefined :: FgnMemberChange)
+    size     = arrBytes + stringBytes network
+             + sum [ stringBytes chan + stringBytes nick + stringBytes new
+                     | (_, chan, nick, new) <- fields ]
+
+    stringBytes txt = utf8Length txt + 1
+
+-- | Kind, channel, nick, and new nick of a membership change.
+memberChangeFields :: MemberChange -> (MemberChangeKind, Text, Text, Text)
+memberChangeFields change =
+  case change of
+    MemberJoin  chan nick     -> (glircMemberJoin , idText chan, idText nick, Text.empty)
+    MemberPart  chan nick     -> (glircMemberPart , idText chan, idText nick, Text.empty)
+    MemberKick  chan nick     -> (glircMemberKick , idText chan, idText nick, Text.empty)
+    MemberQuit  chan nick     -> (glircMemberQuit , idText chan, idText nick, Text.empty)
+    MemberNick  chan old new  -> (glircMemberNick , idText chan, idText old , idText new)
+    MemberReset chan          -> (glircMemberReset, idText chan, Text.empty , Text.empty)
+
 -- | Marshal a 'RawIrcMsg' into a 'FgnMsg' which will be valid for
--- the remainder of the computation.
+-- the remainder of the computation. Each field is allocated separately,
+-- which makes this a useful baseline for 'withRawIrcMsgs'.
 withRawIrcMsg ::
+  Text                  {- ^ network      -} ->
+  RawIrcMsg             {- ^ message      -} ->
+  (Ptr FgnMsg -> IO a)  {- ^ continuation -} ->
+  IO a
+withRawIrcMsg network msg k = evalNestedIO (liftIO . k =<< nestedRawIrcMsg network msg)
+
+nestedRawIrcMsg ::
   Text                 {- ^ network      -} ->
   RawIrcMsg            {- ^ message      -} ->
   NestedIO (Ptr FgnMsg)
-withRawIrcMsg network RawIrcMsg{..} =
+nestedRawIrcMsg network RawIrcMsg{..} =
   do net     <- withText network
      pfxN    <- withText $ maybe Text.empty (idText.userNick) _msgPrefix
      pfxU    <- withText $ maybe Text.empty userName _msgPrefix
@@ -194,8 +721,15 @@ withRawIrcMsg network RawIrcMsg{..} =
      (tagN,keysPtr) <- nest2 $ withArrayLen keys
      valsPtr        <- nest1 $ withArray vals
      (prmN,prmPtr)  <- nest2 $ withArrayLen prms
-     nest1 $ with $ FgnMsg net pfxN pfxU pfxH cmd prmPtr (fromIntegral prmN)
+     msg <- nest1 $ with $ FgnMsg net pfxN pfxU pfxH cmd prmPtr (fromIntegral prmN)
                                        keysPtr valsPtr (fromIntegral tagN)
+     liftIO $ pokeMsgRaw msg (FgnStringLen nullPtr 0) (FgnSpan 0 0) (FgnSpan 0 0) nullPtr
+     absent  <- withText Text.empty
+     let tagStr key = maybe absent snd (find ((key ==) . fst) (zip (map tagKey _msgTags) vals))
+         tagKey (TagEntry key _) = key
+         time = fromMaybe 0 (serverTimeNanos =<< lookupTag "time" _msgTags)
+     liftIO $ pokeMsgDecoded msg (commandCode _msgCommand) time (tagStr "msgid") (tagStr "account") (tagStr "batch") absent
+     return msg
 
 withChat ::
   Text {- ^ network -} ->
@@ -0,0 +1,120 @@
+{-|
+Module      : Client.CApi.Arena
+Description : Reusable marshaling buffer for the C API
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+This module provides a growable buffer that is reused across calls into
+extensions along with helpers for writing UTF-8 encoded strings directly
+into it. Marshaling a message into an arena costs no allocation beyond
+occasionally growing the buffer.
+
+-}
+module Client.CApi.Arena
+  ( -- * Arena
+    Arena
+  , newArena
+  , withArena
+
+  -- * Layout helpers
+  , alignUp
+  , utf8Length
+  , pokeUtf8
+  ) where
+
+import           Data.Bits
+import           Data.Char (ord)
+import           Data.IORef
+import           Data.Text (Text)
+import qualified Data.Text as Text
+import           Data.Text.Unsafe (Iter(..), iter, lengthWord16)
+import           Data.Word
+import           Foreign.ForeignPtr
+import           Foreign.Ptr
+import           Foreign.Storable
+
+-- | Growable buffer reused across marshaling operations. The contents
+-- of the buffer are only valid until the next use of the arena, so an
+-- arena must not be used reentrantly.
+newtype Arena = Arena (IORef (ForeignPtr Word8, Int))
+
+-- | Size of a newly allocated arena in bytes.
+initialArenaSize :: Int
+initialArenaSize = 64 * 1024
+
+-- | Allocate a new, empty arena.
+newArena :: IO Arena
+newArena =
+  do fp <- mallocForeignPtrBytes initialArenaSize
+     Arena <$> newIORef (fp, initialArenaSize)
+
+-- | Run an action with a pointer to at least the requested number
+-- of bytes. The buffer is grown when it is too small and is otherwise
+-- reused without clearing it.
+withArena :: Arena -> Int {- ^ bytes needed -} -> (Ptr a -> IO b) -> IO b
+withArena (Arena ref) n k =
+  do (fp, cap) <- readIORef ref
+     fp' <- if n <= cap then return fp else
+              do let cap' = max n (2 * cap)
+                 new <- mallocForeignPtrBytes cap'
+                 writeIORef ref (new, cap')
+                 return new
+     withForeignPtr fp' (k . castPtr)
+
+-- | Round a size up to a multiple of the given power-of-two alignment.
+alignUp :: Int {- ^ alignment -} -> Int -> Int
+alignUp a n = (n + a - 1) .&. negate a
+
+-- | Number of bytes in the UTF-8 encoding of a 'Text'.
+utf8Length :: Text -> Int
+utf8Length = Text.foldl' (\acc c -> acc + charLength c) 0
+
+-- | Number of bytes in the UTF-8 encoding of a 'Char'.
+charLength :: Char -> Int
+charLength c
+  | o < 0x80    = 1
+  | o < 0x800   = 2
+  | o < 0x10000 = 3
+  | otherwise   = 4
+  where
+    o = ord c
+
+-- | Write the UTF-8 encoding of a 'Text' followed by a NUL terminator.
+-- The destination must have room for @'utf8Length' txt + 1@ bytes.
+--
+-- Returns the length of the encoding not counting the terminator.
+pokeUtf8 :: Ptr Word8 -> Text -> IO Int
+pokeUtf8 dst txt = go 0 0
+  where
+    n = lengthWord16 txt
+
+    go i o
+      | i >= n    = do pokeByteOff dst o (0 :: Word8)
+                       return o
+      | otherwise = do let Iter c d = iter txt i
+                       o' <- pokeChar o (ord c)
+                       go (i + d) o'
+
+    byte :: Int -> Word8
+    byte = fromIntegral
+
+    pokeChar o x
+      | x < 0x80 =
+          do pokeByteOff dst o (byte x)
+             return (o + 1)
+      | x < 0x800 =
+          do pokeByteOff dst  o    (byte (0xc0 .|. shiftR x 6))
+             pokeByteOff dst (o+1) (byte (0x80 .|. x .&. 0x3f))
+             return (o + 2)
+      | x < 0x10000 =
+          do pokeByteOff dst  o    (byte (0xe0 .|. shiftR x 12))
+             pokeByteOff dst (o+1) (byte (0x80 .|. shiftR x 6 .&. 0x3f))
+             pokeByteOff dst (o+2) (byte (0x80 .|. x .&. 0x3f))
+             return (o + 3)
+      | otherwise =
+          do pokeByteOff dst  o    (byte (0xf0 .|. shiftR x 18))
+             pokeByteOff dst (o+1) (byte (0x80 .|. shiftR x 12 .&. 0x3f))
+             pokeByteOff dst (o+2) (byte (0x80 .|. shiftR x 6 .&. 0x3f))
+             pokeByteOff dst (o+3) (byte (0x80 .|. x .&. 0x3f))
+             return (o + 4)
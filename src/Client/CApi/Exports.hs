@@ -14,6 +14,9 @@ module Client.CApi.Exports
    Glirc_send_message
  , glirc_send_message
 
+ , Glirc_send_messages
+ , glirc_send_messages
+
  , Glirc_print
  , glirc_print
 
@@ -29,6 +32,9 @@ module Client.CApi.Exports
  , Glirc_my_nick
  , glirc_my_nick
 
+ , Glirc_my_userinfo
+ , glirc_my_userinfo
+
  , Glirc_identifier_cmp
  , glirc_identifier_cmp
 
@@ -55,8 +61,28 @@ module Client.CApi.Exports
 
  , Glirc_inject_chat
  , glirc_inject_chat
+
+ , Glirc_inject_chats
+ , glirc_inject_chats
+
+ , Glirc_timer_start
+ , glirc_timer_start
+
+ , Glirc_timer_cancel
+ , glirc_timer_cancel
+
+ , Glirc_watch_fd
+ , glirc_watch_fd
+
+ , Glirc_unwatch_fd
+ , glirc_unwatch_fd
+
+ , Glirc_callback_stats
+ , glirc_callback_stats
  ) where
 
+import           Client.CApi (ActiveExtension(..), FdWatch(..))
+import           Client.CApi.Stats
 import           Client.CApi.Types
 import           Client.Message
 import           Client.State
@@ -64,16 +90,22 @@ import           Client.State.Channel
 import           Client.State.Focus
 import           Client.State.Network
 import           Client.State.Window
+import           Client.TimerWheel
 import           Control.Concurrent.MVar
 import           Control.Exception
 import           Control.Lens
 import           Control.Monad (unless)
-import           Data.Foldable (traverse_)
+import           Data.Foldable (find, foldl', traverse_)
+import           Data.Function (on)
 import qualified Data.HashMap.Strict as HashMap
+import qualified Data.IntMap as IntMap
+import           Data.List (groupBy)
+import qualified Data.Map as Map
 import           Data.Text (Text)
 import qualified Data.Text as Text
 import qualified Data.Text.Foreign as Text
 import           Data.Time
+import           Data.Traversable (for)
 import           Foreign.C
 import           Foreign.Marshal
 import           Foreign.Ptr
@@ -83,6 +115,7 @@ import           Irc.Identifier
 import           Irc.RawIrcMsg
 import           Irc.UserInfo
 import           Irc.Message
+import           System.Posix.Types (Fd(..))
 import           LensUtils
 
 ------------------------------------------------------------------------
@@ -147,6 +180,33 @@ glirc_send_message token msgPtr =
 
 ------------------------------------------------------------------------
 
+-- | Send an array of messages. The client state is locked once and the
+-- connection is looked up once for each run of consecutive messages to
+-- the same network. Messages to unknown networks are skipped.
+type Glirc_send_messages =
+  Ptr ()     {- ^ api token             -} ->
+  Ptr FgnMsg {- ^ array of messages     -} ->
+  CSize      {- ^ number of messages    -} ->
+  IO CInt    {- ^ 0 when all were sent  -}
+
+glirc_send_messages :: Glirc_send_messages
+glirc_send_messages token msgsPtr n =
+  do mvar <- derefToken token
+     fgns <- peekArray (fromIntegral n) msgsPtr
+     msgs <- for fgns $ \fgn ->
+               do network <- peekFgnStringLen (fmNetwork fgn)
+                  msg     <- peekFgnMsg fgn
+                  return (network, msg)
+     withMVar mvar $ \st ->
+       do sent <- for (groupBy ((==) `on` fst) msgs) $ \run ->
+                    case preview (clientConnection (fst (head run))) st of
+                      Nothing -> return False
+                      Just cs -> True <$ sendMsgs cs (map snd run)
+          return $! if and sent then 0 else 1
+  `catch` \SomeException{} -> return 1
+
+------------------------------------------------------------------------
+
 -- | Print a message or error to the client window
 type Glirc_print =
   Ptr ()  {- ^ api token         -} ->
@@ -209,6 +269,36 @@ glirc_inject_chat stab netPtr netLen srcPtr srcLen tgtPtr tgtLen msgPtr msgLen =
 
 ------------------------------------------------------------------------
 
+-- | Record an array of chat messages as 'glirc_inject_chat' does,
+-- updating the client state once.
+type Glirc_inject_chats =
+  Ptr ()              {- ^ api token          -} ->
+  Ptr FgnInjectedChat {- ^ array of chats     -} ->
+  CSize               {- ^ number of chats    -} ->
+  IO CInt             {- ^ 0 on success       -}
+
+glirc_inject_chats :: Glirc_inject_chats
+glirc_inject_chats stab chatsPtr n =
+  do mvar  <- derefToken stab
+     fgns  <- peekArray (fromIntegral n) chatsPtr
+     now   <- getZonedTime
+     chats <- for fgns $ \FgnInjectedChat{..} ->
+                do net <- peekFgnStringLen ficNetwork
+                   src <- peekFgnStringLen ficSource
+                   tgt <- mkId <$> peekFgnStringLen ficTarget
+                   txt <- peekFgnStringLen ficMessage
+                   return (net, tgt, ClientMessage
+                     { _msgBody    = IrcBody (Privmsg (parseUserInfo src) tgt txt)
+                     , _msgTime    = now
+                     , _msgNetwork = net
+                     })
+     modifyMVar_ mvar $ \st ->
+       return $! foldl' (\acc (net, tgt, msg) -> recordChannelMessage net tgt msg acc) st chats
+     return 0
+  `catch` \SomeException{} -> return 1
+
+------------------------------------------------------------------------
+
 -- | The resulting strings and array of strings are malloc'd and the
 -- caller must free them. NULL returned on failure.
 type Glirc_list_networks =
@@ -316,6 +406,28 @@ glirc_my_nick stab networkPtr networkLen =
 
 ------------------------------------------------------------------------
 
+-- | Our @nick!user\@host@ as the server shows it to others. The user
+-- and host are only known after joining a channel, until then they
+-- are left out. The resulting string is malloc'd and the caller must
+-- free it. NULL returned on failure.
+type Glirc_my_userinfo =
+  Ptr ()  {- ^ api token           -} ->
+  CString {- ^ network name        -} ->
+  CSize   {- ^ network name length -} ->
+  IO CString
+
+glirc_my_userinfo :: Glirc_my_userinfo
+glirc_my_userinfo stab networkPtr networkLen =
+  do mvar <- derefToken stab
+     st   <- readMVar mvar
+     network <- peekFgnStringLen (FgnStringLen networkPtr networkLen)
+     let mb = preview (clientConnection network . csUserInfo) st
+     case mb of
+       Nothing -> return nullPtr
+       Just me -> newCString (Text.unpack (renderUserInfo me))
+
+------------------------------------------------------------------------
+
 -- | Mark a window as being seen clearing the new message counter.
 -- To clear the client window send an empty network name.
 -- To clear a network window send an empty channel name.
@@ -475,3 +587,121 @@ glirc_is_logged_on stab net netL tgt tgtL =
 
      let online = has (clientConnection network . csUsers . ix (mkId target)) st
      return $! if online then 1 else 0
+
+------------------------------------------------------------------------
+
+-- | Schedule a callback to run once after the given number of
+-- milliseconds. Returns 0 on failure.
+type Glirc_timer_start =
+  Ptr ()               {- ^ api token          -} ->
+  CULong               {- ^ milliseconds       -} ->
+  FunPtr TimerCallback {- ^ callback           -} ->
+  Ptr ()               {- ^ callback data      -} ->
+  IO CLong
+
+glirc_timer_start :: Glirc_timer_start
+glirc_timer_start stab millis f dat =
+  do mvar <- derefToken stab
+     now  <- getCurrentTime
+     modifyMVar mvar $ \st ->
+       do let (TimerId i, st') = clientStartTimer now (fromIntegral millis) f dat st
+          return (st', fromIntegral i)
+  `catch` \SomeException{} -> return 0
+
+------------------------------------------------------------------------
+
+-- | Cancel a timer that has not fired yet. Returns the callback data
+-- of the canceled timer, or NULL when there was no such timer.
+type Glirc_timer_cancel =
+  Ptr () {- ^ api token -} ->
+  CLong  {- ^ timer id  -} ->
+  IO (Ptr ())
+
+glirc_timer_cancel :: Glirc_timer_cancel
+glirc_timer_cancel stab timer =
+  do mvar <- derefToken stab
+     modifyMVar mvar $ \st ->
+       return $! case clientCancelTimer (TimerId (fromIntegral timer)) st of
+                   Nothing        -> (st, nullPtr)
+                   Just (dat,st') -> (st', dat)
+
+------------------------------------------------------------------------
+
+-- | Call a function from the client's event loop whenever a file
+-- descriptor is ready. Returns 0 on failure.
+type Glirc_watch_fd =
+  Ptr ()            {- ^ api token          -} ->
+  CInt              {- ^ file descriptor    -} ->
+  FdEvents          {- ^ conditions to wait -} ->
+  FunPtr FdCallback {- ^ callback           -} ->
+  Ptr ()            {- ^ callback data      -} ->
+  IO CLong
+
+glirc_watch_fd :: Glirc_watch_fd
+glirc_watch_fd stab fd events f dat =
+  do mvar <- derefToken stab
+     modifyMVar mvar $ \st ->
+       do let (i, st') = clientWatchFd (FdWatch (Fd fd) events f dat) st
+          return (st', fromIntegral i)
+  `catch` \SomeException{} -> return 0
+
+------------------------------------------------------------------------
+
+-- | Stop watching a file descriptor. Returns the callback data of the
+-- removed watch, or NULL when there was no such watch.
+type Glirc_unwatch_fd =
+  Ptr () {- ^ api token -} ->
+  CLong  {- ^ watch id  -} ->
+  IO (Ptr ())
+
+glirc_unwatch_fd :: Glirc_unwatch_fd
+glirc_unwatch_fd stab watch =
+  do mvar <- derefToken stab
+     modifyMVar mvar $ \st ->
+       return $! case clientUnwatchFd (fromIntegral watch) st of
+                   Nothing        -> (st, nullPtr)
+                   Just (dat,st') -> (st', dat)
+
+------------------------------------------------------------------------
+
+-- | Copy the counters of one callback of a loaded extension into the
+-- given structure. Returns @0@ on success and @1@ when there is no
+-- extension with the given name.
+type Glirc_callback_stats =
+  Ptr ()                {- ^ api token        -} ->
+  CString               {- ^ extension name   -} ->
+  CSize                 {- ^ extension length -} ->
+  CallbackCode          {- ^ callback         -} ->
+  Ptr FgnCallbackStats  {- ^ output stats     -} ->
+  IO CInt
+
+glirc_callback_stats :: Glirc_callback_stats
+glirc_callback_stats stab extPtr extLen code statsPtr =
+  do mvar <- derefToken stab
+     name <- peekFgnStringLen (FgnStringLen extPtr extLen)
+     withMVar mvar $ \st ->
+       case (find ((name ==) . aeName) (view (clientExtensions . esActive) st),
+             lookup code callbackCodes) of
+         (Just ae, Just cb) ->
+           do m <- readExtensionStats (aeStats ae)
+              poke statsPtr (exportStats (Map.findWithDefault emptyCallbackStats cb m))
+              return 0
+         _ -> return 1
+  `catch` \SomeException{} -> return 1
+  where
+    callbackCodes =
+      [ (glircCallbackStart  , CallbackStart  )
+      , (glircCallbackMessage, CallbackMessage)
+      , (glircCallbackChat   , CallbackChat   )
+      , (glircCallbackCommand, CallbackCommand)
+      ]
+
+    exportStats cs = FgnCallbackStats
+      { fcsCalls     = fromIntegral (cbCalls cs)
+      , fcsMessages  = fromIntegral (cbMessages cs)
+      , fcsDrops     = fromIntegral (cbDrops cs)
+      , fcsTotalNs   = cbTotalNs cs
+      , fcsMaxNs     = cbMaxNs cs
+      , fcsHistogram = [ fromIntegral (IntMap.findWithDefault 0 i (cbHistogram cs))
+                       | i <- [0 .. statsBuckets - 1] ]
+      }
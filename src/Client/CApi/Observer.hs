@@ -0,0 +1,167 @@
+{-|
+Module      : Client.CApi.Observer
+Description : Asynchronous message delivery to observe-only extensions
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+Observe-only extensions can not drop messages, so the client does not
+need to wait for them. Each one is given a bounded queue filled by the
+client and a dedicated thread that drains it, marshals the messages
+into its own arena, and calls the extension.
+
+-}
+module Client.CApi.Observer
+  ( -- * Observers
+    Observer
+  , observerExtension
+  , observerStats
+  , startObserver
+  , stopObserver
+  , offerObserver
+
+  -- * Statistics
+  , ObserverStats(..)
+  ) where
+
+import           Client.CApi
+import           Client.CApi.Arena
+import           Client.Configuration (OverflowPolicy(..))
+import           Control.Concurrent.Async
+import           Control.Concurrent.STM
+import           Control.Monad
+import           Data.ByteString (ByteString)
+import           Data.Foldable (toList, traverse_)
+import           Data.Function (on)
+import           Data.List (groupBy)
+import           Data.Sequence (Seq)
+import qualified Data.Sequence as Seq
+import           Data.Text (Text)
+import           Foreign.Ptr
+import           Irc.RawIrcMsg
+
+-- | Message queued for an observer along with its network.
+data Entry = Entry !Text !ByteString !RawIrcMsg !Text
+
+-- | Queue shared between the client and the observer thread.
+data Ring = Ring
+  { ringItems  :: !(TVar (Seq Entry)) -- ^ queued messages, oldest first
+  , ringClosed :: !(TVar Bool)        -- ^ set when the observer is stopping
+  }
+
+-- | Counters maintained by the client as it queues messages.
+data ObserverStats = ObserverStats
+  { osQueued  :: !Int -- ^ messages added to the queue
+  , osDropped :: !Int -- ^ messages discarded to make room
+  , osBlocked :: !Int -- ^ times the client waited for room
+  , osDepth   :: !Int -- ^ queue length after the latest burst
+  }
+
+-- | An observe-only extension and the thread delivering its messages.
+data Observer = Observer
+  { observerExtension :: !ActiveExtension -- ^ extension being delivered to
+  , observerStats     :: !ObserverStats   -- ^ queueing statistics
+  , obsRing           :: !Ring
+  , obsCapacity       :: !Int
+  , obsPolicy         :: !OverflowPolicy
+  , obsThread         :: !(Async ())
+  }
+
+-- | Start the delivery thread for an observe-only extension.
+startObserver ::
+  Ptr ()          {- ^ clientstate stable pointer -} ->
+  Int             {- ^ queue capacity             -} ->
+  OverflowPolicy  {- ^ full queue behavior        -} ->
+  ActiveExtension {- ^ observing extension        -} ->
+  IO Observer
+startObserver stab cap policy ae =
+  do ring   <- Ring <$> newTVarIO Seq.empty <*> newTVarIO False
+     arena  <- newArena
+     thread <- async (observerLoop stab arena ring ae)
+     return $! Observer
+       { observerExtension = ae
+       , observerStats     = ObserverStats 0 0 0 0
+       , obsRing           = ring
+       , obsCapacity       = max 1 cap
+       , obsPolicy         = policy
+       , obsThread         = thread
+       }
+
+-- | Let the delivery thread drain the queue and wait for it to finish.
+-- The extension itself is not deactivated.
+stopObserver :: Observer -> IO ()
+stopObserver obs =
+  do atomically (writeTVar (ringClosed (obsRing obs)) True)
+     void (waitCatch (obsThread obs))
+
+-- | Repeatedly take everything queued and deliver it, one call per run
+-- of messages from the same network.
+observerLoop :: Ptr () -> Arena -> Ring -> ActiveExtension -> IO ()
+observerLoop stab arena ring ae = loop
+  where
+    loop =
+      do batch <- atomically $
+           do items  <- readTVar (ringItems ring)
+              closed <- readTVar (ringClosed ring)
+              when (Seq.null items && not closed) retry
+              writeTVar (ringItems ring) Seq.empty
+              return items
+         unless (Seq.null batch) $
+           do traverse_ deliver (groupBy ((==) `on` entryNetwork) (toList batch))
+              loop
+
+    entryNetwork (Entry net _ _ _) = net
+
+    deliver entries@(Entry net _ _ _ : _) =
+      withRawIrcMsgs arena net [ (line, msg, ty) | Entry _ line msg ty <- entries ] $
+        observeExtension stab ae
+    deliver [] = return ()
+
+-- | Queue the messages of a burst that the observer subscribed to.
+-- When the queue is full the observer's overflow policy decides whether
+-- to wait for room or to discard the oldest queued messages.
+offerObserver ::
+  Text                      {- ^ network                   -} ->
+  [(ByteString, RawIrcMsg, Text)] {- ^ messages the client kept and their batch types -} ->
+  Observer                  {- ^ observer                  -} ->
+  IO Observer
+offerObserver network msgs obs
+  | null entries = return obs
+  | otherwise =
+      do (dropped, blocked, depth) <-
+           case obsPolicy obs of
+             OverflowDropOldest -> dropOldest
+             OverflowBlock      -> block 0 entries
+         let ObserverStats q d b _ = observerStats obs
+         return $! obs { observerStats =
+                           ObserverStats (q + length entries) (d + dropped) (b + blocked) depth }
+  where
+    items = ringItems (obsRing obs)
+    cap   = obsCapacity obs
+
+    entries = [ Entry network line msg ty
+                | (line, msg, ty) <- msgs
+                , wantsCommand (_msgCommand msg) (observerExtension obs) ]
+
+    dropOldest = atomically $
+      do queue <- readTVar items
+         let queue' = queue Seq.>< Seq.fromList entries
+             excess = max 0 (Seq.length queue' - cap)
+         writeTVar items $! Seq.drop excess queue'
+         return (excess, 0, Seq.length queue' - excess)
+
+    -- add as many messages as fit, waiting for room for the rest
+    block :: Int -> [Entry] -> IO (Int, Int, Int)
+    block blocked todo =
+      do (rest, depth) <- atomically $
+           do queue <- readTVar items
+              let (now, later) = splitAt (cap - Seq.length queue) todo
+                  queue'       = queue Seq.>< Seq.fromList now
+              writeTVar items $! queue'
+              return (later, Seq.length queue')
+         if null rest
+           then return (0, blocked, depth)
+           else do atomically $
+                     do queue <- readTVar items
+                        when (Seq.length queue >= cap) retry
+                   block (blocked + 1) rest
@@ -0,0 +1,161 @@
+{-# Language CPP, OverloadedStrings #-}
+{-|
+Module      : Client.CApi.Stats
+Description : Latency and throughput counters for extension callbacks
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+Each loaded extension carries counters for the callbacks the client
+makes into it. Calls are timed with a monotonic clock and counted in a
+histogram with power-of-two microsecond buckets. Calls slower than the
+configured threshold are also remembered so that the client can warn
+about them.
+
+The counters are updated atomically because observe-only extensions
+are called from their own threads.
+
+-}
+module Client.CApi.Stats
+  ( -- * Callbacks
+    Callback(..)
+  , callbackName
+
+  -- * Statistics
+  , CallbackStats(..)
+  , emptyCallbackStats
+  , histogramBuckets
+  , latencyBucket
+
+  -- * Extension counters
+  , ExtensionStats
+  , newExtensionStats
+  , timeCallback
+  , readExtensionStats
+  , SlowCall(..)
+  , takeSlowCalls
+  ) where
+
+import           Control.Monad
+import           Data.Bits
+import           Data.IORef
+import           Data.IntMap.Strict (IntMap)
+import qualified Data.IntMap.Strict as IntMap
+import           Data.Map.Strict (Map)
+import qualified Data.Map.Strict as Map
+import           Data.Maybe (fromMaybe)
+import           Data.Text (Text)
+import           Data.Word
+
+#if MIN_VERSION_base(4,11,0)
+import           GHC.Clock (getMonotonicTimeNSec)
+#else
+import           Data.Time.Clock.POSIX (getPOSIXTime)
+#endif
+
+-- | Callbacks of @struct glirc_extension@ that are measured.
+data Callback
+  = CallbackStart   -- ^ @start@
+  | CallbackMessage -- ^ @process_message@ and @process_messages@
+  | CallbackChat    -- ^ @process_chat@
+  | CallbackCommand -- ^ @process_command@
+  deriving (Eq, Ord, Show, Enum, Bounded)
+
+-- | Name of the callback as it appears in @struct glirc_extension@.
+callbackName :: Callback -> Text
+callbackName cb =
+  case cb of
+    CallbackStart   -> "start"
+    CallbackMessage -> "process_message"
+    CallbackChat    -> "process_chat"
+    CallbackCommand -> "process_command"
+
+-- | Counters for one callback of one extension.
+data CallbackStats = CallbackStats
+  { cbCalls     :: !Int          -- ^ number of calls
+  , cbMessages  :: !Int          -- ^ messages passed across all calls
+  , cbDrops     :: !Int          -- ^ messages the callback dropped
+  , cbTotalNs   :: !Word64       -- ^ total time spent in the callback
+  , cbMaxNs     :: !Word64       -- ^ longest single call
+  , cbHistogram :: !(IntMap Int) -- ^ calls per 'latencyBucket'
+  }
+
+-- | Counters for a callback that was never called.
+emptyCallbackStats :: CallbackStats
+emptyCallbackStats = CallbackStats 0 0 0 0 0 IntMap.empty
+
+-- | Number of histogram buckets. This matches @GLIRC_STATS_BUCKETS@.
+histogramBuckets :: Int
+histogramBuckets = 24
+
+-- | Histogram bucket of a call duration. Bucket 0 holds calls under a
+-- microsecond and bucket @i@ calls from @2^(i-1)@ up to @2^i@
+-- microseconds. The last bucket also holds all slower calls.
+latencyBucket :: Word64 {- ^ nanoseconds -} -> Int
+latencyBucket ns = min (histogramBuckets - 1) (finiteBitSize us - countLeadingZeros us)
+  where
+    us = ns `div` 1000
+
+-- | A call that took longer than the slow callback threshold.
+data SlowCall = SlowCall !Callback !Word64 -- ^ callback and nanoseconds
+
+-- | Mutable counters for all of the callbacks of one extension.
+data ExtensionStats = ExtensionStats
+  { statsCallbacks :: !(IORef (Map Callback CallbackStats))
+  , statsSlow      :: !(IORef [SlowCall]) -- ^ newest first
+  , statsThreshold :: !Word64             -- ^ nanoseconds, 0 to disable
+  }
+
+-- | Allocate counters for a newly loaded extension.
+newExtensionStats :: Int {- ^ slow callback threshold in milliseconds, 0 to disable -} -> IO ExtensionStats
+newExtensionStats ms =
+  do callbacks <- newIORef Map.empty
+     slow      <- newIORef []
+     return $! ExtensionStats callbacks slow (fromIntegral (max 0 ms) * 1000000)
+
+-- | Run a call into an extension and record how long it took.
+timeCallback ::
+  ExtensionStats {- ^ extension counters           -} ->
+  Callback       {- ^ callback being called        -} ->
+  Int            {- ^ messages passed to the call  -} ->
+  (a -> Int)     {- ^ messages dropped by result   -} ->
+  IO a           {- ^ call                         -} ->
+  IO a
+timeCallback stats cb n drops call =
+  do start <- getTimeNSec
+     x     <- call
+     end   <- getTimeNSec
+     let ns = end - start
+     atomicModifyIORef' (statsCallbacks stats) $ \m ->
+       (Map.alter (Just . addCall n (drops x) ns . fromMaybe emptyCallbackStats) cb m, ())
+     when (statsThreshold stats /= 0 && ns >= statsThreshold stats) $
+       atomicModifyIORef' (statsSlow stats) $ \xs -> (SlowCall cb ns : xs, ())
+     return x
+
+-- | Add one call to the counters.
+addCall :: Int -> Int -> Word64 -> CallbackStats -> CallbackStats
+addCall n d ns (CallbackStats calls msgs drops total mx hist) =
+  CallbackStats
+    (calls + 1) (msgs + n) (drops + d) (total + ns) (max mx ns)
+    (IntMap.insertWith (+) (latencyBucket ns) 1 hist)
+
+-- | Current counters for each callback that has been called.
+readExtensionStats :: ExtensionStats -> IO (Map Callback CallbackStats)
+readExtensionStats = readIORef . statsCallbacks
+
+-- | Remove and return the slow calls recorded since the last use,
+-- oldest first.
+takeSlowCalls :: ExtensionStats -> IO [SlowCall]
+takeSlowCalls stats =
+  do pending <- readIORef (statsSlow stats)
+     if null pending
+       then return []
+       else reverse <$> atomicModifyIORef' (statsSlow stats) (\xs -> ([], xs))
+
+-- | Current value of a monotonic clock in nanoseconds.
+getTimeNSec :: IO Word64
+#if MIN_VERSION_base(4,11,0)
+getTimeNSec = getMonotonicTimeNSec
+#else
+getTimeNSec = (\t -> floor (t * 1000000000)) <$> getPOSIXTime
+#endif
@@ -26,6 +26,7 @@ module Client.Commands
   ) where
 
 import           Client.CApi
+import           Client.CApi.Stats
 import           Client.Commands.Arguments.Spec
 import           Client.Commands.Arguments.Parser
 import           Client.Commands.Exec
@@ -327,6 +328,21 @@ commandsList =
       \\^Bextension\^B should be the name of the loaded extension.\n"
     $ ClientCommand cmdExtension simpleClientTab
 
+  , Command
+      (pure "extensions")
+      (pure ())
+      "Show the loaded extensions and the commands they subscribe to.\n"
+    $ ClientCommand cmdExtensions noClientTab
+
+  , Command
+      (pure "extstats")
+      (pure ())
+      "Show call counts and latencies of the callbacks of loaded extensions.\n\
+      \\n\
+      \Calls slower than `extension-slow-callback` milliseconds are also\n\
+      \reported in the client window.\n"
+    $ ClientCommand cmdExtStats noClientTab
+
   , Command
       (pure "palette")
       (pure ())
@@ -1390,6 +1406,20 @@ cmdDigraphs st _ = commandSuccess (changeSubfocus FocusDigraphs st)
 cmdKeyMap :: ClientCommand ()
 cmdKeyMap st _ = commandSuccess (changeSubfocus FocusKeyMap st)
 
+-- | Implementation of @/extensions@ command. Set subfocus to Extensions.
+cmdExtensions :: ClientCommand ()
+cmdExtensions st _ = commandSuccess (changeSubfocus FocusExtensions st)
+
+-- | Implementation of @/extstats@ command. Set subfocus to ExtensionStats
+-- with a snapshot of the counters of each loaded extension.
+cmdExtStats :: ClientCommand ()
+cmdExtStats st _ =
+  do stats <- traverse extensionStats (view (clientExtensions . esActive) st)
+     commandSuccess $ set clientExtensionStats stats
+                    $ changeSubfocus FocusExtensionStats st
+  where
+    extensionStats ae = (,) (aeName ae) <$> readExtensionStats (aeStats ae)
+
 -- | Implementation of @/rtsstats@ command. Set subfocus to RtsStats.
 -- Update cached rts stats in client state.
 cmdRtsStats :: ClientCommand ()
@@ -21,6 +21,7 @@ module Client.Configuration
   , ConfigurationFailure(..)
   , LayoutMode(..)
   , PaddingMode(..)
+  , OverflowPolicy(..)
 
   -- * Lenses
   , configDefaults
@@ -30,6 +31,9 @@ module Client.Configuration
   , configNickPadding
   , configMacros
   , configExtensions
+  , configExtensionQueueSize
+  , configExtensionOverflow
+  , configExtensionSlowCallback
   , configExtraHighlights
   , configUrlOpener
   , configIgnores
@@ -93,6 +97,9 @@ data Configuration = Configuration
   , _configNickPadding     :: PaddingMode -- ^ Padding of nicks in messages
   , _configMacros          :: Recognizer Macro -- ^ command macros
   , _configExtensions      :: [FilePath] -- ^ paths to shared library
+  , _configExtensionQueueSize :: Int -- ^ messages queued for each observe-only extension
+  , _configExtensionOverflow  :: OverflowPolicy -- ^ behavior when that queue is full
+  , _configExtensionSlowCallback :: Int -- ^ milliseconds before an extension callback is reported as slow, 0 to disable
   , _configUrlOpener       :: Maybe FilePath -- ^ paths to url opening executable
   , _configIgnores         :: [Text] -- ^ initial ignore mask list
   , _configActivityBar     :: Bool -- ^ initially visibility of the activity bar
@@ -119,6 +126,14 @@ data LayoutMode
   | TwoColumn
   deriving Show
 
+-- | Behavior when the message queue of an observe-only extension is full.
+data OverflowPolicy
+  -- | Wait for the extension to make room
+  = OverflowBlock
+  -- | Discard the oldest queued messages
+  | OverflowDropOldest
+  deriving Show
+
 makeLenses ''Configuration
 
 -- | Failure cases when loading a configuration file.
@@ -269,6 +284,14 @@ configurationSpec = sectionsSpec "" $
                                "Programmable macro commands"
      _configExtensions      <- sec' [] "extensions" (listSpec stringSpec)
                                "Filenames of extension libraries to load at startup"
+     _configExtensionQueueSize <- sec' 1024 "extension-queue-size" positiveSpec
+                               "Number of messages queued for each observe-only extension"
+     _configExtensionOverflow <- sec' OverflowDropOldest "extension-overflow" overflowSpec
+                               "Behavior when an observe-only extension's queue is full:\
+                               \ `block` or `drop-oldest` (default)"
+     _configExtensionSlowCallback <- sec' 100 "extension-slow-callback" nonnegativeSpec
+                               "Milliseconds an extension callback can run before a warning\
+                               \ is shown in the client window, 0 to disable (default 100)"
      _configUrlOpener       <- optSection' "url-opener" stringSpec
                                "External command used by /url command"
      _configExtraHighlights <- sec' mempty "extra-highlights" identifierSetSpec
@@ -339,6 +362,10 @@ layoutSpec :: ValueSpecs LayoutMode
 layoutSpec = OneColumn <$ atomSpec "one-column"
          <!> TwoColumn <$ atomSpec "two-column"
 
+overflowSpec :: ValueSpecs OverflowPolicy
+overflowSpec = OverflowBlock      <$ atomSpec "block"
+           <!> OverflowDropOldest <$ atomSpec "drop-oldest"
+
 keyBindingSpec :: ValueSpecs (KeyMap -> KeyMap)
 keyBindingSpec = actBindingSpec <!> cmdBindingSpec <!> unbindingSpec
 
@@ -373,6 +400,9 @@ keySpec = customSpec "emacs-key" stringSpec parseKey
 nonnegativeSpec :: (Ord a, Num a) => ValueSpecs a
 nonnegativeSpec = customSpec "non-negative" numSpec $ \x -> find (0 <=) [x]
 
+positiveSpec :: (Ord a, Num a) => ValueSpecs a
+positiveSpec = customSpec "positive" numSpec $ \x -> find (0 <) [x]
+
 
 paletteSpec :: ValueSpecs Palette
 paletteSpec = sectionsSpec "palette" $
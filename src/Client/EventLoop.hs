@@ -17,7 +17,8 @@ module Client.EventLoop
   ) where
 
 import qualified Client.Authentication.Ecdsa as Ecdsa
-import           Client.CApi
+import           Client.CApi (prepareFdWatch)
+import           Client.CApi.Types (FdEvents)
 import           Client.Commands
 import           Client.Commands.Interpolation
 import           Client.Configuration (configJumpModifier, configKeyMap, configWindowNames)
@@ -41,6 +42,7 @@ import           Control.Lens
 import           Control.Monad
 import           Data.ByteString (ByteString)
 import           Data.Foldable
+import qualified Data.IntMap as IntMap
 import           Data.List
 import           Data.Maybe
 import           Data.Monoid
@@ -60,11 +62,18 @@ import           LensUtils
 import           Hookup
 
 
--- | Sum of the three possible event types the event loop handles
+-- | Sum of the possible event types the event loop handles
 data ClientEvent
   = VtyEvent Event -- ^ Key presses and resizing
   | NetworkEvent NetworkEvent -- ^ Incoming network events
+  | NetworkLines NetworkId [(ZonedTime, ByteString)] -- ^ Lines already received on one network
   | TimerEvent NetworkId TimedAction -- ^ Timed action and the applicable network
+  | ExtensionTimerEvent -- ^ Timers started by extensions need attention
+  | FdWatchEvent Int FdEvents -- ^ File descriptor watched by an extension is ready
+
+-- | Maximum number of lines from one network processed as a single event
+maxLineBurst :: Int
+maxLineBurst = 256
 
 
 -- | Block waiting for the next 'ClientEvent'. This function will compute
@@ -74,12 +83,16 @@ getEvent ::
   ClientState {- ^ client state -} ->
   IO ClientEvent
 getEvent vty st =
-  do timer <- prepareTimer
-     atomically $
-       asum [ timer
-            , VtyEvent     <$> readTChan vtyEventChannel
-            , NetworkEvent <$> readTQueue (view clientEvents st)
-            ]
+  do timer    <- prepareTimer
+     extTimer <- prepareExtensionTimer
+     watches  <- traverse prepareWatch (IntMap.toList (view (clientExtensions . esWatches) st))
+     let release = traverse_ snd watches
+     (`finally` release) $ atomically $
+       asum $ [ timer
+              , extTimer
+              , VtyEvent     <$> readTChan vtyEventChannel
+              , readNetworkEvent (view clientEvents st)
+              ] ++ map fst watches
   where
     vtyEventChannel = _eventChannel (inputIface vty)
 
@@ -87,12 +100,47 @@ getEvent vty st =
       case earliestEvent st of
         Nothing -> return retry
         Just (networkId,(runAt,action)) ->
-          do now <- getCurrentTime
-             let microsecs = truncate (1000000 * diffUTCTime runAt now)
-             var <- registerDelay (max 0 microsecs)
-             return $ do ready <- readTVar var
-                         unless ready retry
-                         return (TimerEvent networkId action)
+          do ready <- waitUntil runAt
+             return (TimerEvent networkId action <$ ready)
+
+    prepareWatch (i, fw) =
+      do (ready, release) <- prepareFdWatch fw
+         return (FdWatchEvent i <$> ready, release)
+
+    prepareExtensionTimer =
+      case clientNextTimer st of
+        Nothing    -> return retry
+        Just runAt -> do ready <- waitUntil runAt
+                         return (ExtensionTimerEvent <$ ready)
+
+-- | Prepare a transaction that retries until the given time.
+waitUntil :: UTCTime -> IO (STM ())
+waitUntil runAt =
+  do now <- getCurrentTime
+     let microsecs = truncate (1000000 * diffUTCTime runAt now)
+     var <- registerDelay (max 0 microsecs)
+     return $ do ready <- readTVar var
+                 unless ready retry
+
+-- | Read the next network event. Lines that are already waiting in the
+-- queue from the same network are collected into a single event so that
+-- extensions can process them together.
+readNetworkEvent :: TQueue NetworkEvent -> STM ClientEvent
+readNetworkEvent queue =
+  do event <- readTQueue queue
+     case event of
+       NetworkLine net time line -> NetworkLines net <$> collect net [(time,line)] 1
+       _                         -> return (NetworkEvent event)
+  where
+    collect net acc n
+      | n >= maxLineBurst = return (reverse acc)
+      | otherwise =
+          do next <- tryReadTQueue queue
+             case next of
+               Just (NetworkLine net' time line)
+                 | net == net' -> collect net ((time,line) : acc) (n+1)
+               Just event      -> reverse acc <$ unGetTQueue queue event
+               Nothing         -> return (reverse acc)
 
 -- | Compute the earliest scheduled timed action for the client
 earliestEvent :: ClientState -> Maybe (NetworkId, (UTCTime, TimedAction))
@@ -113,11 +161,14 @@ eventLoop vty st =
      event <- getEvent vty st'
      case event of
        TimerEvent networkId action  -> eventLoop vty =<< doTimerEvent networkId action st'
+       ExtensionTimerEvent          -> eventLoop vty =<< doExtensionTimers st'
+       FdWatchEvent i events        -> eventLoop vty =<< clientRunWatch i events st'
        VtyEvent vtyEvent -> traverse_ (eventLoop vty) =<< doVtyEvent vty vtyEvent st'
+       NetworkLines net lines -> eventLoop vty =<< doNetworkLines net lines st'
        NetworkEvent networkEvent ->
          eventLoop vty =<<
          case networkEvent of
-           NetworkLine  net time line -> doNetworkLine  net time line st'
+           NetworkLine  net time line -> doNetworkLines net [(time,line)] st'
            NetworkError net time ex   -> doNetworkError net time ex st'
            NetworkOpen  net time      -> doNetworkOpen  net time st'
            NetworkClose net time      -> doNetworkClose net time st'
@@ -164,7 +215,7 @@ doNetworkClose networkId time st =
                  , _msgNetwork = view csNetwork cs
                  , _msgBody    = NormalBody "connection closed"
                  }
-     return (recordNetworkMessage msg st')
+     clientFlushMemberChanges (recordNetworkMessage msg st')
 
 
 -- | Respond to a network connection closing abnormally.
@@ -178,7 +229,7 @@ doNetworkError networkId time ex st =
   do let (cs,st1) = removeNetwork networkId st
          st2 = foldl' (\acc msg -> recordError time cs (Text.pack msg) acc) st1
              $ exceptionToLines ex
-     reconnectLogic ex cs st2
+     reconnectLogic ex cs =<< clientFlushMemberChanges st2
 
 reconnectLogic ::
   SomeException {- ^ thread failure reason -} ->
@@ -214,33 +265,58 @@ reconnectLogic ex cs st
           | otherwise                                                 -> False
 
 
--- | Respond to an IRC protocol line. This will parse the message, updated the
--- relevant connection state and update the UI buffers.
-doNetworkLine ::
-  NetworkId   {- ^ Network ID of message            -} ->
-  ZonedTime   {- ^ current time                     -} ->
-  ByteString  {- ^ Raw IRC message without newlines -} ->
-  ClientState {- ^ client state                     -} ->
+-- | Respond to a burst of IRC protocol lines received on one network.
+-- The lines are parsed and offered to extensions together, and then the
+-- surviving messages update the relevant connection state and UI buffers
+-- in order. Channel membership changes made by the burst are delivered
+-- to extensions together at the end.
+--
+-- Because the whole burst is offered before any line is applied,
+-- extension callbacks that query the client state see it as it was
+-- before the burst. This is documented next to @process_messages@ in
+-- @glirc-api.h@.
+doNetworkLines ::
+  NetworkId                 {- ^ Network ID of messages             -} ->
+  [(ZonedTime, ByteString)] {- ^ Raw IRC messages without newlines  -} ->
+  ClientState               {- ^ client state                       -} ->
   IO ClientState
-doNetworkLine networkId time line st =
+doNetworkLines networkId entries st =
   case view (clientConnections . at networkId) st of
-    Nothing -> error "doNetworkLine: Network missing"
+    Nothing -> error "doNetworkLines: Network missing"
     Just cs ->
-      let network = view csNetwork cs in
-      case parseRawIrcMsg (asUtf8 line) of
-        Nothing ->
-          do let msg = Text.pack ("Malformed message: " ++ show line)
-             return $! recordError time cs msg st
-
-        Just raw ->
-          do (st1,passed) <- clientPark st $ \ptr ->
-                               notifyExtensions ptr network raw
-                                 (view (clientExtensions . esActive) st)
-
-
-             if not passed then return st1 else do
-
-             let time' = computeEffectiveTime time (view msgTags raw)
+      do let network = view csNetwork cs
+             parsed  = [ (time, line, parseRawIrcMsg (asUtf8 line))
+                         | (time, line) <- entries ]
+
+         (st1, passes) <- clientNotifyExtensions network (view csBatches cs)
+                            [ (line, raw) | (_, line, Just raw) <- parsed ] st
+
+         let step (acc, ps) (time, line, Nothing) =
+               do let msg = Text.pack ("Malformed message: " ++ show line)
+                  return (recordError time cs msg acc, ps)
+             step (acc, p:ps) (time, _, Just raw) =
+               do acc' <- if p then doNetworkMsg networkId time raw acc
+                               else return acc
+                  return (acc', ps)
+             step (acc, []) _ = return (acc, []) -- one verdict per parsed message
+
+         clientFlushMemberChanges . fst =<< foldM step (st1, passes) parsed
+
+
+-- | Respond to an IRC protocol message that extensions allowed through.
+-- This will update the relevant connection state and the UI buffers.
+doNetworkMsg ::
+  NetworkId   {- ^ Network ID of message -} ->
+  ZonedTime   {- ^ current time          -} ->
+  RawIrcMsg   {- ^ parsed message        -} ->
+  ClientState {- ^ client state          -} ->
+  IO ClientState
+doNetworkMsg networkId time raw st1 =
+  case view (clientConnections . at networkId) st1 of
+    Nothing -> return st1 -- connection removed earlier in the same burst
+    Just cs ->
+          do let network = view csNetwork cs
+                 time' = computeEffectiveTime time (view msgTags raw)
 
                  (stateHook, viewHook)
                       = over both applyMessageHooks
@@ -511,6 +587,15 @@ executeInput ::
 executeInput st = execute (clientFirstLine st) st
 
 
+-- | Run the extension timers that are due.
+doExtensionTimers ::
+  ClientState {- ^ client state -} ->
+  IO ClientState
+doExtensionTimers st =
+  do now <- getCurrentTime
+     clientRunTimers now st
+
+
 -- | Respond to a timer event.
 doTimerEvent ::
   NetworkId   {- ^ Network related to event -} ->
@@ -344,6 +344,8 @@ viewSubfocusLabel pal subfocus =
                             opt mb
     FocusIgnoreList -> Just $ string (view palLabel pal) "ignores"
     FocusRtsStats -> Just $ string (view palLabel pal) "rtsstats"
+    FocusExtensions -> Just $ string (view palLabel pal) "extensions"
+    FocusExtensionStats -> Just $ string (view palLabel pal) "extstats"
     FocusMasks m  -> Just $ mconcat
       [ string (view palLabel pal) "masks"
       , char defAttr ':'
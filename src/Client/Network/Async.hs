@@ -28,6 +28,7 @@ module Client.Network.Async
   , NetworkEvent(..)
   , createConnection
   , Client.Network.Async.send
+  , sendAll
 
   -- * Abort connections
   , abortConnection
@@ -92,6 +93,11 @@ instance Exception TerminationReason where
 send :: NetworkConnection -> ByteString -> IO ()
 send c msg = atomically (writeTQueue (connOutQueue c) msg)
 
+-- | Schedule several messages in one transaction so that they are
+-- transmitted together and in order.
+sendAll :: NetworkConnection -> [ByteString] -> IO ()
+sendAll c msgs = atomically (traverse_ (writeTQueue (connOutQueue c)) msgs)
+
 -- | Force the given connection to terminate.
 abortConnection :: TerminationReason -> NetworkConnection -> IO ()
 abortConnection reason c = cancelWith (connAsync c) reason
@@ -44,6 +44,7 @@ module Client.State
   , clientErrorMsg
   , clientLayout
   , clientRtsStats
+  , clientExtensionStats
   , clientConfigPath
 
   -- * Client operations
@@ -51,6 +52,7 @@ module Client.State
   , clientStartExtensions
   , clientShutdown
   , clientPark
+  , clientNotifyExtensions
   , clientMatcher
   , clientMatcher'
   , clientActiveRegex
@@ -99,6 +101,17 @@ module Client.State
   -- * Extensions
   , ExtensionState
   , esActive
+  , esSkippedMarshals
+  , esObservers
+  , clientStartTimer
+  , clientCancelTimer
+  , clientRunTimers
+  , clientNextTimer
+  , esWatches
+  , clientWatchFd
+  , clientUnwatchFd
+  , clientRunWatch
+  , clientFlushMemberChanges
 
   -- * URL view
   , urlPattern
@@ -107,6 +120,10 @@ module Client.State
   ) where
 
 import           Client.CApi
+import           Client.CApi.Arena
+import           Client.CApi.Observer
+import           Client.CApi.Stats
+import           Client.CApi.Types
 import           Client.Commands.WordCompletion
 import           Client.Configuration
 import           Client.Configuration.ServerSettings
@@ -121,12 +138,14 @@ import qualified Client.State.EditBox as Edit
 import           Client.State.Focus
 import           Client.State.Network
 import           Client.State.Window
+import           Client.TimerWheel
 import           Control.Applicative
 import           Control.Concurrent.MVar
 import           Control.Concurrent.STM
 import           Control.Exception
 import           Control.Lens
 import           Control.Monad
+import           Data.ByteString (ByteString)
 import           Data.Foldable
 import           Data.Either
 import           Data.HashMap.Strict (HashMap)
@@ -143,6 +162,7 @@ import           Data.Text (Text)
 import qualified Data.Text as Text
 import qualified Data.Text.Lazy as LText
 import           Data.Time
+import           Data.Time.Clock.POSIX
 import           Foreign.Ptr
 import           Foreign.StablePtr
 import           Irc.Codes
@@ -192,6 +212,7 @@ data ClientState = ClientState
   , _clientLogQueue          :: ![LogLine]                -- ^ log lines ready to write
   , _clientErrorMsg          :: Maybe Text                -- ^ transient error box text
   , _clientRtsStats          :: Maybe Stats               -- ^ most recent GHC RTS stats
+  , _clientExtensionStats    :: [(Text, Map Callback CallbackStats)] -- ^ most recent extension stats
   }
 
 
@@ -199,6 +220,14 @@ data ClientState = ClientState
 -- to support reentry into the Haskell runtime from the C API.
 data ExtensionState = ExtensionState
   { _esActive    :: [ActiveExtension]            -- ^ active extensions
+  , _esDispatch  :: MessageDispatch              -- ^ command index of 'esActive'
+  , _esSkippedMarshals :: !Int                   -- ^ messages no extension subscribed to
+  , _esArena     :: Arena                        -- ^ buffer reused to marshal messages
+  , _esObservers :: [Observer]                   -- ^ delivery threads of observe-only extensions
+  , _esTimers    :: !(TimerWheel (FunPtr TimerCallback, Ptr ())) -- ^ timers started by extensions
+  , _esWatches   :: !(IntMap FdWatch)            -- ^ file descriptors watched by extensions
+  , _esNextWatch :: !Int                         -- ^ next unused watch identifier
+  , _esMemberChanges :: ![(Text, MemberChange)]  -- ^ undelivered membership changes, newest first
   , _esMVar      :: MVar ClientState             -- ^ 'MVar' used to with 'clientPark'
   , _esStablePtr :: StablePtr (MVar ClientState) -- ^ 'StablePtr' used with 'clientPark'
   }
@@ -218,7 +247,152 @@ clientPark st k =
      let token = views (clientExtensions . esStablePtr) castStablePtrToPtr st
      res <- k token
      st' <- takeMVar mvar
-     return (st', res)
+     st'' <- recordSlowCalls st'
+     return (st'', res)
+
+-- | Report extension callbacks that took longer than
+-- @extension-slow-callback@ in the client window.
+recordSlowCalls :: ClientState -> IO ClientState
+recordSlowCalls st =
+  do slow <- traverse slowCalls (view (clientExtensions . esActive) st)
+     case concat slow of
+       []    -> return st
+       calls -> do now <- getZonedTime
+                   return $! foldl' (\acc c -> recordNetworkMessage (slowMessage now c) acc) st calls
+  where
+    slowCalls ae = map ((,) (aeName ae)) <$> takeSlowCalls (aeStats ae)
+
+    slowMessage now (name, SlowCall cb ns) = ClientMessage
+      { _msgTime    = now
+      , _msgBody    = ErrorBody (Text.concat
+                        [ name, ": ", callbackName cb, " took "
+                        , Text.pack (show (ns `div` 1000000)), " ms" ])
+      , _msgNetwork = ""
+      }
+
+-- | Offer a burst of incoming IRC messages to the extensions that
+-- subscribed to their commands. A message is only marshaled when there
+-- is at least one such extension. The messages that pass are then queued
+-- for the observe-only extensions. This happens while the client is
+-- parked so that observers waiting on the client can make progress.
+--
+-- Returns 'False' for each message that an extension dropped.
+clientNotifyExtensions ::
+  Text                      {- ^ network                -} ->
+  HashMap Text Text         {- ^ batches open before the lines -} ->
+  [(ByteString, RawIrcMsg)] {- ^ lines and their parses -} ->
+  ClientState               {- ^ client state           -} ->
+  IO (ClientState, [Bool])
+clientNotifyExtensions network batches raws st
+  | not (hasMessageListeners dispatch) && null observers = return (st, map (const True) raws)
+  | otherwise =
+      do (st1, (passes, observers')) <- clientPark st' $ \ptr ->
+           do passes <- notifyExtensions ptr arena network dispatch typed
+              let kept = [ raw | (raw, True) <- zip typed passes ]
+              observers' <- traverse (offerObserver network kept) observers
+              return (passes, observers')
+         return (set (clientExtensions . esObservers) observers' st1, passes)
+  where
+    typed     = zipWith (\(line, raw) ty -> (line, raw, ty)) raws
+                        (burstBatchTypes batches (map snd raws))
+    arena     = view (clientExtensions . esArena) st
+    observers = view (clientExtensions . esObservers) st
+    dispatch = view (clientExtensions . esDispatch) st
+    skipped  = length [ () | (_, raw) <- raws
+                           , null (dispatchMessage dispatch (view msgCommand raw)) ]
+    st'      = overStrict (clientExtensions . esSkippedMarshals) (+ skipped) st
+
+-- | Convert a time to the millisecond ticks used by extension timers.
+timerTick :: UTCTime -> Int
+timerTick t = floor (utcTimeToPOSIXSeconds t * 1000)
+
+-- | Schedule an extension timer callback to run after a number of
+-- milliseconds.
+clientStartTimer ::
+  UTCTime                {- ^ current time   -} ->
+  Int                    {- ^ milliseconds   -} ->
+  FunPtr TimerCallback   {- ^ callback       -} ->
+  Ptr ()                 {- ^ callback data  -} ->
+  ClientState            {- ^ client state   -} ->
+  (TimerId, ClientState)
+clientStartTimer now millis f dat =
+  clientExtensions . esTimers %%~ insertTimer (timerTick now + millis) (f, dat)
+
+-- | Cancel an extension timer that has not fired, returning its data.
+clientCancelTimer :: TimerId -> ClientState -> Maybe (Ptr (), ClientState)
+clientCancelTimer timer st =
+  do ((_, dat), timers) <- cancelTimer timer (view (clientExtensions . esTimers) st)
+     return (dat, set (clientExtensions . esTimers) timers st)
+
+-- | Run the extension timer callbacks that are due.
+clientRunTimers :: UTCTime -> ClientState -> IO ClientState
+clientRunTimers now st
+  | null due  = return st1
+  | otherwise = fst <$> clientPark st1 (\ptr ->
+                  traverse_ (\(f, dat) -> runTimerCallback f ptr dat) due)
+  where
+    (due, st1) = (clientExtensions . esTimers) (advanceTimers (timerTick now)) st
+
+-- | Time when the extension timers next need attention.
+clientNextTimer :: ClientState -> Maybe UTCTime
+clientNextTimer st =
+  do tick <- nextTimerTick (view (clientExtensions . esTimers) st)
+     return $! posixSecondsToUTCTime (fromIntegral tick / 1000)
+
+-- | Start watching a file descriptor on behalf of an extension.
+-- Returns the identifier of the new watch.
+clientWatchFd :: FdWatch -> ClientState -> (Int, ClientState)
+clientWatchFd fw st =
+  (i, set (clientExtensions . esNextWatch) (i + 1)
+    $ set (clientExtensions . esWatches . at i) (Just fw) st)
+  where
+    i = view (clientExtensions . esNextWatch) st
+
+-- | Stop watching a file descriptor, returning the watch's callback data.
+clientUnwatchFd :: Int -> ClientState -> Maybe (Ptr (), ClientState)
+clientUnwatchFd i st =
+  do fw <- view (clientExtensions . esWatches . at i) st
+     return (fwData fw, set (clientExtensions . esWatches . at i) Nothing st)
+
+-- | Run the callback of a watch whose file descriptor became ready.
+-- Watches that could not be registered are removed before the
+-- extension is told about the error.
+clientRunWatch :: Int -> FdEvents -> ClientState -> IO ClientState
+clientRunWatch i events st =
+  case view (clientExtensions . esWatches . at i) st of
+    Nothing -> return st -- removed since the event loop registered it
+    Just fw ->
+      do let st1 | events == glircFdError = set (clientExtensions . esWatches . at i) Nothing st
+                 | otherwise              = st
+         fst <$> clientPark st1 (\ptr -> runFdWatch ptr fw events)
+
+-- | Record membership changes on a network for delivery by
+-- 'clientFlushMemberChanges'. Nothing is recorded when no extension has
+-- a membership callback.
+queueMemberChanges :: Text {- ^ network -} -> [MemberChange] -> ClientState -> ClientState
+queueMemberChanges network changes st
+  | views (clientExtensions . esDispatch) (null . memberListeners) st = st
+  | otherwise = over (clientExtensions . esMemberChanges)
+                     (reverse [ (network, change) | change <- changes ] ++) st
+
+-- | Deliver the queued membership changes to extensions, one call per
+-- run of changes on the same network.
+clientFlushMemberChanges :: ClientState -> IO ClientState
+clientFlushMemberChanges st
+  | null pending = return st
+  | otherwise    = fst <$> clientPark st1 (\ptr ->
+                     traverse_ (deliver ptr) (groupBy sameNetwork (reverse pending)))
+  where
+    (pending, st1) = (clientExtensions . esMemberChanges <<.~ []) st
+
+    arena     = view (clientExtensions . esArena) st
+    listeners = views (clientExtensions . esDispatch) memberListeners st
+
+    sameNetwork x y = fst x == fst y
+
+    deliver ptr changes@((network, _) : _) =
+      notifyMemberChanges ptr arena network listeners (map snd changes)
+    deliver _ [] = return ()
 
 -- | 'Traversal' for finding the 'NetworkState' associated with a given network
 -- if that connection is currently active.
@@ -276,14 +450,25 @@ withClientState cfgPath cfg k =
         , _clientLogQueue          = []
         , _clientErrorMsg          = Nothing
         , _clientRtsStats          = Nothing
+        , _clientExtensionStats    = []
         }
 
 withExtensionState :: (ExtensionState -> IO a) -> IO a
 withExtensionState k =
-  do mvar <- newEmptyMVar
+  do mvar  <- newEmptyMVar
+     arena <- newArena
+     now   <- getCurrentTime
      bracket (newStablePtr mvar) freeStablePtr $ \stab ->
        k ExtensionState
          { _esActive    = []
+         , _esDispatch  = buildMessageDispatch []
+         , _esSkippedMarshals = 0
+         , _esArena     = arena
+         , _esObservers = []
+         , _esTimers    = emptyTimerWheel (timerTick now)
+         , _esWatches   = IntMap.empty
+         , _esNextWatch = 1
+         , _esMemberChanges = []
          , _esMVar      = mvar
          , _esStablePtr = stab
          }
@@ -684,7 +869,8 @@ urlMatches txt = removeBrackets . extractText . (^?! ix 0)
 
 -- | Remove a network connection and unlink it from the network map.
 -- This operation assumes that the network connection exists and should
--- only be applied once per connection.
+-- only be applied once per connection. Extensions tracking channel
+-- membership are told to forget the network's channels.
 removeNetwork :: NetworkId -> ClientState -> (NetworkState, ClientState)
 removeNetwork networkId st =
   case (clientConnections . at networkId <<.~ Nothing) st of
@@ -692,7 +878,9 @@ removeNetwork networkId st =
     (Just cs, st1) ->
       -- Only remove the network mapping if it hasn't already been replaced
       -- with a new one. This can happen during reconnect in particular.
-      let network = view csNetwork cs in
+      let network = view csNetwork cs
+          resets  = map MemberReset (views csChannels HashMap.keys cs) in
+      fmap (queueMemberChanges network resets) $
       forOf (clientNetworkMap . at network) st1 $ \mb ->
         case mb of
           Just i | i == networkId -> (cs,Nothing)
@@ -751,7 +939,8 @@ applyMessageToClientState time irc networkId cs st =
   where
     (reply, cs') = applyMessage time irc cs
     network      = view csNetwork cs
-    st'          = applyWindowRenames network irc
+    st'          = queueMemberChanges network (memberChanges irc cs cs')
+                 $ applyWindowRenames network irc
                  $ set (clientConnections . ix networkId) cs' st
 
 -- | When a nick change happens and there is an open query window for that nick
@@ -791,12 +980,22 @@ clientShutdown st = () <$ clientStopExtensions st
 
 
 -- | Unload all active extensions.
+--
+-- Timers and watches are kept while the stop callbacks run, so that
+-- extensions can still cancel them there. Afterwards every remaining
+-- timer and watch, including any started during stop, belonged to an
+-- extension that is now unloaded, and they are all removed.
 clientStopExtensions :: ClientState -> IO ClientState
 clientStopExtensions st =
-  do let (aes,st1) = (clientExtensions . esActive <<.~ []) st
+  do let (obs,st0) = (clientExtensions . esObservers <<.~ []) st
+         (aes,st1) = (clientExtensions . esActive <<.~ [])
+                   $ set (clientExtensions . esDispatch) (buildMessageDispatch []) st0
      (st2,_) <- clientPark st1 $ \ptr ->
-                  traverse_ (deactivateExtension ptr) aes
-     return st2
+                  do traverse_ stopObserver obs
+                     traverse_ (deactivateExtension ptr) aes
+     return $! over (clientExtensions . esTimers) clearTimers
+             $ set  (clientExtensions . esMemberChanges) []
+             $ set  (clientExtensions . esWatches) IntMap.empty st2
 
 -- | Start extensions after ensuring existing ones are stopped
 clientStartExtensions :: ClientState -> IO ClientState
@@ -804,12 +1003,22 @@ clientStartExtensions st =
   do let cfg = view clientConfig st
      st1        <- clientStopExtensions st
      (st2, res) <- clientPark st1 $ \ptr ->
-            traverse (try . activateExtension ptr)
+            traverse (try . activateExtension ptr (view configExtensionSlowCallback cfg))
                      (view configExtensions cfg)
 
      let (errors, exts) = partitionEithers res
      st3 <- recordErrors errors st2
-     return $! set (clientExtensions . esActive) exts st3
+     let stab = views (clientExtensions . esStablePtr) castStablePtrToPtr st3
+     obs <- traverse (startObserver stab (view configExtensionQueueSize cfg)
+                                         (view configExtensionOverflow cfg))
+                     (filter aeObserveOnly exts)
+     let st4 = set (clientExtensions . esActive) exts
+             $ set (clientExtensions . esDispatch) (buildMessageDispatch exts)
+             $ set (clientExtensions . esObservers) obs st3
+
+         -- start membership listeners off with the current channel members
+         snapshot acc cs = queueMemberChanges (view csNetwork cs) (memberSnapshot cs) acc
+     clientFlushMemberChanges (foldl' snapshot st4 (view clientConnections st4))
   where
     recordErrors [] ste = return ste
     recordErrors es ste =
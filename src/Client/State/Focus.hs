@@ -54,6 +54,8 @@ data Subfocus
   | FocusKeyMap      -- ^ Show key bindings
   | FocusHelp (Maybe Text) -- ^ Show help window with optional command
   | FocusRtsStats    -- ^ Show GHC RTS statistics
+  | FocusExtensions  -- ^ Show loaded extensions
+  | FocusExtensionStats -- ^ Show extension callback statistics
   | FocusIgnoreList    -- ^ Show ignored masks
   deriving (Eq,Show)
 
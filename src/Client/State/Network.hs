@@ -44,6 +44,7 @@ module Client.State.Network
   , csLastReceived
   , csMessageHooks
   , csAuthenticationState
+  , csBatches
 
   -- * User information
   , UserAndHost(..)
@@ -57,10 +58,16 @@ module Client.State.Network
 
   -- * Messages interactions
   , sendMsg
+  , sendMsgs
   , initialMessages
   , applyMessage
   , squelchIrcMsg
 
+  -- * Channel membership changes
+  , MemberChange(..)
+  , memberChanges
+  , memberSnapshot
+
   -- * Timer information
   , PingStatus(..)
   , _PingConnecting
@@ -124,6 +131,7 @@ data NetworkState = NetworkState
   , _csLastReceived :: !(Maybe UTCTime) -- ^ time of last message received
   , _csMessageHooks :: ![Text] -- ^ names of message hooks to apply to this connection
   , _csAuthenticationState :: !AuthenticateState
+  , _csBatches      :: !(HashMap Text Text) -- ^ types of open batches by reference tag
   }
   deriving Show
 
@@ -171,17 +179,25 @@ csNick = csUserInfo . uiNick
 -- with the given network. For @PRIVMSG@ and @NOTICE@ overlong
 -- commands are detected and transmitted as multiple messages.
 sendMsg :: NetworkState -> RawIrcMsg -> IO ()
-sendMsg cs msg =
+sendMsg cs msg = sendMsgs cs [msg]
+
+-- | Transmit several messages like 'sendMsg' in a single
+-- transaction on the connection's send queue.
+sendMsgs :: NetworkState -> [RawIrcMsg] -> IO ()
+sendMsgs cs msgs =
+  sendAll (view csSocket cs) (map renderRawIrcMsg (concatMap (splitMsg cs) msgs))
+
+-- | Split overlong @PRIVMSG@ and @NOTICE@ commands into several
+-- messages that each fit on a line.
+splitMsg :: NetworkState -> RawIrcMsg -> [RawIrcMsg]
+splitMsg cs msg =
   case (view msgCommand msg, view msgParams msg) of
     ("PRIVMSG", [tgt,txt]) -> multiline "PRIVMSG" tgt txt
     ("NOTICE",  [tgt,txt]) -> multiline "NOTICE"  tgt txt
-    _ -> transmit msg
+    _ -> [msg]
   where
-    transmit = send (view csSocket cs) . renderRawIrcMsg
-
     multiline cmd tgt txt =
-      for_ txtChunks $ \txtChunk ->
-        transmit $ rawIrcMsg cmd [tgt, txtChunk]
+      [ rawIrcMsg cmd [tgt, txtChunk] | txtChunk <- txtChunks ]
       where
         txtChunks = utf8ChunksOf maxContentLen txt
         maxContentLen = computeMaxMessageLength (view csUserInfo cs) tgt
@@ -240,6 +256,7 @@ newNetworkState networkId network settings sock ping = NetworkState
   , _csLastReceived = Nothing
   , _csMessageHooks = view ssMessageHooks settings
   , _csAuthenticationState = AS_None
+  , _csBatches      = HashMap.empty
   }
 
 
@@ -296,6 +313,8 @@ applyMessage' msgWhen msg cs =
     Authenticate param     -> doAuthenticate param cs
     Mode who target (modes:params)  -> doMode msgWhen who target modes params cs
     Topic user chan topic  -> noReply (doTopic msgWhen user chan topic cs)
+    BatchStart ref ty _    -> noReply (over csBatches (HashMap.insert ref ty) cs)
+    BatchEnd ref           -> noReply (over csBatches (HashMap.delete ref) cs)
     _                      -> noReply cs
   where
     exitChannel chan nick
@@ -305,6 +324,70 @@ applyMessage' msgWhen msg cs =
       | otherwise              = noReply $ forgetUser' nick
                                $ overChannel chan (partChannel nick) cs
 
+-- | Change to the members of one channel. Changes affecting several
+-- channels, like quits and nick changes, are reported once per channel.
+data MemberChange
+  = MemberJoin  !Identifier !Identifier             -- ^ channel, nick
+  | MemberPart  !Identifier !Identifier             -- ^ channel, nick
+  | MemberKick  !Identifier !Identifier             -- ^ channel, nick
+  | MemberQuit  !Identifier !Identifier             -- ^ channel, nick
+  | MemberNick  !Identifier !Identifier !Identifier -- ^ channel, old nick, new nick
+  | MemberReset !Identifier                         -- ^ channel, all members forgotten
+  deriving (Eq, Show)
+
+-- | Compute the membership changes made by 'applyMessage' from the
+-- connection state before and after the message. The cost is
+-- proportional to the number of changes except for a names list, which
+-- replaces the membership of a channel with a reset and a join for
+-- each member.
+memberChanges ::
+  IrcMsg       {- ^ message applied  -} ->
+  NetworkState {- ^ state before     -} ->
+  NetworkState {- ^ state after      -} ->
+  [MemberChange]
+memberChanges msg old new =
+  case msg of
+    Join user chan
+      | isMember new chan (userNick user) -> [MemberJoin chan (userNick user)]
+
+    Part user chan _mbreason
+      | isMember old chan (userNick user) -> [MemberPart chan (userNick user)]
+
+    Kick _kicker chan nick _reason
+      | isMember old chan nick -> [MemberKick chan nick]
+
+    Quit user _reason ->
+      [ MemberQuit chan (userNick user) | chan <- channelsOf (userNick user) ]
+
+    Nick oldNick newNick ->
+      [ MemberNick chan (userNick oldNick) newNick | chan <- channelsOf (userNick oldNick) ]
+
+    Reply RPL_ENDOFNAMES (_me:tgt:_)
+      | Just chanState <- preview (csChannels . ix chan) new ->
+          channelSnapshot chan chanState
+      where
+        chan = mkId tgt
+
+    _ -> []
+  where
+    isMember cs chan nick = has (csChannels . ix chan . chanUsers . ix nick) cs
+
+    channelsOf nick =
+      [ chan | (chan, cs) <- HashMap.toList (view csChannels old)
+             , has (chanUsers . ix nick) cs ]
+
+-- | Current members of every joined channel as the changes that would
+-- build them up from nothing.
+memberSnapshot :: NetworkState -> [MemberChange]
+memberSnapshot cs =
+  concat [ channelSnapshot chan chanState
+           | (chan, chanState) <- HashMap.toList (view csChannels cs) ]
+
+-- | Membership of a channel as a reset followed by a join for each member.
+channelSnapshot :: Identifier -> ChannelState -> [MemberChange]
+channelSnapshot chan chanState =
+  MemberReset chan : [ MemberJoin chan nick | nick <- views chanUsers HashMap.keys chanState ]
+
 -- | Restrict 'csUsers' to only users are in a channel that the client
 -- is connected to.
 pruneUsers :: NetworkState -> NetworkState
@@ -0,0 +1,151 @@
+{-|
+Module      : Client.TimerWheel
+Description : Hierarchical timer wheel
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+This module implements a hierarchical timer wheel used to schedule the
+timers requested by extensions.
+
+Timers are stored in buckets on one of several levels. A bucket on
+level @n@ covers @64^n@ ticks. Each timer is placed on the finest level
+whose buckets can distinguish its deadline from the current time. When
+the wheel reaches a bucket its timers fire, for level 0, or move down to
+a finer level. Each timer is therefore handled a bounded number of times
+no matter how many timers are scheduled.
+
+Unlike a classic timer wheel, the levels are not fixed arrays of
+circular slots. Each level is an 'IntMap' keyed by absolute bucket
+number, and an 'IntMap' index maps each timer to its bucket. This keeps
+the wheel a persistent value that fits in the immutable client state
+without an 'IORef' or mutable array. The cost is that 'insertTimer' and
+'cancelTimer' are 'IntMap' operations, O(min(n, W)) for W-bit keys,
+rather than constant time. 'advanceTimers' still finds the next bucket
+by looking only at the earliest bucket of each level.
+
+-}
+module Client.TimerWheel
+  ( TimerWheel
+  , TimerId(..)
+  , emptyTimerWheel
+  , clearTimers
+  , insertTimer
+  , cancelTimer
+  , advanceTimers
+  , nextTimerTick
+  , timerCount
+  ) where
+
+import           Data.Bits
+import           Data.IntMap (IntMap)
+import qualified Data.IntMap as IntMap
+import           Data.Maybe (fromMaybe)
+
+-- | Identifier of a scheduled timer. Identifiers are never reused.
+newtype TimerId = TimerId Int
+  deriving (Eq, Ord, Show)
+
+-- | Timers carrying values of type @a@, scheduled at integer ticks.
+data TimerWheel a = TimerWheel
+  { twNow    :: !Int                                 -- ^ current tick
+  , twNextId :: !Int                                 -- ^ next unused identifier
+  , twLevels :: !(IntMap (IntMap (IntMap (Int, a)))) -- ^ level, bucket, identifier
+  , twIndex  :: !(IntMap (Int, Int))                 -- ^ level and bucket of each timer
+  }
+
+-- | Number of bits of the tick resolved by each level.
+levelBits :: Int
+levelBits = 6
+
+-- | Number of levels. The last level has unbounded range.
+levelCount :: Int
+levelCount = 4
+
+-- | Wheel with no timers starting at the given tick.
+emptyTimerWheel :: Int {- ^ current tick -} -> TimerWheel a
+emptyTimerWheel now = TimerWheel now 1 IntMap.empty IntMap.empty
+
+-- | Remove all timers without reusing their identifiers.
+clearTimers :: TimerWheel a -> TimerWheel a
+clearTimers w = w { twLevels = IntMap.empty, twIndex = IntMap.empty }
+
+-- | Number of scheduled timers.
+timerCount :: TimerWheel a -> Int
+timerCount = IntMap.size . twIndex
+
+-- | Schedule a value to be returned by 'advanceTimers' once the wheel
+-- reaches the given tick.
+insertTimer :: Int {- ^ deadline tick -} -> a -> TimerWheel a -> (TimerId, TimerWheel a)
+insertTimer deadline x w = (TimerId i, place i deadline x w { twNextId = i + 1 })
+  where
+    i = twNextId w
+
+-- | Remove a timer that has not fired yet, returning its value.
+cancelTimer :: TimerId -> TimerWheel a -> Maybe (a, TimerWheel a)
+cancelTimer (TimerId i) w =
+  do (lvl, bucket) <- IntMap.lookup i (twIndex w)
+     (_, x)        <- IntMap.lookup i =<< IntMap.lookup bucket
+                                      =<< IntMap.lookup lvl (twLevels w)
+     let remove = IntMap.update (nonEmpty . IntMap.delete i) bucket
+     return (x, w { twIndex  = IntMap.delete i (twIndex w)
+                  , twLevels = IntMap.adjust remove lvl (twLevels w) })
+  where
+    nonEmpty m
+      | IntMap.null m = Nothing
+      | otherwise     = Just m
+
+-- | Advance the wheel to the given tick, returning the values of the
+-- timers that came due in deadline order.
+advanceTimers :: Int {- ^ current tick -} -> TimerWheel a -> ([a], TimerWheel a)
+advanceTimers tick = go []
+  where
+    go acc w =
+      case nextBucket w of
+        Just (start, lvl, key) | start <= tick ->
+          let timers = fromMaybe IntMap.empty
+                         (IntMap.lookup key =<< IntMap.lookup lvl (twLevels w))
+              w'     = w { twNow    = max (twNow w) start
+                         , twLevels = IntMap.adjust (IntMap.delete key) lvl (twLevels w) }
+          in if lvl == 0
+               then go (reverse (map snd (IntMap.elems timers)) ++ acc)
+                       w' { twIndex = twIndex w' `IntMap.difference` timers }
+               else go acc (IntMap.foldrWithKey (\i (d,x) -> place i d x) w' timers)
+
+        _ -> (reverse acc, w { twNow = max (twNow w) tick })
+
+-- | Tick at which the wheel next has work to do: either timers to fire
+-- or a bucket to move to a finer level. This is never later than the
+-- earliest deadline.
+nextTimerTick :: TimerWheel a -> Maybe Int
+nextTimerTick w = (\(start,_,_) -> start) <$> nextBucket w
+
+-- | Earliest nonempty bucket as its starting tick, level, and key.
+nextBucket :: TimerWheel a -> Maybe (Int, Int, Int)
+nextBucket w
+  | null starts = Nothing
+  | otherwise   = Just (minimum starts)
+  where
+    starts = [ (shiftL key (levelBits * lvl), lvl, key)
+               | (lvl, buckets) <- IntMap.toList (twLevels w)
+               , Just ((key, _), _) <- [IntMap.minViewWithKey buckets] ]
+
+-- | Store a timer in the bucket for its deadline relative to the
+-- current tick.
+place :: Int -> Int -> a -> TimerWheel a -> TimerWheel a
+place i deadline x w =
+  w { twLevels = IntMap.alter (Just . addTimer . fromMaybe IntMap.empty) lvl (twLevels w)
+    , twIndex  = IntMap.insert i (lvl, bucket) (twIndex w) }
+  where
+    lvl      = levelFor (twNow w) deadline
+    bucket   = shiftR deadline (levelBits * lvl)
+    addTimer = IntMap.insertWith IntMap.union bucket (IntMap.singleton i (deadline, x))
+
+-- | Finest level whose buckets separate the deadline from the current
+-- tick. Deadlines in the past go to level 0 and fire on the next advance.
+levelFor :: Int {- ^ current tick -} -> Int {- ^ deadline -} -> Int
+levelFor now deadline =
+  head ([ lvl | lvl <- [0 .. levelCount - 2]
+              , let bits = levelBits * (lvl + 1)
+              , shiftR deadline bits <= shiftR now bits ]
+        ++ [levelCount - 1])
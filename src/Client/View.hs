@@ -18,6 +18,8 @@ import           Client.State
 import           Client.State.Focus
 import           Client.View.ChannelInfo
 import           Client.View.Digraphs
+import           Client.View.ExtensionStats
+import           Client.View.Extensions
 import           Client.View.Help
 import           Client.View.IgnoreList
 import           Client.View.KeyMap
@@ -50,6 +52,8 @@ viewLines focus subfocus w !st =
     (_, FocusKeyMap) -> keyMapLines st
     (_, FocusHelp mb) -> helpImageLines st mb pal
     (_, FocusRtsStats) -> rtsStatsLines (view clientRtsStats st) pal
+    (_, FocusExtensions) -> extensionsLines st pal
+    (_, FocusExtensionStats) -> extensionStatsLines (view clientExtensionStats st) pal
     (_, FocusIgnoreList) -> ignoreListLines (view clientIgnores st) pal
     _ -> chatMessageImages focus w st
   where
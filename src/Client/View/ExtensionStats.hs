@@ -0,0 +1,79 @@
+{-# Language OverloadedStrings #-}
+{-|
+Module      : Client.View.ExtensionStats
+Description : View extension callback statistics
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+Lines for the @/extstats@ command. Each extension is shown with the
+call, message, and drop counts of its callbacks along with their mean
+and maximum latency and a latency histogram.
+
+-}
+
+module Client.View.ExtensionStats
+  ( extensionStatsLines
+  ) where
+
+import           Client.CApi.Stats
+import           Client.Image.Message
+import           Client.Image.PackedImage
+import           Client.Image.Palette
+import           Control.Lens
+import qualified Data.IntMap as IntMap
+import           Data.Map (Map)
+import qualified Data.Map as Map
+import           Data.Semigroup
+import           Data.Text (Text)
+import qualified Data.Text as Text
+import           Data.Word
+import           Graphics.Vty.Attributes
+import           Numeric (showFFloat)
+
+-- | Generate lines used for @/extstats@ from the counters of each
+-- loaded extension.
+extensionStatsLines :: [(Text, Map Callback CallbackStats)] -> Palette -> [Image']
+extensionStatsLines [] pal = [text' (view palError pal) "No extensions loaded"]
+extensionStatsLines exts pal = reverse (concatMap extensionLines exts)
+  where
+    label = text' (view palLabel pal)
+
+    extensionLines (name, cbs)
+      | Map.null cbs = [label (cleanText name), text' defAttr "  no calls"]
+      | otherwise    = label (cleanText name) :
+                       concatMap (uncurry callbackLines) (Map.toList cbs)
+
+    callbackLines cb stats =
+      [ text' defAttr ("  " <> callbackName cb) <>
+        field "calls" (show (cbCalls stats)) <>
+        field "messages" (show (cbMessages stats)) <>
+        field "drops" (show (cbDrops stats)) <>
+        field "mean" (showNs (cbTotalNs stats `div` fromIntegral (max 1 (cbCalls stats)))) <>
+        field "max" (showNs (cbMaxNs stats))
+      , string defAttr "   " <>
+        mconcat [ field (bucketLabel i) (show n)
+                | (i, n) <- IntMap.toList (cbHistogram stats) ]
+      ]
+
+    field lbl val = label (" " <> lbl <> ": ") <> string defAttr val
+
+-- | Label of a histogram bucket by its upper bound, or its lower bound
+-- for the last bucket.
+bucketLabel :: Int -> Text
+bucketLabel i
+  | i == histogramBuckets - 1 = Text.pack (">=" ++ showNs (bound (i - 1)))
+  | otherwise                 = Text.pack ("<"  ++ showNs (bound i))
+  where
+    bound j = 1000 * 2 ^ j
+
+-- | Render a duration in nanoseconds with a suitable unit.
+showNs :: Word64 -> String
+showNs ns
+  | ns < 1000       = show ns ++ "ns"
+  | ns < 1000000    = unit 1e3 "us"
+  | ns < 1000000000 = unit 1e6 "ms"
+  | otherwise       = unit 1e9 "s"
+  where
+    unit :: Double -> String -> String
+    unit d u = showFFloat (Just 1) (fromIntegral ns / d) u
@@ -0,0 +1,62 @@
+{-# Language OverloadedStrings #-}
+{-|
+Module      : Client.View.Extensions
+Description : Line renderers for the loaded extension list
+Copyright   : (c) Eric Mertens, 2018
+License     : ISC
+Maintainer  : emertens@gmail.com
+
+This module renders the lines used in the @/extensions@ view.
+-}
+module Client.View.Extensions
+  ( extensionsLines
+  ) where
+
+import           Client.CApi
+import           Client.CApi.Observer
+import           Client.Image.Message
+import           Client.Image.PackedImage
+import           Client.Image.Palette
+import           Client.State
+import           Control.Lens
+import           Data.Semigroup
+import qualified Data.Text as Text
+import           Graphics.Vty.Attributes
+
+-- | Render the lines used by the @/extensions@ view.
+extensionsLines :: ClientState -> Palette -> [Image']
+extensionsLines st pal =
+  summaryLine st pal :
+  [ extensionLine ae pal | ae <- reverse (view (clientExtensions . esActive) st) ] ++
+  [ observerLine obs pal | obs <- reverse (view (clientExtensions . esObservers) st) ]
+
+-- | Render a summary of the message dispatch counters.
+summaryLine :: ClientState -> Palette -> Image'
+summaryLine st pal
+  | null (view (clientExtensions . esActive) st) =
+      text' (view palError pal) "No extensions loaded"
+  | otherwise =
+      text' (view palLabel pal) "Messages not marshaled: " <>
+      string defAttr (show (view (clientExtensions . esSkippedMarshals) st))
+
+-- | Render the name, version, and subscriptions of an extension.
+extensionLine :: ActiveExtension -> Palette -> Image'
+extensionLine ae pal =
+  text' (view palLabel pal) (cleanText (aeName ae)) <>
+  string defAttr (" " ++ show (aeMajorVersion ae) ++ "." ++ show (aeMinorVersion ae)) <>
+  text' defAttr (maybe "" (\cmds -> " [" <> Text.unwords cmds <> "]") (aeCommands ae))
+
+-- | Render the queueing statistics of an observe-only extension.
+observerLine :: Observer -> Palette -> Image'
+observerLine obs pal =
+  text' (view palLabel pal) (cleanText (aeName (observerExtension obs))) <>
+  text' defAttr " observer" <>
+  field "queued"  osQueued <>
+  field "dropped" osDropped <>
+  field "blocked" osBlocked <>
+  field "depth"   osDepth
+  where
+    stats = observerStats obs
+    field lbl f =
+      text' (view palLabel pal) (" " <> lbl <> ": ") <>
+      string defAttr (show (f stats))
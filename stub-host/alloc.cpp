@@ -0,0 +1,84 @@
+// Count the allocations made while an extension callback runs.
+//
+// With glibc the malloc family is wrapped, which catches allocations
+// made by C and C++ extensions alike. Elsewhere only C++ operator new is
+// replaced, so allocations made with malloc are not counted.
+
+#include <cstdlib>
+#include <new>
+
+#include "host.hpp"
+
+namespace {
+
+// Counted per thread so that extensions called at the same time, and
+// threads the extensions start themselves, don't add to each other's
+// callbacks
+thread_local uint64_t count = 0;
+thread_local uint64_t bytes = 0;
+
+void record(size_t n)
+{
+    count++;
+    bytes += n;
+}
+
+} // namespace
+
+uint64_t alloc_count() { return count; }
+uint64_t alloc_bytes() { return bytes; }
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void  __libc_free(void *);
+
+void *malloc(size_t n)
+{
+    record(n);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    record(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n)
+{
+    record(n);
+    return __libc_realloc(p, n);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+} // extern "C"
+
+#else
+
+void *operator new(size_t n)
+{
+    record(n);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/* Synthetic observe-only extension for benchmarking glirc-stub-host.
+ *
+ * Every message costs BUSY_US microseconds of spinning on the CPU, or of
+ * sleeping when GLIRC_BUSY_SLEEP is set in the environment, to stand in
+ * for a recorder or notifier that waits on a disk or socket. The
+ * Makefile builds busy-N.so for a cost of N microseconds.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "glirc-api.h"
+
+#define STR(x)  #x
+#define XSTR(x) STR(x)
+
+#ifndef BUSY_US
+#define BUSY_US 10
+#endif
+
+static int sleeping;
+
+static long long now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void work(size_t n)
+{
+        long long ns = BUSY_US * 1000LL * (long long)n;
+
+        if (sleeping) {
+                struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+                nanosleep(&ts, NULL);
+        } else {
+                long long end = now_ns() + ns;
+                while (now_ns() < end) {}
+        }
+}
+
+static void *start(struct glirc *G, const char *path)
+{
+        (void)G, (void)path;
+        sleeping = getenv("GLIRC_BUSY_SLEEP") != NULL;
+        return NULL;
+}
+
+static enum process_result process_message(struct glirc *G, void *S, const struct glirc_message *msg)
+{
+        (void)G, (void)S, (void)msg;
+        work(1);
+        return PASS_MESSAGE;
+}
+
+static void process_messages(struct glirc *G, void *S, const struct glirc_message * const *msgs,
+                             size_t n, unsigned char *drops)
+{
+        (void)G, (void)S, (void)msgs, (void)drops;
+        work(n);
+}
+
+GLIRC_EXTENSION_API_VERSION;
+
+struct glirc_extension extension = {
+        .name             = "busy-" XSTR(BUSY_US),
+        .major_version    = 1,
+        .minor_version    = 0,
+        .start            = start,
+        .process_message  = process_message,
+        .process_messages = process_messages,
+        .observe_only     = 1,
+};
@@ -0,0 +1,558 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+
+#include "host.hpp"
+
+using namespace std;
+
+namespace {
+
+glirc_string glirc_str(const string &s) { return {s.data(), s.size()}; }
+
+string from_glirc(const char *str, size_t len) { return str ? string(str, len) : string(); }
+
+bool same_id(const string &x, const string &y)
+{
+    return glirc_id_cmp(glirc_str(x), glirc_str(y)) == 0;
+}
+
+// Undo the IRCv3 escaping of a message tag value
+string unescape_tag(const string &s)
+{
+    string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '\\') { out += s[i]; continue; }
+        if (++i == s.size()) break;
+        switch (s[i]) {
+            case ':': out += ';';  break;
+            case 's': out += ' ';  break;
+            case 'r': out += '\r'; break;
+            case 'n': out += '\n'; break;
+            default:  out += s[i]; break;
+        }
+    }
+    return out;
+}
+
+char *copy_string(const string &s)
+{
+    char *p = static_cast<char*>(malloc(s.size() + 1));
+    if (p) memcpy(p, s.c_str(), s.size() + 1);
+    return p;
+}
+
+// NULL-terminated array of malloc'd strings for glirc_free_strings
+template <typename It>
+char **copy_strings(It begin, It end)
+{
+    size_t n = distance(begin, end);
+    char **arr = static_cast<char**>(calloc(n + 1, sizeof *arr));
+    if (!arr) return nullptr;
+    size_t i = 0;
+    for (auto it = begin; it != end; ++it) arr[i++] = copy_string(*it);
+    return arr;
+}
+
+// Nanoseconds since the epoch of a server-time tag value, 0 if malformed
+int64_t server_time_ns(const string &s)
+{
+    struct tm tm {};
+    int frac_start = 0;
+    if (sscanf(s.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &frac_start) != 6) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon  -= 1;
+
+    int64_t ns = 0, scale = 100000000;
+    size_t i = size_t(frac_start);
+    if (i < s.size() && s[i] == '.') {
+        for (i++; i < s.size() && isdigit(static_cast<unsigned char>(s[i])); i++) {
+            ns += (s[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (s.compare(i, string::npos, "Z") != 0) return 0;
+    return int64_t(timegm(&tm)) * 1000000000 + ns;
+}
+
+// Same buckets as latencyBucket in Client.CApi.Stats
+size_t latency_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    size_t bits = 0;
+    while (us) { bits++; us >>= 1; }
+    return min(bits, size_t(GLIRC_STATS_BUCKETS - 1));
+}
+
+} // namespace
+
+Line::Line(Kind kind, string target, string text)
+    : kind(kind), target(move(target)), text(move(text)) {}
+
+bool
+Line::prepare(const string &network)
+{
+    glirc_string net = glirc_str(network);
+
+    switch (kind) {
+        case Chat:
+            chat_ = { net, glirc_str(target), glirc_str(text) };
+            return true;
+        case Command:
+            command_.command = glirc_str(text);
+            return true;
+        case Raw:
+            break;
+    }
+
+    const char *base = text.data();
+    size_t pos = 0, end = text.size();
+
+    auto skip_spaces = [&] { while (pos < end && text[pos] == ' ') pos++; };
+    auto word = [&] {
+        size_t start = pos;
+        while (pos < end && text[pos] != ' ') pos++;
+        return glirc_span { start, pos - start };
+    };
+    auto str = [&](glirc_span s) { return glirc_string { base + s.offset, s.len }; };
+
+    if (pos < end && text[pos] == '@') {
+        pos++;
+        glirc_span tags = word();
+        size_t i = tags.offset, tags_end = tags.offset + tags.len;
+        while (i < tags_end) {
+            size_t semi = min(text.find(';', i), tags_end);
+            size_t eq   = min(text.find('=', i), semi);
+            tag_keys.push_back(text.substr(i, eq - i));
+            tag_vals.push_back(eq < semi ? unescape_tag(text.substr(eq + 1, semi - eq - 1)) : string());
+            i = semi + 1;
+        }
+        skip_spaces();
+    }
+
+    glirc_span prefix {0, 0};
+    if (pos < end && text[pos] == ':') {
+        pos++;
+        prefix = word();
+        skip_spaces();
+    }
+
+    glirc_span cmd = word();
+    if (cmd.len == 0) return false;
+    skip_spaces();
+
+    while (pos < end) {
+        if (text[pos] == ':') {
+            param_spans.push_back({pos + 1, end - pos - 1});
+            break;
+        }
+        param_spans.push_back(word());
+        skip_spaces();
+    }
+
+    for (auto &s : param_spans) params.push_back(str(s));
+    for (auto &k : tag_keys) tagkeys.push_back(glirc_str(k));
+    for (auto &v : tag_vals) tagvals.push_back(glirc_str(v));
+
+    // nick!user@host
+    string p = text.substr(prefix.offset, prefix.len);
+    size_t bang = min(p.find('!'), p.size());
+    size_t at   = min(p.find('@'), p.size());
+    glirc_span nick {prefix.offset, min(bang, at)};
+    glirc_span user {0, 0}, host {0, 0};
+    if (bang < at) user = { prefix.offset + bang + 1, at - bang - 1 };
+    if (at < p.size()) host = { prefix.offset + at + 1, p.size() - at - 1 };
+
+    msg.network      = net;
+    msg.prefix_nick  = str(nick);
+    msg.prefix_user  = str(user);
+    msg.prefix_host  = str(host);
+    msg.command      = str(cmd);
+    msg.command_code = glirc_command_code(msg.command);
+    msg.params       = params.data();
+    msg.params_n     = params.size();
+    msg.tagkeys      = tagkeys.data();
+    msg.tagvals      = tagvals.data();
+    msg.tags_n       = tagkeys.size();
+    msg.raw          = glirc_str(text);
+    msg.prefix_span  = prefix;
+    msg.command_span = cmd;
+    msg.param_spans  = param_spans.data();
+
+    glirc_string absent = glirc_str(batch_type);
+    auto tag_str = [&](const char *key) {
+        for (size_t i = 0; i < tag_keys.size(); i++) {
+            if (tag_keys[i] == key) return tagvals[i];
+        }
+        return absent;
+    };
+    msg.server_time  = server_time_ns(tag("time"));
+    msg.msgid        = tag_str("msgid");
+    msg.account      = tag_str("account");
+    msg.batch_ref    = tag_str("batch");
+    msg.batch_type   = absent;
+    return true;
+}
+
+void
+Line::set_batch_type(string type)
+{
+    batch_type = move(type);
+    msg.batch_type = glirc_str(batch_type);
+}
+
+string Line::command_name() const { return from_glirc(msg.command.str, msg.command.len); }
+
+string Line::prefix_nick() const { return from_glirc(msg.prefix_nick.str, msg.prefix_nick.len); }
+
+string Line::param(size_t i) const
+{
+    return i < params.size() ? from_glirc(params[i].str, params[i].len) : string();
+}
+
+string Line::tag(const string &key) const
+{
+    auto it = find(tag_keys.begin(), tag_keys.end(), key);
+    return it != tag_keys.end() ? tag_vals[it - tag_keys.begin()] : string();
+}
+
+vector<MemberChange>
+glirc::apply(const Line &line)
+{
+    vector<MemberChange> changes;
+    if (line.kind != Line::Raw) return changes;
+
+    Network &net = networks[network_name];
+    string cmd = line.command_name();
+    string who = line.prefix_nick();
+
+    auto remove = [&](const string &chan, const string &nick, member_change_kind kind) {
+        auto it = net.channels.find(chan);
+        if (it == net.channels.end()) return;
+        it->second.erase(nick);
+        if (same_id(nick, net.nick)) net.channels.erase(it);
+        changes.push_back({kind, chan, nick, ""});
+    };
+
+    if (cmd == "001" && line.params_n() >= 1) {
+        net.nick = line.param(0);
+
+    } else if (cmd == "JOIN" && line.params_n() >= 1) {
+        string chan = line.param(0);
+        if (same_id(who, net.nick)) net.channels[chan];
+        auto it = net.channels.find(chan);
+        if (it != net.channels.end()) {
+            it->second.insert(who);
+            changes.push_back({GLIRC_MEMBER_JOIN, chan, who, ""});
+        }
+
+    } else if (cmd == "PART" && line.params_n() >= 1) {
+        remove(line.param(0), who, GLIRC_MEMBER_PART);
+
+    } else if (cmd == "KICK" && line.params_n() >= 2) {
+        remove(line.param(0), line.param(1), GLIRC_MEMBER_KICK);
+
+    } else if (cmd == "QUIT") {
+        for (auto &c : net.channels) {
+            if (c.second.erase(who)) changes.push_back({GLIRC_MEMBER_QUIT, c.first, who, ""});
+        }
+
+    } else if (cmd == "NICK" && line.params_n() >= 1) {
+        string nick = line.param(0);
+        for (auto &c : net.channels) {
+            if (c.second.erase(who)) {
+                c.second.insert(nick);
+                changes.push_back({GLIRC_MEMBER_NICK, c.first, who, nick});
+            }
+        }
+        if (same_id(who, net.nick)) net.nick = nick;
+
+    } else if (cmd == "353" && line.params_n() >= 4) { // RPL_NAMREPLY
+        IdSet &names = net.names[line.param(2)];
+        string list = line.param(3);
+        size_t i = 0;
+        while (i < list.size()) {
+            size_t sp = min(list.find(' ', i), list.size());
+            size_t start = list.find_first_not_of("~&@%+", i);
+            if (start < sp) names.insert(list.substr(start, sp - start));
+            i = sp + 1;
+        }
+
+    } else if (cmd == "366" && line.params_n() >= 2) { // RPL_ENDOFNAMES
+        string chan = line.param(1);
+        auto it = net.channels.find(chan);
+        if (it != net.channels.end()) {
+            it->second = move(net.names[chan]);
+            changes.push_back({GLIRC_MEMBER_RESET, chan, "", ""});
+            for (auto &nick : it->second) changes.push_back({GLIRC_MEMBER_JOIN, chan, nick, ""});
+        }
+        net.names.erase(chan);
+    }
+
+    return changes;
+}
+
+void
+glirc::run_timers()
+{
+    for (;;) {
+        auto it = min_element(timers.begin(), timers.end(),
+                    [](const pair<const timer_id, Timer> &x, const pair<const timer_id, Timer> &y) {
+                        return x.second.due < y.second.due;
+                    });
+        if (it == timers.end() || it->second.due > Clock::now()) return;
+        Timer t = it->second;
+        timers.erase(it);
+        t.cb(this, t.dat);
+    }
+}
+
+void
+glirc::poll_watches()
+{
+    if (watches.empty()) return;
+
+    vector<pollfd> fds;
+    vector<watch_id> ids;
+    for (auto &w : watches) {
+        short events = 0;
+        if (w.second.events & GLIRC_FD_READ)  events |= POLLIN;
+        if (w.second.events & GLIRC_FD_WRITE) events |= POLLOUT;
+        fds.push_back({w.second.fd, events, 0});
+        ids.push_back(w.first);
+    }
+
+    if (poll(fds.data(), fds.size(), 0) <= 0) return;
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        short revents = fds[i].revents;
+        if (revents == 0) continue;
+
+        // an earlier callback may have removed this watch
+        auto it = watches.find(ids[i]);
+        if (it == watches.end()) continue;
+        Watch w = it->second;
+
+        int events = 0;
+        if (revents & (POLLIN | POLLHUP)) events |= GLIRC_FD_READ;
+        if (revents & POLLOUT)            events |= GLIRC_FD_WRITE;
+        if (revents & (POLLERR | POLLNVAL)) {
+            events |= GLIRC_FD_ERROR;
+            watches.erase(it);
+        }
+        w.cb(this, w.dat, w.fd, events);
+    }
+}
+
+//
+// Implementation of glirc-api.h against the in-memory state
+//
+
+int glirc_send_message(struct glirc *G, const struct glirc_message *msg)
+{
+    G->sent++;
+    if (G->verbose) {
+        string line = from_glirc(msg->command.str, msg->command.len);
+        for (size_t i = 0; i < msg->params_n; i++) {
+            line += i + 1 == msg->params_n ? " :" : " ";
+            line += from_glirc(msg->params[i].str, msg->params[i].len);
+        }
+        printf("send: %s\n", line.c_str());
+    }
+    return 0;
+}
+
+int glirc_send_messages(struct glirc *G, const struct glirc_message *msgs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        glirc_send_message(G, &msgs[i]);
+    }
+    return 0;
+}
+
+int glirc_print(struct glirc *G, enum message_code code, const char *msg, size_t msglen)
+{
+    G->printed++;
+    if (G->verbose) {
+        printf("%s: %.*s\n", code == ERROR_MESSAGE ? "error" : "print", int(msglen), msg);
+    }
+    return 0;
+}
+
+int glirc_inject_chat(struct glirc *G,
+                const char* net, size_t netLen,
+                const char* src, size_t srcLen,
+                const char* tgt, size_t tgtLen,
+                const char* msg, size_t msgLen)
+{
+    G->injected++;
+    if (G->verbose) {
+        printf("chat: %.*s %.*s <%.*s> %.*s\n", int(netLen), net, int(tgtLen), tgt,
+               int(srcLen), src, int(msgLen), msg);
+    }
+    return 0;
+}
+
+int glirc_inject_chats(struct glirc *G, const struct glirc_injected_chat *chats, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        auto &c = chats[i];
+        glirc_inject_chat(G, c.network.str, c.network.len, c.source.str, c.source.len,
+                          c.target.str, c.target.len, c.message.str, c.message.len);
+    }
+    return 0;
+}
+
+char ** glirc_list_networks(struct glirc *G)
+{
+    vector<string> names;
+    for (auto &n : G->networks) names.push_back(n.first);
+    return copy_strings(names.begin(), names.end());
+}
+
+char ** glirc_list_channels(struct glirc *G, struct glirc_string network)
+{
+    auto it = G->networks.find(from_glirc(network.str, network.len));
+    if (it == G->networks.end()) return nullptr;
+
+    vector<string> names;
+    for (auto &c : it->second.channels) names.push_back(c.first);
+    return copy_strings(names.begin(), names.end());
+}
+
+char ** glirc_list_channel_users(struct glirc *G, struct glirc_string network, struct glirc_string channel)
+{
+    auto it = G->networks.find(from_glirc(network.str, network.len));
+    if (it == G->networks.end()) return nullptr;
+
+    auto chan = it->second.channels.find(from_glirc(channel.str, channel.len));
+    if (chan == it->second.channels.end()) return nullptr;
+
+    return copy_strings(chan->second.begin(), chan->second.end());
+}
+
+void glirc_current_focus(struct glirc *G, char **net, size_t *netlen, char **tgt , size_t *tgtlen)
+{
+    *net    = copy_string(G->network_name);
+    *netlen = G->network_name.size();
+    if (G->focus_target.empty()) {
+        *tgt    = nullptr;
+        *tgtlen = 0;
+    } else {
+        *tgt    = copy_string(G->focus_target);
+        *tgtlen = G->focus_target.size();
+    }
+}
+
+char * glirc_my_nick(struct glirc *G, const char *net, size_t netlen)
+{
+    auto it = G->networks.find(from_glirc(net, netlen));
+    return it == G->networks.end() ? nullptr : copy_string(it->second.nick);
+}
+
+// Replayed connections never learn a user and host
+char * glirc_my_userinfo(struct glirc *G, const char *net, size_t netlen)
+{
+    return glirc_my_nick(G, net, netlen);
+}
+
+void glirc_mark_seen(struct glirc *, struct glirc_string, struct glirc_string) {}
+
+void glirc_clear_window(struct glirc *, struct glirc_string, struct glirc_string) {}
+
+int glirc_identifier_cmp(struct glirc_string s, struct glirc_string t)
+{
+    return glirc_id_cmp(s, t);
+}
+
+int glirc_is_channel(struct glirc *G, const char *net, size_t netlen,
+                                      const char *tgt, size_t tgtlen)
+{
+    return G->networks.count(from_glirc(net, netlen)) &&
+           tgtlen > 0 && (tgt[0] == '#' || tgt[0] == '&');
+}
+
+int glirc_is_logged_on(struct glirc *G, const char *net, size_t netlen,
+                                        const char *tgt, size_t tgtlen)
+{
+    auto it = G->networks.find(from_glirc(net, netlen));
+    if (it == G->networks.end()) return 0;
+
+    string nick = from_glirc(tgt, tgtlen);
+    for (auto &c : it->second.channels) {
+        if (c.second.count(nick)) return 1;
+    }
+    return 0;
+}
+
+timer_id glirc_timer_start(struct glirc *G, unsigned long millis,
+                timer_callback_type *cb, void *dat)
+{
+    timer_id id = G->next_timer++;
+    G->timers[id] = { Clock::now() + chrono::milliseconds(millis), cb, dat };
+    return id;
+}
+
+void *glirc_timer_cancel(struct glirc *G, timer_id timer)
+{
+    auto it = G->timers.find(timer);
+    if (it == G->timers.end()) return nullptr;
+    void *dat = it->second.dat;
+    G->timers.erase(it);
+    return dat;
+}
+
+watch_id glirc_watch_fd(struct glirc *G, int fd, int events,
+                fd_callback_type *cb, void *dat)
+{
+    watch_id id = G->next_watch++;
+    G->watches[id] = { fd, events, cb, dat };
+    return id;
+}
+
+void *glirc_unwatch_fd(struct glirc *G, watch_id watch)
+{
+    auto it = G->watches.find(watch);
+    if (it == G->watches.end()) return nullptr;
+    void *dat = it->second.dat;
+    G->watches.erase(it);
+    return dat;
+}
+
+int glirc_callback_stats(struct glirc *G, const char *ext, size_t extlen,
+                enum glirc_callback callback, struct glirc_callback_stats *stats)
+{
+    if (from_glirc(ext, extlen) != G->extension_name) return 1;
+    if (callback < 0 || size_t(callback) >= G->stats.size()) return 1;
+
+    const CallbackStats &cs = G->stats[callback];
+    *stats = {};
+    stats->calls    = cs.ns.size();
+    stats->messages = cs.messages;
+    stats->drops    = cs.drops;
+    for (uint64_t ns : cs.ns) {
+        stats->total_ns += ns;
+        stats->max_ns = max(stats->max_ns, ns);
+        stats->histogram[latency_bucket(ns)]++;
+    }
+    return 0;
+}
+
+void glirc_free_string(char *s)
+{
+    free(s);
+}
+
+void glirc_free_strings(char **p)
+{
+    if (!p) return;
+    for (char **s = p; *s; s++) free(*s);
+    free(p);
+}
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef HOST_HPP
+#define HOST_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "glirc-api.h"
+}
+
+using Clock = std::chrono::steady_clock;
+
+// IRC identifiers ordered without regard to case, the way the client
+// compares nicknames and channel names.
+struct IdLess {
+    bool operator()(const std::string &x, const std::string &y) const {
+        return glirc_id_cmp({x.data(), x.size()}, {y.data(), y.size()}) < 0;
+    }
+};
+
+using IdSet = std::set<std::string, IdLess>;
+
+struct Network {
+    std::string nick;
+    std::map<std::string, IdSet, IdLess> channels; // members of joined channels
+    std::map<std::string, IdSet, IdLess> names;    // RPL_NAMREPLY not yet ended
+};
+
+struct Timer {
+    Clock::time_point due;
+    timer_callback_type *cb;
+    void *dat;
+};
+
+struct Watch {
+    int fd;
+    int events;
+    fd_callback_type *cb;
+    void *dat;
+};
+
+// Membership change with its own copies of the strings
+struct MemberChange {
+    member_change_kind kind;
+    std::string channel, nick, new_nick;
+};
+
+// Timings of one callback
+struct CallbackStats {
+    std::vector<uint64_t> ns; // duration of each call
+    unsigned long messages = 0;
+    unsigned long drops = 0;
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+};
+
+// One line of a message file, ready to hand to an extension
+class Line {
+public:
+    enum Kind { Raw, Chat, Command };
+
+    Kind kind;
+    std::string target; // Chat only
+    std::string text;   // line as received, chat message, or command
+
+    Line(Kind kind, std::string target, std::string text);
+    Line(const Line &) = delete;
+    Line &operator=(const Line &) = delete;
+
+    // Parse a raw line and point the marshaled structures at this line.
+    // Returns false when a raw line has no command.
+    bool prepare(const std::string &network);
+
+    // Type of the batch the message belongs to, tracked by the reader
+    void set_batch_type(std::string type);
+
+    const glirc_message *message() const { return &msg; }
+    const glirc_chat *chat() const { return &chat_; }
+    const glirc_command *command() const { return &command_; }
+
+    std::string command_name() const;
+    std::string prefix_nick() const;
+    std::string param(size_t i) const;
+    std::string tag(const std::string &key) const;
+    size_t params_n() const { return params.size(); }
+
+private:
+    std::vector<std::string> tag_keys, tag_vals;
+    std::vector<glirc_string> tagkeys, tagvals, params;
+    std::vector<glirc_span> param_spans;
+    std::string batch_type;
+    glirc_message msg {};
+    glirc_chat chat_ {};
+    glirc_command command_ {};
+};
+
+// Client state seen by the extension through the glirc_* functions
+struct glirc {
+    std::string network_name;
+    std::map<std::string, Network> networks;
+    std::string focus_target; // empty for the network window
+
+    std::string extension_name;
+    std::array<CallbackStats, 4> stats; // indexed by enum glirc_callback
+
+    std::map<timer_id, Timer> timers;
+    timer_id next_timer = 1;
+    std::map<watch_id, Watch> watches;
+    watch_id next_watch = 1;
+
+    bool verbose = false;
+    unsigned long sent = 0, printed = 0, injected = 0;
+
+    // Update the networks with a line the extension passed and return the
+    // resulting membership changes.
+    std::vector<MemberChange> apply(const Line &line);
+
+    // Call the callbacks of expired timers and ready file descriptors
+    void run_timers();
+    void poll_watches();
+};
+
+// Allocations made by the calling thread so far
+uint64_t alloc_count();
+uint64_t alloc_bytes();
+
+#endif
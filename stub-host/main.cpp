@@ -0,0 +1,486 @@
+// Standalone host for glirc extensions.
+//
+// glirc-stub-host loads extensions the way the client does and replays
+// a message file through their callbacks, reporting throughput, latency,
+// and allocations for each callback. The glirc_* functions work against
+// in-memory networks, channels, and users that follow the replayed JOIN,
+// PART, KICK, QUIT, and NICK messages and NAMES replies. Each extension
+// is given its own copy of this state.
+//
+// Each line of the message file is one of:
+//
+//   a raw IRC line as received    process_message or process_messages
+//   > TARGET TEXT                 process_chat
+//   / TEXT                        process_command of every extension
+//
+// Blank lines and lines starting with # are skipped. Messages are handed
+// to process_messages in bursts of -b lines. With -w the host keeps
+// firing timers and fd watches for that many milliseconds after the
+// replay, for extensions that finish their work on other threads.
+//
+// Extensions that can drop messages see a burst one after another in the
+// order they were loaded. Observe-only extensions then get the messages
+// that were kept. They can't affect each other, so they are called at
+// the same time from -j threads, and the host waits for all of them
+// before the next burst. The dispatch latency of each burst is reported.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "host.hpp"
+#include "pool.hpp"
+
+using namespace std;
+
+namespace {
+
+struct Options {
+    string network = "bench";
+    string nick = "bench";
+    string focus;
+    unsigned long repeat = 1;
+    size_t burst = 1;
+    size_t jobs = 0; // 0 for one thread per observe-only extension
+    unsigned long wait_ms = 0;
+    bool verbose = false;
+    const char *messages = nullptr;
+    vector<const char *> extensions;
+};
+
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n NETWORK] [-N NICK] [-f TARGET] [-r REPEAT] [-b BURST] [-j THREADS]"
+            " [-m MESSAGES] [-w MILLIS] [-v] EXTENSION...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+Options parse_options(int argc, char **argv)
+{
+    Options o;
+    int c;
+    while ((c = getopt(argc, argv, "n:N:f:r:b:j:m:w:v")) != -1) {
+        switch (c) {
+            case 'n': o.network = optarg; break;
+            case 'N': o.nick = optarg; break;
+            case 'f': o.focus = optarg; break;
+            case 'r': o.repeat = strtoul(optarg, nullptr, 10); break;
+            case 'b': o.burst = max(1ul, strtoul(optarg, nullptr, 10)); break;
+            case 'j': o.jobs = max(1ul, strtoul(optarg, nullptr, 10)); break;
+            case 'm': o.messages = optarg; break;
+            case 'w': o.wait_ms = strtoul(optarg, nullptr, 10); break;
+            case 'v': o.verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind == argc) usage(argv[0]);
+    o.extensions.assign(argv + optind, argv + argc);
+    return o;
+}
+
+// Read a message file. Lines are stored in a deque so that the marshaled
+// structures can point into them. Open batches are tracked like the
+// client does so that messages in them carry the batch type.
+bool read_lines(istream &in, const string &network, deque<Line> &lines)
+{
+    string text;
+    unsigned long lineno = 0;
+    map<string, string> batches;
+    while (getline(in, text)) {
+        lineno++;
+        if (!text.empty() && text.back() == '\r') text.pop_back();
+        if (text.empty() || text[0] == '#') continue;
+
+        if (text[0] == '>') {
+            size_t start = min(text.find_first_not_of(' ', 1), text.size());
+            size_t sp    = min(text.find(' ', start), text.size());
+            lines.emplace_back(Line::Chat, text.substr(start, sp - start),
+                               sp < text.size() ? text.substr(sp + 1) : string());
+        } else if (text[0] == '/') {
+            size_t start = min(text.find_first_not_of(' ', 1), text.size());
+            lines.emplace_back(Line::Command, string(), text.substr(start));
+        } else {
+            lines.emplace_back(Line::Raw, string(), text);
+        }
+
+        Line &line = lines.back();
+        if (!line.prepare(network)) {
+            fprintf(stderr, "line %lu: missing command\n", lineno);
+            return false;
+        }
+
+        if (line.kind != Line::Raw) continue;
+        auto open = batches.find(line.tag("batch"));
+        if (open != batches.end()) line.set_batch_type(open->second);
+
+        string ref = line.param(0);
+        if (line.command_name() == "BATCH" && !ref.empty()) {
+            if (ref[0] == '+' && line.params_n() >= 2) batches[ref.substr(1)] = line.param(1);
+            else if (ref[0] == '-') batches.erase(ref.substr(1));
+        }
+    }
+    return true;
+}
+
+// Time one call into the extension and count the allocations it made
+class Timing {
+    CallbackStats &stats;
+    Clock::time_point start;
+    uint64_t allocs, bytes;
+
+public:
+    Timing(glirc &G, glirc_callback cb, unsigned long messages)
+        : stats(G.stats[cb]), start(Clock::now()),
+          allocs(alloc_count()), bytes(alloc_bytes())
+    {
+        stats.messages += messages;
+    }
+
+    ~Timing()
+    {
+        auto end = Clock::now();
+        stats.allocs      += alloc_count() - allocs;
+        stats.alloc_bytes += alloc_bytes() - bytes;
+        stats.ns.push_back(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    }
+
+    Timing(const Timing &) = delete;
+    Timing &operator=(const Timing &) = delete;
+
+    void drops(unsigned long n) { stats.drops += n; }
+};
+
+// Loaded extension, read according to its glirc_extension_api_version
+// like activateExtension does
+class Extension {
+    void *dl = nullptr;
+    glirc_extension *fgn = nullptr;
+    int api_version = 0; // 0 when the symbol is missing
+    void *session = nullptr;
+    vector<string> commands; // empty for every command
+
+public:
+    Extension() = default;
+    Extension(const Extension &) = delete;
+    Extension &operator=(const Extension &) = delete;
+
+    bool load(glirc &G, const char *path)
+    {
+        dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!dl) {
+            fprintf(stderr, "%s\n", dlerror());
+            return false;
+        }
+
+        fgn = static_cast<glirc_extension*>(dlsym(dl, "extension"));
+        if (!fgn) {
+            fprintf(stderr, "%s\n", dlerror());
+            return false;
+        }
+
+        auto version = static_cast<const int*>(dlsym(dl, "glirc_extension_api_version"));
+        if (version) api_version = *version;
+
+        if (since(1) && fgn->message_commands) {
+            for (auto c = fgn->message_commands; *c; c++) commands.push_back(*c);
+        }
+
+        G.extension_name = fgn->name;
+        if (fgn->start) {
+            Timing t(G, GLIRC_CALLBACK_START, 0);
+            session = fgn->start(&G, path);
+        }
+        return true;
+    }
+
+    void unload(glirc &G)
+    {
+        if (fgn && fgn->stop) fgn->stop(&G, session);
+        if (dl) dlclose(dl);
+        fgn = nullptr;
+        dl = nullptr;
+    }
+
+    bool since(int version) const { return api_version >= version; }
+
+    bool observe_only() const { return since(3) && fgn->observe_only; }
+
+    bool wants(const Line &line) const
+    {
+        if (!fgn->process_message && !(since(2) && fgn->process_messages)) return false;
+        return commands.empty() ||
+               find(commands.begin(), commands.end(), line.command_name()) != commands.end();
+    }
+
+    // Deliver a burst of messages and return which ones were dropped
+    vector<bool> messages(glirc &G, const vector<const Line*> &burst) const
+    {
+        vector<bool> dropped(burst.size());
+        vector<size_t> todo;
+        for (size_t i = 0; i < burst.size(); i++) {
+            if (wants(*burst[i])) todo.push_back(i);
+        }
+        if (todo.empty()) return dropped;
+
+        if (since(2) && fgn->process_messages) {
+            vector<const glirc_message*> msgs;
+            for (size_t i : todo) msgs.push_back(burst[i]->message());
+            vector<unsigned char> bits((todo.size() + 7) / 8);
+
+            {
+                Timing t(G, GLIRC_CALLBACK_MESSAGE, todo.size());
+                fgn->process_messages(&G, session, msgs.data(), msgs.size(), bits.data());
+                if (!observe_only()) {
+                    for (size_t j = 0; j < todo.size(); j++) {
+                        if (bits[j / 8] & (1u << (j % 8))) dropped[todo[j]] = true;
+                    }
+                    t.drops(count(dropped.begin(), dropped.end(), true));
+                }
+            }
+        } else {
+            for (size_t i : todo) {
+                Timing t(G, GLIRC_CALLBACK_MESSAGE, 1);
+                bool drop = fgn->process_message(&G, session, burst[i]->message()) == DROP_MESSAGE;
+                if (drop && !observe_only()) {
+                    dropped[i] = true;
+                    t.drops(1);
+                }
+            }
+        }
+        return dropped;
+    }
+
+    bool chat(glirc &G, const Line &line) const
+    {
+        if (!fgn->process_chat) return false;
+        Timing t(G, GLIRC_CALLBACK_CHAT, 1);
+        bool drop = fgn->process_chat(&G, session, line.chat()) == DROP_MESSAGE;
+        if (drop) t.drops(1);
+        return drop;
+    }
+
+    void command(glirc &G, const Line &line) const
+    {
+        if (!fgn->process_command) return;
+        Timing t(G, GLIRC_CALLBACK_COMMAND, 0);
+        fgn->process_command(&G, session, line.command());
+    }
+
+    void member_changes(glirc &G, const vector<MemberChange> &changes) const
+    {
+        if (changes.empty() || !since(4) || !fgn->process_member_changes) return;
+
+        glirc_string net = { G.network_name.data(), G.network_name.size() };
+        auto str = [](const string &s) { return glirc_string { s.data(), s.size() }; };
+        vector<glirc_member_change> fgn_changes;
+        for (auto &c : changes) {
+            fgn_changes.push_back({c.kind, net, str(c.channel), str(c.nick), str(c.new_nick)});
+        }
+        fgn->process_member_changes(&G, session, fgn_changes.data(), fgn_changes.size());
+    }
+};
+
+// An extension and the client state it sees
+struct Loaded {
+    glirc G;
+    Extension ext;
+};
+
+// Hand the lines to the extensions and apply the ones they keep.
+// Returns the time taken to dispatch each burst.
+vector<uint64_t> replay(vector<unique_ptr<Loaded>> &exts, WorkerPool &pool,
+                        const deque<Line> &lines, const Options &o)
+{
+    vector<Loaded*> droppers, observers;
+    for (auto &l : exts) {
+        (l->ext.observe_only() ? observers : droppers).push_back(l.get());
+    }
+
+    vector<uint64_t> dispatch_ns;
+    dispatch_ns.reserve(lines.size() * o.repeat / o.burst + 1);
+
+    vector<const Line*> burst;
+    function<void(size_t)> observe =
+        [&](size_t i) { observers[i]->ext.messages(observers[i]->G, burst); };
+
+    auto flush = [&] {
+        if (burst.empty()) return;
+        auto start = Clock::now();
+
+        // each extension only sees what the ones before it kept
+        for (auto l : droppers) {
+            vector<bool> dropped = l->ext.messages(l->G, burst);
+            size_t kept = 0;
+            for (size_t i = 0; i < burst.size(); i++) {
+                if (!dropped[i]) burst[kept++] = burst[i];
+            }
+            burst.resize(kept);
+        }
+
+        pool.run(observers.size(), observe);
+
+        dispatch_ns.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count());
+
+        for (auto &l : exts) {
+            vector<MemberChange> changes;
+            for (auto line : burst) {
+                for (auto &c : l->G.apply(*line)) changes.push_back(move(c));
+            }
+            l->ext.member_changes(l->G, changes);
+            l->G.run_timers();
+            l->G.poll_watches();
+        }
+        burst.clear();
+    };
+
+    for (unsigned long r = 0; r < o.repeat; r++) {
+        for (auto &line : lines) {
+            switch (line.kind) {
+                case Line::Raw:
+                    burst.push_back(&line);
+                    if (burst.size() >= o.burst) flush();
+                    break;
+                case Line::Chat:
+                    flush();
+                    for (auto &l : exts) {
+                        if (l->ext.chat(l->G, line)) break;
+                    }
+                    break;
+                case Line::Command:
+                    flush();
+                    for (auto &l : exts) l->ext.command(l->G, line);
+                    break;
+            }
+        }
+    }
+    flush();
+    return dispatch_ns;
+}
+
+string show_ns(double ns)
+{
+    char buf[32];
+    if      (ns < 1e3) snprintf(buf, sizeof buf, "%.0fns", ns);
+    else if (ns < 1e6) snprintf(buf, sizeof buf, "%.1fus", ns / 1e3);
+    else if (ns < 1e9) snprintf(buf, sizeof buf, "%.1fms", ns / 1e6);
+    else               snprintf(buf, sizeof buf, "%.2fs",  ns / 1e9);
+    return buf;
+}
+
+void report_dispatch(vector<uint64_t> ns, unsigned long lines, double seconds, size_t threads)
+{
+    printf("%lu lines in %.3f s, %.0f lines/s\n",
+           lines, seconds, seconds > 0 ? lines / seconds : 0.0);
+    if (ns.empty()) return;
+
+    sort(ns.begin(), ns.end());
+    double total = 0;
+    for (uint64_t x : ns) total += x;
+    printf("dispatch of %zu bursts with %zu threads: mean %s, p50 %s, p99 %s, max %s\n",
+           ns.size(), threads,
+           show_ns(total / ns.size()).c_str(),
+           show_ns(ns[(ns.size() - 1) / 2]).c_str(),
+           show_ns(ns[(ns.size() - 1) * 99 / 100]).c_str(),
+           show_ns(ns.back()).c_str());
+}
+
+void report(const glirc &G)
+{
+    static const char * const names[] = {
+        "start", "process_message", "process_chat", "process_command"
+    };
+
+    printf("\n%s: sent %lu, printed %lu, injected %lu\n",
+           G.extension_name.c_str(), G.sent, G.printed, G.injected);
+    printf("%-16s %9s %9s %7s %10s %8s %8s %8s %12s %11s\n",
+           "callback", "calls", "messages", "drops", "msg/s",
+           "p50", "p99", "max", "allocs/call", "bytes/call");
+
+    for (size_t i = 0; i < G.stats.size(); i++) {
+        const CallbackStats &cs = G.stats[i];
+        if (cs.ns.empty()) continue;
+
+        vector<uint64_t> ns = cs.ns;
+        sort(ns.begin(), ns.end());
+        double total = 0;
+        for (uint64_t x : ns) total += x;
+        double calls = ns.size();
+
+        printf("%-16s %9zu %9lu %7lu %10.0f %8s %8s %8s %12.1f %11.1f\n",
+               names[i], ns.size(), cs.messages, cs.drops,
+               total > 0 ? cs.messages / (total / 1e9) : 0.0,
+               show_ns(ns[(ns.size() - 1) / 2]).c_str(),
+               show_ns(ns[(ns.size() - 1) * 99 / 100]).c_str(),
+               show_ns(ns.back()).c_str(),
+               cs.allocs / calls, cs.alloc_bytes / calls);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o = parse_options(argc, argv);
+
+    deque<Line> lines;
+    bool ok;
+    if (o.messages) {
+        ifstream in(o.messages);
+        if (!in) {
+            fprintf(stderr, "%s: %s\n", o.messages, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        ok = read_lines(in, o.network, lines);
+    } else {
+        ok = read_lines(cin, o.network, lines);
+    }
+    if (!ok) return EXIT_FAILURE;
+
+    vector<unique_ptr<Loaded>> exts;
+    size_t observers = 0;
+    for (auto path : o.extensions) {
+        exts.emplace_back(new Loaded);
+        glirc &G = exts.back()->G;
+        G.network_name = o.network;
+        G.networks[o.network].nick = o.nick;
+        G.focus_target = o.focus;
+        G.verbose = o.verbose;
+        for (auto &cs : G.stats) cs.ns.reserve(lines.size() * o.repeat);
+
+        if (!exts.back()->ext.load(G, path)) return EXIT_FAILURE;
+        if (exts.back()->ext.observe_only()) observers++;
+    }
+
+    size_t threads = min(o.jobs ? o.jobs : observers, max<size_t>(observers, 1));
+    WorkerPool pool(threads - 1);
+
+    auto start = Clock::now();
+    auto dispatch_ns = replay(exts, pool, lines, o);
+    chrono::duration<double> elapsed = Clock::now() - start;
+
+    auto until = Clock::now() + chrono::milliseconds(o.wait_ms);
+    while (Clock::now() < until) {
+        for (auto &l : exts) {
+            l->G.run_timers();
+            l->G.poll_watches();
+        }
+        usleep(1000);
+    }
+
+    report_dispatch(move(dispatch_ns), lines.size() * o.repeat, elapsed.count(), threads);
+    for (auto &l : exts) {
+        report(l->G);
+        l->ext.unload(l->G);
+    }
+    return EXIT_SUCCESS;
+}
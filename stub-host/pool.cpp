@@ -0,0 +1,69 @@
+#include "pool.hpp"
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        threads.emplace_back([this] { work(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto &t : threads) t.join();
+}
+
+void WorkerPool::run(size_t n, const function<void(size_t)> &f)
+{
+    if (n == 0) return;
+
+    if (threads.empty() || n == 1) {
+        for (size_t i = 0; i < n; i++) f(i);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(m);
+        job = &f;
+        jobs = n;
+        next = 0;
+        running = threads.size();
+        generation++;
+    }
+    start_cv.notify_all();
+
+    drain();
+
+    unique_lock<mutex> lock(m);
+    done_cv.wait(lock, [this] { return running == 0; });
+}
+
+// Every worker takes part in every batch, so a worker can't miss one
+// and run() can't start the next while a worker is still in drain()
+void WorkerPool::work()
+{
+    unsigned long seen = 0;
+    unique_lock<mutex> lock(m);
+    for (;;) {
+        start_cv.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+
+        lock.unlock();
+        drain();
+        lock.lock();
+
+        if (--running == 0) done_cv.notify_one();
+    }
+}
+
+void WorkerPool::drain()
+{
+    for (size_t i; (i = next.fetch_add(1)) < jobs; ) (*job)(i);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that share the jobs of one batch at a time. The
+// calling thread works on the batch too, so a pool of n threads runs up
+// to n + 1 jobs at once.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Call job(i) for each i below n and return when all calls are done
+    void run(size_t n, const std::function<void(size_t)> &job);
+
+private:
+    void work();
+    void drain();
+
+    std::mutex m;
+    std::condition_variable start_cv, done_cv;
+    std::vector<std::thread> threads;
+
+    const std::function<void(size_t)> *job = nullptr;
+    size_t jobs = 0;
+    std::atomic<size_t> next {0};
+    size_t running = 0;          // workers still on the current batch
+    unsigned long generation = 0; // batches started
+    bool stopping = false;
+};
+
+#endif
@@ -1,4 +1,4 @@
-{-# Language GADTs #-}
+{-# Language GADTs, ForeignFunctionInterface #-}
 {-|
 Module      : Main
 Description : Tests for the glirc library
@@ -11,9 +11,27 @@ This module test various components of glirc
 -}
 module Main (main) where
 
+import           Client.CApi (burstBatchTypes, serverTimeNanos)
+import           Client.CApi.Types (CommandCode(..), commandCode)
+import           Client.CApi.Stats
 import           Client.Commands.Arguments.Spec
 import           Client.Commands.Arguments.Parser
+import           Client.TimerWheel
 import           Control.Applicative
+import qualified Data.ByteString as B
+import qualified Data.HashMap.Strict as HashMap
+import qualified Data.IntMap as IntMap
+import qualified Data.Map as Map
+import           Data.Maybe (mapMaybe)
+import           Data.Text (Text)
+import qualified Data.Text as Text
+import qualified Data.Text.Encoding as Text
+import           Data.Word
+import           Foreign.C
+import           Foreign.Marshal
+import           Foreign.Ptr
+import           Irc.Identifier
+import           Irc.RawIrcMsg
 import           System.Exit
 import           Test.HUnit
 
@@ -25,7 +43,7 @@ main =
        else exitFailure
 
 tests :: Test
-tests = test [ argumentParserTests ]
+tests = test [ argumentParserTests, timerWheelTests, identifierTests, statsTests, capiTests ]
 
 argumentParserTests :: Test
 argumentParserTests = test
@@ -71,3 +89,146 @@ argumentParserTests = test
        (Just ("some", " text here"))
        (parse () (liftA2 (,) (simpleToken "first") (remainingArg "second")) "  some  text here")
   ]
+
+timerWheelTests :: Test
+timerWheelTests = test
+  [ assertEqual "fires in deadline order"
+       ["a","b","c"]
+       (fst (advanceTimers 1000000 wheel))
+
+  , assertEqual "only due timers fire"
+       ["a"]
+       (fst (advanceTimers 1050 wheel))
+
+  , assertEqual "later advance fires the rest"
+       ["b","c"]
+       (fst (advanceTimers 1000000 (snd (advanceTimers 1050 wheel))))
+
+  , assertEqual "canceled timers don't fire"
+       ["a","c"]
+       (fst (advanceTimers 1000000 canceled))
+
+  , assertEqual "cancel returns the value"
+       (Just "b")
+       (fst <$> cancelTimer idB wheel)
+
+  , assertEqual "cancel after firing fails"
+       Nothing
+       (fst <$> cancelTimer idB (snd (advanceTimers 1000000 wheel)))
+
+  , assertEqual "next tick bounds the earliest deadline"
+       True
+       (maybe False (<= 1040) (nextTimerTick wheel))
+  ]
+  where
+    (_  , w1) = insertTimer 500000 "c" (emptyTimerWheel 1000)
+    (idB, w2) = insertTimer 70000  "b" w1
+    (_  , wheel) = insertTimer 1040 "a" w2
+    canceled = maybe wheel snd (cancelTimer idB wheel)
+
+statsTests :: Test
+statsTests = test
+  [ assertEqual "bucket boundaries"
+       [0,0,1,1,2,2,3,10,histogramBuckets-1]
+       (map latencyBucket [0,999,1000,1999,2000,3999,4000,1000000,maxBound])
+
+  , do stats <- newExtensionStats 0
+       _ <- timeCallback stats CallbackMessage 3 (const 1) (return ())
+       _ <- timeCallback stats CallbackMessage 2 (const 0) (return ())
+       m <- readExtensionStats stats
+       slow <- takeSlowCalls stats
+       let Just cs = Map.lookup CallbackMessage m
+       assertEqual "calls"    2 (cbCalls cs)
+       assertEqual "messages" 5 (cbMessages cs)
+       assertEqual "drops"    1 (cbDrops cs)
+       assertEqual "histogram total" 2 (sum (IntMap.elems (cbHistogram cs)))
+       assertEqual "only called callbacks" [CallbackMessage] (Map.keys m)
+       assertEqual "disabled threshold" 0 (length slow)
+  ]
+
+capiTests :: Test
+capiTests = test $
+  [ assertEqual "epoch" (Just 0) (serverTimeNanos (Text.pack "1970-01-01T00:00:00Z"))
+  , assertEqual "milliseconds" (Just 1500000000) (serverTimeNanos (Text.pack "1970-01-01T00:00:01.5Z"))
+  , assertEqual "nanoseconds" (Just 1525089600123456789)
+      (serverTimeNanos (Text.pack "2018-04-30T12:00:00.1234567891Z"))
+  , assertEqual "invalid date" Nothing (serverTimeNanos (Text.pack "2018-02-30T12:00:00.000Z"))
+  , assertEqual "missing zone" Nothing (serverTimeNanos (Text.pack "2018-04-30T12:00:00.000"))
+
+  , assertEqual "batch types"
+      (map Text.pack ["", "chathistory", "", "netjoin", ""])
+      (burstBatchTypes (HashMap.singleton (Text.pack "old") (Text.pack "netjoin")) burst)
+
+  , assertBool "known verb" (commandCode (Text.pack "PRIVMSG") /= CommandCode 0)
+  ] ++
+
+  [ do code <- B.useAsCStringLen (Text.encodeUtf8 cmd) $ \(p, n) ->
+                 c_command_code p (fromIntegral n)
+       let CommandCode expected = commandCode cmd
+       assertEqual ("command code " ++ show cmd) expected code
+  | cmd <- map Text.pack commands ]
+  where
+    -- every verb in glirc-codes.h and some that are not commands
+    commands =
+      [ "ACCOUNT", "AUTHENTICATE", "AWAY", "BATCH", "CAP", "CHGHOST", "ERROR"
+      , "INVITE", "JOIN", "KICK", "MODE", "NICK", "NOTICE", "PART", "PING"
+      , "PONG", "PRIVMSG", "QUIT", "TAGMSG", "TOPIC", "WALLOPS"
+      , "001", "005", "433", "999", "000", "1000", "12a", "", "privmsg", "PRIVMS", "FOO" ]
+
+    burst = mapMaybe (parseRawIrcMsg . Text.pack)
+      [ ":irc.example BATCH +abc chathistory #chan"
+      , "@batch=abc :nick PRIVMSG #chan :replayed"
+      , ":irc.example BATCH -abc"
+      , "@batch=old :nick JOIN #chan"
+      , "@batch=abc :nick PRIVMSG #chan :late"
+      ]
+
+foreign import ccall unsafe "test_command_code"
+  c_command_code :: CString -> CSize -> IO CInt
+
+foreign import ccall unsafe "test_id_casefold"
+  c_id_casefold :: Ptr CChar -> CString -> CSize -> IO ()
+
+foreign import ccall unsafe "test_id_cmp"
+  c_id_cmp :: CString -> CSize -> CString -> CSize -> IO CInt
+
+foreign import ccall unsafe "test_id_hash"
+  c_id_hash :: CString -> CSize -> IO Word64
+
+-- | Check the identifier functions in glirc-api.h against "Irc.Identifier"
+identifierTests :: Test
+identifierTests = test $
+  [ do folded <- cCasefold x
+       assertEqual ("casefold " ++ show x) (Text.encodeUtf8 (idTextNorm (mkId x))) folded
+  | x <- samples ] ++
+
+  [ do ordering <- cCompare x y
+       assertEqual ("compare " ++ show (x, y)) (compare (mkId x) (mkId y)) ordering
+  | x <- samples, y <- samples ] ++
+
+  [ do h <- cHash x
+       assertEqual ("hash " ++ show x) (idHash64 (mkId x)) h
+  | x <- samples ]
+  where
+    samples :: [Text]
+    samples = map Text.singleton ['\0' .. '\x7f']
+           ++ map Text.pack
+                [ "", "glguy", "GLGUY", "[foo]", "{FOO}", "a^b", "A~B", "nick|away"
+                , "NICK\\AWAY", "ab", "abc", "abd", "#chan", "#Chan", "\xfc\&ber"
+                , "\xdc\&BER", "\x2603" ]
+
+    withBytes x = B.useAsCStringLen (Text.encodeUtf8 x)
+
+    cCasefold x =
+      withBytes x $ \(p, n) ->
+      allocaBytes n $ \dst ->
+        do c_id_casefold dst p (fromIntegral n)
+           B.packCStringLen (dst, n)
+
+    cCompare x y =
+      withBytes x $ \(p, n) ->
+      withBytes y $ \(q, m) ->
+        do r <- c_id_cmp p (fromIntegral n) q (fromIntegral m)
+           return (compare r 0)
+
+    cHash x = withBytes x $ \(p, n) -> c_id_hash p (fromIntegral n)
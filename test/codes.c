@@ -0,0 +1,10 @@
+#include "glirc-api.h"
+
+/* Out-of-line wrapper so the tests can compare glirc_command_code with
+ * the code the client marshals. */
+
+int test_command_code(const char *s, size_t len)
+{
+        struct glirc_string x = { s, len };
+        return glirc_command_code(x);
+}
@@ -0,0 +1,21 @@
+#include "glirc-api.h"
+
+/* Out-of-line wrappers so the tests can call the inline identifier
+ * functions from glirc-api.h through the FFI. */
+
+void test_id_casefold(char *dst, const char *src, size_t len)
+{
+        glirc_id_casefold(dst, src, len);
+}
+
+int test_id_cmp(const char *s, size_t slen, const char *t, size_t tlen)
+{
+        struct glirc_string x = { s, slen }, y = { t, tlen };
+        return glirc_id_cmp(x, y);
+}
+
+uint64_t test_id_hash(const char *s, size_t len)
+{
+        struct glirc_string x = { s, len };
+        return glirc_id_hash(x);
+}